@@ -0,0 +1,510 @@
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "SegmentSink.hpp"
+#include "Turtle.hpp"
+
+/*
+ * End-to-end scaling sweep over the grammars of the samples.
+ *
+ * Every combination of grammar, depth, canvas size and thread count is evaluated, drawn and rasterized in a forked
+ * child process, so its peak resident set size is not inflated by the configurations run before it. The results
+ * are written as CSV and can be compared against a baseline CSV: a configuration fails if it is slower than its
+ * baseline by more than the tolerance plus the slack, or if the hash of its image differs, so a speedup only passes
+ * if it is pixel-exact. A configuration also fails if its image differs from the one drawn with another thread
+ * count, since the thread count must never change the image.
+ *
+ * The output starts with comment lines describing the machine. Timings of a baseline are only compared for thread
+ * counts its machine could run in parallel; images are always compared.
+ *
+ * Usage: lsys-bench [--baseline FILE] [--tolerance FRACTION] [--slack MS] [--output FILE] [--repeat N]
+ *                   [--grammars NAMES] [--sizes PIXELS] [--threads COUNTS]
+ *
+ * Lists are comma separated. The output is itself a valid baseline (e.g. --output bench/baseline.csv).
+ */
+
+struct GrammarCase
+{
+    const char* name;
+    lsys::Transform2d start;
+    std::vector<unsigned int> depths;
+    void (*setup)(lsys::Lsystem& lsystem);
+};
+
+struct Configuration
+{
+    const GrammarCase* grammar;
+    unsigned int depth;
+    unsigned short size;
+    unsigned int threads;
+};
+
+struct Measurement
+{
+    double wall_ms;
+    long peak_rss_kb;
+    uint64_t symbols;
+    uint64_t image_hash;
+};
+
+/**
+ * Grammar, depth, width, height and thread count of a result.
+ */
+using ResultKey = std::tuple<std::string, unsigned int, unsigned int, unsigned int, unsigned int>;
+
+/**
+ * Tracks the bounds of everything the turtle draws, to fit the drawing to the canvas viewport.
+ */
+class BoundsSink : public lsys::graphics::SegmentSink
+{
+public:
+    void addSegment(lsys::graphics::Point2d start, lsys::graphics::Point2d end) override
+    {
+        for (const auto& point : {start, end})
+        {
+            if (empty)
+            {
+                bounds = {point.x, point.y, point.x, point.y};
+                empty = false;
+                continue;
+            }
+            bounds.min_x = std::min(bounds.min_x, point.x);
+            bounds.min_y = std::min(bounds.min_y, point.y);
+            bounds.max_x = std::max(bounds.max_x, point.x);
+            bounds.max_y = std::max(bounds.max_y, point.y);
+        }
+    }
+
+    lsys::graphics::Bounds2d bounds = {0, 0, 0, 0};
+    bool empty = true;
+};
+
+void setupBinaryFractal(lsys::Lsystem& lsystem)
+{
+    lsystem.setAxiom("0");
+    lsystem.addSymbol('0', nullptr);
+    lsystem.addSymbol('1', std::make_shared<lsys::MoveForwardCommand>(5));
+    lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+    lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(45));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-45));
+    lsystem.addRule('0', "1[+0]-0");
+    lsystem.addRule('1', "11");
+}
+
+void setupKochCurve(lsys::Lsystem& lsystem)
+{
+    lsystem.setAxiom("F");
+    lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(5));
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(90));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-90));
+    lsystem.addRule('F', "F+F-F-F+F");
+}
+
+void setupSierpinskiTriangle(lsys::Lsystem& lsystem)
+{
+    lsystem.setAxiom("F-G-G");
+    lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(20));
+    lsystem.addSymbol('G', std::make_shared<lsys::MoveForwardCommand>(20));
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(120));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-120));
+    lsystem.addRule('F', "F-G+F+G-F");
+    lsystem.addRule('G', "GG");
+}
+
+void setupFractalPlant(lsys::Lsystem& lsystem)
+{
+    lsystem.setAxiom("X");
+    lsystem.addSymbol('X', nullptr);
+    lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(15));
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(25));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-25));
+    lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+    lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+    lsystem.addRule('X', "F+[[X]-X]-F[-FX]+X");
+    lsystem.addRule('F', "FF");
+}
+
+/**
+ * The grammars of the samples, with the depth used by the samples as the largest one of the sweep.
+ */
+const std::vector<GrammarCase> grammar_cases = {
+    {"binary_fractal", {{2500, 0}, 90}, {8, 9, 10}, setupBinaryFractal},
+    {"koch_curve", {{50, 50}, 0}, {4, 5, 6}, setupKochCurve},
+    {"sierpinski_triangle", {{200, 200}, 120}, {5, 6, 7}, setupSierpinskiTriangle},
+    {"fractal_plant", {{400, 50}, 60}, {4, 5, 6}, setupFractalPlant},
+};
+
+/**
+ * FNV-1a hash of the pixels of a canvas, row by row.
+ */
+uint64_t hashPixels(const lsys::Canvas& canvas)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const unsigned char* bytes, size_t count) {
+        for (size_t i = 0; i < count; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+
+    const lsys::graphics::PixelContainerType pixels = canvas.getPixels();
+    for (unsigned short y = 0; y < canvas.getHeight(); ++y)
+    {
+        for (unsigned short x = 0; x < canvas.getWidth(); ++x)
+        {
+            const lsys::graphics::RgbColor& pixel = pixels[y][x];
+            unsigned char bytes[3] = {pixel.r, pixel.g, pixel.b};
+            add(bytes, 3);
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * Run one configuration in the calling process. The time of the fastest repetition is kept.
+ */
+Measurement runConfiguration(const Configuration& configuration, unsigned int repeat)
+{
+    const GrammarCase& grammar = *configuration.grammar;
+
+    // Fit the drawing into a square viewport, so every canvas size shows the same drawing
+    lsys::graphics::Bounds2d viewport;
+    {
+        lsys::Lsystem lsystem;
+        grammar.setup(lsystem);
+        lsystem.evaluate(configuration.depth);
+
+        lsys::Canvas canvas({0, 0, 0, 0}, 1, 1);
+        lsys::Turtle turtle(grammar.start, canvas);
+        BoundsSink sink;
+        lsystem.draw(turtle, sink);
+
+        float extent = std::max({sink.bounds.max_x - sink.bounds.min_x, sink.bounds.max_y - sink.bounds.min_y, 1.0f});
+        extent *= 1.02f;
+        float center_x = (sink.bounds.min_x + sink.bounds.max_x) / 2;
+        float center_y = (sink.bounds.min_y + sink.bounds.max_y) / 2;
+        viewport = {center_x - extent / 2, center_y - extent / 2, center_x + extent / 2, center_y + extent / 2};
+    }
+
+    Measurement measurement = {0, 0, 0, 0};
+    for (unsigned int i = 0; i < repeat; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        lsys::Lsystem lsystem;
+        grammar.setup(lsystem);
+        lsystem.evaluate(configuration.depth);
+
+        lsys::Canvas canvas({0, 0, 0, 0}, configuration.size, configuration.size);
+        canvas.setViewport(viewport);
+        lsys::Turtle turtle(grammar.start, canvas);
+        turtle.setThreadCount(configuration.threads);
+        lsystem.draw(turtle);
+
+        double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || wall_ms < measurement.wall_ms) measurement.wall_ms = wall_ms;
+
+        if (i == 0)
+        {
+            measurement.symbols = lsystem.getEvaluatedLength();
+            measurement.image_hash = hashPixels(canvas);
+        }
+    }
+
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    measurement.peak_rss_kb = usage.ru_maxrss;
+
+    return measurement;
+}
+
+/**
+ * Run one configuration in a child process and read its measurement back through a pipe.
+ *
+ * @return Whether the child produced a measurement
+ */
+bool runIsolated(const Configuration& configuration, unsigned int repeat, Measurement& measurement)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) return false;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        Measurement result = runConfiguration(configuration, repeat);
+        bool written = write(pipe_fds[1], &result, sizeof(result)) == static_cast<ssize_t>(sizeof(result));
+        _exit(written ? 0 : 1);
+    }
+
+    close(pipe_fds[1]);
+    bool received = read(pipe_fds[0], &measurement, sizeof(measurement)) == static_cast<ssize_t>(sizeof(measurement));
+    close(pipe_fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty()) items.push_back(item);
+    }
+
+    return items;
+}
+
+/**
+ * Describe the machine as CSV comment lines: its processor, hardware threads and operating system.
+ */
+std::string describeMachine()
+{
+    std::string cpu = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") != 0) continue;
+
+        size_t colon = line.find(':');
+        if (colon != std::string::npos && colon + 2 <= line.size()) cpu = line.substr(colon + 2);
+        break;
+    }
+
+    std::string system = "unknown";
+    struct utsname name = {};
+    if (uname(&name) == 0) system = std::string(name.sysname) + " " + name.release + " " + name.machine;
+
+    return "# cpu: " + cpu + "\n# hardware threads: " + std::to_string(std::thread::hardware_concurrency()) +
+           "\n# system: " + system + "\n";
+}
+
+/**
+ * Read the results of a previous sweep, keyed by configuration. Lines starting with '#' are comments, except that
+ * the hardware threads of the machine that produced it are read from its description (0 if unknown).
+ */
+std::map<ResultKey, Measurement> readBaseline(const std::string& filename, bool& ok, unsigned int& hardware_threads)
+{
+    std::map<ResultKey, Measurement> baseline;
+    std::ifstream file(filename);
+    ok = static_cast<bool>(file);
+    hardware_threads = 0;
+
+    const std::string threads_comment = "# hardware threads: ";
+    std::string line;
+    bool header = true;
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, threads_comment.size(), threads_comment) == 0)
+        {
+            hardware_threads = static_cast<unsigned int>(std::stoul(line.substr(threads_comment.size())));
+        }
+        if (line.empty() || line[0] == '#') continue;
+        if (header)
+        {
+            header = false;
+            continue;
+        }
+
+        std::vector<std::string> fields = splitList(line);
+        if (fields.size() != 10) continue;
+
+        ResultKey key(fields[0], std::stoul(fields[1]), std::stoul(fields[2]), std::stoul(fields[3]),
+                      std::stoul(fields[4]));
+        Measurement measurement = {std::stod(fields[5]), std::stol(fields[6]), 0,
+                                   std::stoull(fields[9], nullptr, 16)};
+        baseline[key] = measurement;
+    }
+
+    return baseline;
+}
+
+int main(int argc, char** argv)
+{
+    std::string baseline_file;
+    std::string output_file;
+    double tolerance = 0.10;
+    double slack_ms = 5;
+    unsigned int repeat = 5;
+    std::vector<std::string> grammar_names;
+    std::vector<unsigned short> sizes = {1024, 2048, 4096};
+    std::vector<unsigned int> thread_counts = {1, 2, 4};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 2;
+        }
+        std::string value = argv[++i];
+
+        if (option == "--baseline") baseline_file = value;
+        else if (option == "--output") output_file = value;
+        else if (option == "--tolerance") tolerance = std::stod(value);
+        else if (option == "--slack") slack_ms = std::stod(value);
+        else if (option == "--repeat") repeat = std::max(1ul, std::stoul(value));
+        else if (option == "--grammars") grammar_names = splitList(value);
+        else if (option == "--sizes")
+        {
+            sizes.clear();
+            for (const auto& size : splitList(value)) sizes.push_back(static_cast<unsigned short>(std::stoul(size)));
+        }
+        else if (option == "--threads")
+        {
+            thread_counts.clear();
+            for (const auto& count : splitList(value)) thread_counts.push_back(std::max(1ul, std::stoul(count)));
+        }
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 2;
+        }
+    }
+
+    std::map<ResultKey, Measurement> baseline;
+    unsigned int baseline_threads = 0;
+    if (!baseline_file.empty())
+    {
+        bool ok;
+        baseline = readBaseline(baseline_file, ok, baseline_threads);
+        if (!ok)
+        {
+            std::cerr << "Cannot read baseline " << baseline_file << std::endl;
+            return 2;
+        }
+    }
+
+    std::ofstream output_stream;
+    if (!output_file.empty())
+    {
+        output_stream.open(output_file, std::ios::trunc);
+        if (!output_stream)
+        {
+            std::cerr << "Cannot write " << output_file << std::endl;
+            return 2;
+        }
+    }
+    std::ostream& output = output_file.empty() ? std::cout : output_stream;
+
+    output << describeMachine();
+    output << "grammar,depth,width,height,threads,wall_ms,peak_rss_kb,symbols_per_s,pixels_per_s,image_hash\n";
+
+    unsigned int failures = 0;
+    for (const auto& grammar : grammar_cases)
+    {
+        if (!grammar_names.empty() &&
+            std::find(grammar_names.begin(), grammar_names.end(), grammar.name) == grammar_names.end()) continue;
+
+        for (unsigned int depth : grammar.depths)
+        {
+            for (unsigned short size : sizes)
+            {
+                bool has_first_image = false;
+                uint64_t first_image_hash = 0;
+                unsigned int first_threads = 0;
+
+                for (unsigned int threads : thread_counts)
+                {
+                    Configuration configuration = {&grammar, depth, size, threads};
+                    Measurement measurement;
+                    if (!runIsolated(configuration, repeat, measurement))
+                    {
+                        std::cerr << grammar.name << " depth " << depth << " size " << size << " threads "
+                                  << threads << ": run failed" << std::endl;
+                        ++failures;
+                        continue;
+                    }
+
+                    double seconds = std::max(measurement.wall_ms, 1e-3) / 1000.0;
+                    char line[256];
+                    std::snprintf(line, sizeof(line), "%s,%u,%u,%u,%u,%.3f,%ld,%.0f,%.0f,%016" PRIx64 "\n",
+                                  grammar.name, depth, size, size, threads, measurement.wall_ms,
+                                  measurement.peak_rss_kb, measurement.symbols / seconds,
+                                  static_cast<double>(size) * size / seconds, measurement.image_hash);
+                    output << line << std::flush;
+
+                    std::string prefix = std::string(grammar.name) + " depth " + std::to_string(depth) + " size " +
+                                         std::to_string(size) + " threads " + std::to_string(threads) + ": ";
+                    if (!has_first_image)
+                    {
+                        has_first_image = true;
+                        first_image_hash = measurement.image_hash;
+                        first_threads = threads;
+                    }
+                    else if (measurement.image_hash != first_image_hash)
+                    {
+                        std::cerr << prefix << "image differs from the one drawn with " << first_threads
+                                  << " thread(s)" << std::endl;
+                        ++failures;
+                    }
+
+                    auto reference = baseline.find(ResultKey(grammar.name, depth, size, size, threads));
+                    if (baseline_file.empty() || reference == baseline.end()) continue;
+
+                    if (reference->second.image_hash != measurement.image_hash)
+                    {
+                        std::cerr << prefix << "image differs from the baseline" << std::endl;
+                        ++failures;
+                    }
+
+                    // Threads beyond those of the baseline's machine were not timed in parallel
+                    if (baseline_threads != 0 && threads > baseline_threads) continue;
+
+                    if (measurement.wall_ms > reference->second.wall_ms * (1 + tolerance) + slack_ms)
+                    {
+                        std::cerr << prefix << measurement.wall_ms << " ms, baseline " << reference->second.wall_ms
+                                  << " ms" << std::endl;
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!baseline_file.empty())
+    {
+        std::cerr << (failures == 0 ? "All configurations match the baseline" :
+                      std::to_string(failures) + " configuration(s) regressed") << std::endl;
+    }
+    else if (failures != 0)
+    {
+        std::cerr << failures << " configuration(s) failed" << std::endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "RenderProtocol.hpp"
+
+/*
+ * Client of the render daemon: sends render requests and reports how the daemon answered them.
+ *
+ * Usage: lsys-client [--socket PATH] (--preset NAME | --grammar FILE) [--depth N] [--size WxH] [--start X,Y,ROTATION]
+ *                    [--viewport MINX,MINY,MAXX,MAXY] [--format mono1|gray8|rgb24|density32] [--output PATH] [--fd]
+ *                    [--repeat N]
+ *
+ * Presets are the sample grammars, with the depth, canvas size and start of the samples unless given. With --fd the
+ * image comes back as a file descriptor, and is copied to the output path if one is given.
+ */
+
+namespace
+{
+    struct Preset
+    {
+        const char* name;
+        const char* grammar;
+        uint32_t depth;
+        uint16_t width;
+        uint16_t height;
+        float start_x;
+        float start_y;
+        int32_t start_rotation;
+    };
+
+    const Preset presets[] = {
+        {"binary", "axiom 0\nignore 0\nmove 1 5\npush [\npop ]\nturn + 45\nturn - -45\nrule 0 1[+0]-0\nrule 1 11\n",
+         10, 5000, 5000, 2500, 0, 90},
+        {"koch", "axiom F\nmove F 5\nturn + 90\nturn - -90\nrule F F+F-F-F+F\n",
+         6, 3800, 2000, 50, 50, 0},
+        {"sierpinski", "axiom F-G-G\nmove F 20\nmove G 20\nturn + 120\nturn - -120\nrule F F-G+F+G-F\nrule G GG\n",
+         7, 3000, 3000, 200, 200, 120},
+        {"plant", "axiom X\nignore X\nmove F 15\nturn + 25\nturn - -25\npush [\npop ]\n"
+                  "rule X F+[[X]-X]-F[-FX]+X\nrule F FF\n",
+         6, 3000, 3000, 400, 50, 60}
+    };
+
+    /**
+     * Copy the whole file behind a descriptor to a path.
+     *
+     * @return Whether the file was copied
+     */
+    bool copyFile(int fd, const std::string& path)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        if (!output) return false;
+
+        char buffer[1 << 16];
+        off_t offset = 0;
+        ssize_t count;
+        while ((count = ::pread(fd, buffer, sizeof(buffer), offset)) > 0)
+        {
+            output.write(buffer, count);
+            offset += count;
+        }
+
+        return count == 0 && static_cast<bool>(output);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace lsys::daemon;
+
+    std::string socket_path = "/tmp/lsys.sock";
+    std::string grammar;
+    std::string output;
+    unsigned int repeat = 1;
+
+    RequestHeader request;
+    bool has_depth = false;
+    bool has_size = false;
+    bool has_start = false;
+    const Preset* preset = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--fd")
+        {
+            request.flags |= ReplyWithFd;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value of " << option << std::endl;
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        char separator;
+        if (option == "--socket")
+        {
+            socket_path = value;
+        }
+        else if (option == "--preset")
+        {
+            for (const auto& candidate : presets)
+            {
+                if (value == candidate.name) preset = &candidate;
+            }
+            if (preset == nullptr)
+            {
+                std::cerr << "Unknown preset " << value << std::endl;
+                return 2;
+            }
+            grammar = preset->grammar;
+        }
+        else if (option == "--grammar")
+        {
+            std::ifstream file(value);
+            std::stringstream text;
+            text << file.rdbuf();
+            if (!file)
+            {
+                std::cerr << "Cannot read " << value << std::endl;
+                return 2;
+            }
+            grammar = text.str();
+        }
+        else if (option == "--depth")
+        {
+            request.depth = static_cast<uint32_t>(std::stoul(value));
+            has_depth = true;
+        }
+        else if (option == "--size")
+        {
+            std::istringstream(value) >> request.width >> separator >> request.height;
+            has_size = true;
+        }
+        else if (option == "--start")
+        {
+            std::istringstream(value) >> request.start_x >> separator >> request.start_y >> separator
+                                      >> request.start_rotation;
+            has_start = true;
+        }
+        else if (option == "--viewport")
+        {
+            std::istringstream(value) >> request.viewport[0] >> separator >> request.viewport[1] >> separator
+                                      >> request.viewport[2] >> separator >> request.viewport[3];
+            request.has_viewport = 1;
+        }
+        else if (option == "--format")
+        {
+            const char* formats[] = {"mono1", "gray8", "rgb24", "density32"};
+            request.pixel_format = 4;
+            for (uint8_t format = 0; format < 4; ++format)
+            {
+                if (value == formats[format]) request.pixel_format = format;
+            }
+        }
+        else if (option == "--output")
+        {
+            output = value;
+        }
+        else if (option == "--repeat")
+        {
+            repeat = static_cast<unsigned int>(std::stoul(value));
+        }
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 2;
+        }
+    }
+
+    if (grammar.empty())
+    {
+        std::cerr << "No grammar, use --preset or --grammar" << std::endl;
+        return 2;
+    }
+    if (preset != nullptr)
+    {
+        if (!has_depth) request.depth = preset->depth;
+        if (!has_size)
+        {
+            request.width = preset->width;
+            request.height = preset->height;
+        }
+        if (!has_start)
+        {
+            request.start_x = preset->start_x;
+            request.start_y = preset->start_y;
+            request.start_rotation = preset->start_rotation;
+        }
+    }
+
+    // The daemon resolves relative paths against its own directory
+    std::string path;
+    if ((request.flags & ReplyWithFd) == 0)
+    {
+        path = output.empty() ? "lsys-client.bmp" : output;
+        if (path[0] != '/')
+        {
+            char directory[4096];
+            if (::getcwd(directory, sizeof(directory)) != nullptr) path = std::string(directory) + "/" + path;
+        }
+    }
+    request.grammar_size = static_cast<uint32_t>(grammar.size());
+    request.path_size = static_cast<uint32_t>(path.size());
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int connection = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 || ::connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        std::perror("lsys-client");
+        return 1;
+    }
+
+    const char* status_names[] = {"ok", "bad request", "bad grammar", "render failed"};
+    int result = 0;
+    for (unsigned int i = 0; i < repeat && result == 0; ++i)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+
+        if (!writeFully(connection, &request, sizeof(request)) ||
+            !writeFully(connection, grammar.data(), grammar.size()) ||
+            !writeFully(connection, path.data(), path.size()))
+        {
+            std::perror("lsys-client");
+            return 1;
+        }
+
+        ResponseHeader response;
+        std::string message;
+        int image_fd;
+        if (!receiveResponse(connection, response, message, image_fd))
+        {
+            std::cerr << "No valid response" << std::endl;
+            return 1;
+        }
+
+        double round_trip = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                      start_time).count();
+
+        std::printf("%s: render %.3f ms, round trip %.3f ms, cached %s%s%s, %llu bytes",
+                    response.status < 4 ? status_names[response.status] : "unknown",
+                    response.render_microseconds / 1000.0, round_trip,
+                    (response.cache_flags & GrammarCached) ? "grammar " : "",
+                    (response.cache_flags & GenerationCached) ? "generation " : "",
+                    (response.cache_flags & CanvasCached) ? "canvas" : "-",
+                    static_cast<unsigned long long>(response.file_size));
+        if (!message.empty()) std::printf(", %s", message.c_str());
+        if (image_fd >= 0) std::printf(", fd %d", image_fd);
+        std::printf("\n");
+
+        if (response.status != static_cast<uint16_t>(ResponseStatus::Ok)) result = 1;
+
+        if (image_fd >= 0)
+        {
+            if (!output.empty() && !copyFile(image_fd, output))
+            {
+                std::cerr << "Cannot write " << output << std::endl;
+                result = 1;
+            }
+            ::close(image_fd);
+        }
+    }
+
+    ::close(connection);
+
+    return result;
+}
@@ -0,0 +1,632 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "BmpImage.hpp"
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "ParameterSweep.hpp"
+#include "RenderProtocol.hpp"
+
+/*
+ * Render daemon: renders L-systems for clients connecting to a Unix domain socket (see RenderProtocol.hpp).
+ *
+ * The daemon keeps the work that does not depend on a single request warm between requests: grammars are parsed
+ * once into L-systems, every L-system evaluated for a depth is kept, and canvases are pooled by size and format so
+ * their pixels are reused. The caches are bounded and drop their least recently used entries first. Connections are
+ * served by a pool of worker threads, and evaluated L-systems are only read while drawing, so any number of workers
+ * can draw the same one at once. A connection idle for longer than the idle timeout is closed, so idle clients cannot
+ * hold every worker. Requests larger than the limits are refused, and a request that fails (e.g. out of memory) is
+ * answered as failed rather than stopping the daemon.
+ *
+ * Usage: lsys-daemon [--socket PATH] [--threads N] [--cache-mb MB] [--max-symbols N] [--max-pixels N]
+ *                    [--idle-timeout SECONDS]
+ */
+
+namespace lsys::daemon
+{
+    /**
+     * Map from keys to shared values, bounded by the total weight of the values.
+     * Values are shared, so one dropped from the cache stays valid for the requests still using it.
+     */
+    template<typename Value>
+    class LruCache
+    {
+    public:
+        explicit LruCache(size_t capacity)
+            : capacity(capacity)
+            , weight_total(0)
+        {
+        }
+
+        /**
+         * Find a value, marking it as the most recently used.
+         *
+         * @return The value, or nullptr if the key is not cached
+         */
+        std::shared_ptr<const Value> find(const std::string& key)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto entry = index.find(key);
+            if (entry == index.end()) return nullptr;
+
+            entries.splice(entries.begin(), entries, entry->second);
+            return entry->second->value;
+        }
+
+        /**
+         * Add a value, dropping the least recently used ones until the cache fits its capacity.
+         * A value heavier than the whole capacity is not cached.
+         */
+        void insert(const std::string& key, std::shared_ptr<const Value> value, size_t weight)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (weight > capacity || index.count(key) != 0) return;
+
+            entries.push_front({key, std::move(value), weight});
+            index[key] = entries.begin();
+            weight_total += weight;
+
+            while (weight_total > capacity)
+            {
+                weight_total -= entries.back().weight;
+                index.erase(entries.back().key);
+                entries.pop_back();
+            }
+        }
+
+    private:
+        struct Entry
+        {
+            std::string key;
+            std::shared_ptr<const Value> value;
+            size_t weight;
+        };
+
+        size_t capacity;
+        size_t weight_total;
+
+        std::list<Entry> entries;
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+        std::mutex mutex;
+    };
+
+    /**
+     * Idle canvases, by size, pixel format and whether they have a viewport.
+     * Canvases are taken out while drawn on, so only one request uses a canvas at a time.
+     */
+    class CanvasPool
+    {
+    public:
+        using Key = std::tuple<uint16_t, uint16_t, int, bool>;
+
+        explicit CanvasPool(size_t capacity)
+            : capacity(capacity)
+            , idle_bytes(0)
+        {
+        }
+
+        /**
+         * Take an idle canvas, or create one.
+         *
+         * @param reused Set to whether an idle canvas was taken
+         */
+        std::unique_ptr<Canvas> acquire(const Key& key, bool& reused)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto canvases = idle.find(key);
+                if (canvases != idle.end() && !canvases->second.empty())
+                {
+                    std::unique_ptr<Canvas> canvas = std::move(canvases->second.back());
+                    canvases->second.pop_back();
+                    idle_bytes -= getBytes(key);
+
+                    reused = true;
+                    return canvas;
+                }
+            }
+
+            reused = false;
+            return std::unique_ptr<Canvas>(new Canvas({0, 0, 0, 0}, std::get<0>(key), std::get<1>(key),
+                                                      static_cast<PixelFormat>(std::get<2>(key))));
+        }
+
+        /**
+         * Give a canvas back, keeping it for later requests if the pool has room for it.
+         */
+        void release(const Key& key, std::unique_ptr<Canvas> canvas)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle_bytes + getBytes(key) > capacity) return;
+
+            idle[key].push_back(std::move(canvas));
+            idle_bytes += getBytes(key);
+        }
+
+    private:
+        static size_t getBytes(const Key& key)
+        {
+            size_t pixels = static_cast<size_t>(std::get<0>(key)) * std::get<1>(key);
+            switch (static_cast<PixelFormat>(std::get<2>(key)))
+            {
+                case PixelFormat::Mono1:
+                    return pixels / 8;
+                case PixelFormat::Gray8:
+                    return pixels;
+                case PixelFormat::Rgb24:
+                    return pixels * 3;
+                case PixelFormat::Density32:
+                    return pixels * 4;
+            }
+
+            return pixels;
+        }
+
+        size_t capacity;
+        size_t idle_bytes;
+
+        std::map<Key, std::vector<std::unique_ptr<Canvas>>> idle;
+        std::mutex mutex;
+    };
+
+    /**
+     * Parse grammar text (see RenderProtocol.hpp) into an L-system.
+     *
+     * @return Whether the text is valid; if not, error describes the first invalid line
+     */
+    bool parseGrammar(const std::string& text, Lsystem& lsystem, std::string& error)
+    {
+        std::istringstream lines(text);
+        std::string line;
+        unsigned int line_number = 0;
+        bool has_axiom = false;
+
+        while (std::getline(lines, line))
+        {
+            ++line_number;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+
+            std::istringstream fields(line);
+            std::string directive;
+            std::string symbol;
+            fields >> directive >> symbol;
+
+            bool valid = symbol.size() == 1 || (directive == "axiom" && !symbol.empty());
+            if (valid && directive == "axiom")
+            {
+                lsystem.setAxiom(symbol);
+                has_axiom = true;
+            }
+            else if (valid && directive == "rule")
+            {
+                std::string successor;
+                valid = static_cast<bool>(fields >> successor);
+                if (valid) lsystem.addRule(symbol[0], successor);
+            }
+            else if (valid && directive == "move")
+            {
+                float distance;
+                valid = static_cast<bool>(fields >> distance);
+                if (valid) lsystem.addSymbol(symbol[0], std::make_shared<MoveForwardCommand>(distance));
+            }
+            else if (valid && directive == "turn")
+            {
+                int degrees;
+                valid = static_cast<bool>(fields >> degrees);
+                if (valid) lsystem.addSymbol(symbol[0], std::make_shared<TurnCommand>(degrees));
+            }
+            else if (valid && directive == "push")
+            {
+                lsystem.addSymbol(symbol[0], std::make_shared<PushStateCommand>());
+            }
+            else if (valid && directive == "pop")
+            {
+                lsystem.addSymbol(symbol[0], std::make_shared<PopStateCommand>());
+            }
+            else if (valid && directive == "penup")
+            {
+                lsystem.addSymbol(symbol[0], std::make_shared<PenUpCommand>());
+            }
+            else if (valid && directive == "pendown")
+            {
+                lsystem.addSymbol(symbol[0], std::make_shared<PenDownCommand>());
+            }
+            else if (valid && directive == "ignore")
+            {
+                lsystem.addSymbol(symbol[0], nullptr);
+            }
+            else
+            {
+                valid = false;
+            }
+
+            if (!valid)
+            {
+                error = "invalid grammar line " + std::to_string(line_number) + ": " + line;
+                return false;
+            }
+        }
+
+        if (!has_axiom) error = "grammar has no axiom";
+        return has_axiom;
+    }
+
+    /**
+     * Serves render requests, keeping grammars, evaluated L-systems and canvases between them.
+     */
+    class RenderServer
+    {
+    public:
+        RenderServer(size_t cache_bytes, uint64_t max_symbols, uint64_t max_pixels)
+            : grammars(cache_bytes / 16)
+            , generations(cache_bytes / 2)
+            , canvases(cache_bytes / 2)
+            , max_symbols(max_symbols)
+            , max_pixels(max_pixels)
+        {
+        }
+
+        /**
+         * Answer the requests of a connection until the client closes it.
+         */
+        void serve(int connection)
+        {
+            RequestHeader request;
+            while (readFully(connection, &request, sizeof(request)))
+            {
+                if (request.magic != request_magic || request.version != protocol_version ||
+                    request.grammar_size > max_grammar_size || request.path_size > max_path_size)
+                {
+                    ResponseHeader response;
+                    response.status = static_cast<uint16_t>(ResponseStatus::BadRequest);
+                    sendResponse(connection, response, "malformed request");
+                    return;
+                }
+
+                std::string grammar(request.grammar_size, '\0');
+                std::string path(request.path_size, '\0');
+                if (!readFully(connection, &grammar[0], grammar.size())) return;
+                if (!readFully(connection, &path[0], path.size())) return;
+
+                if (!handle(connection, request, grammar, path)) return;
+            }
+        }
+
+    private:
+        /**
+         * Render one request and send its response, answering RenderFailed if rendering throws.
+         *
+         * @return Whether the response was sent
+         */
+        bool handle(int connection, const RequestHeader& request, const std::string& grammar, const std::string& path)
+        {
+            std::string error;
+            try
+            {
+                return render(connection, request, grammar, path);
+            }
+            catch (const std::exception& exception)
+            {
+                error = exception.what();
+            }
+
+            ResponseHeader response;
+            response.status = static_cast<uint16_t>(ResponseStatus::RenderFailed);
+            return sendResponse(connection, response, "render failed: " + error);
+        }
+
+        /**
+         * Render one request and send its response.
+         *
+         * @return Whether the response was sent
+         */
+        bool render(int connection, const RequestHeader& request, const std::string& grammar, const std::string& path)
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            ResponseHeader response;
+
+            auto fail = [&](ResponseStatus status, const std::string& message)
+            {
+                response.status = static_cast<uint16_t>(status);
+                return sendResponse(connection, response, message);
+            };
+
+            bool reply_with_fd = (request.flags & ReplyWithFd) != 0;
+            if (request.width == 0 || request.height == 0 || request.pixel_format > 3)
+            {
+                return fail(ResponseStatus::BadRequest, "invalid canvas");
+            }
+            if (static_cast<uint64_t>(request.width) * request.height > max_pixels)
+            {
+                return fail(ResponseStatus::BadRequest, "canvas too large");
+            }
+            if (!reply_with_fd && path.empty()) return fail(ResponseStatus::BadRequest, "no output path");
+            if (request.depth > max_depth) return fail(ResponseStatus::BadRequest, "depth too large");
+
+            // Compiled grammar
+            std::shared_ptr<const Lsystem> compiled = grammars.find(grammar);
+            if (compiled != nullptr)
+            {
+                response.cache_flags |= GrammarCached;
+            }
+            else
+            {
+                auto parsed = std::make_shared<Lsystem>();
+                std::string error;
+                if (!parseGrammar(grammar, *parsed, error)) return fail(ResponseStatus::BadGrammar, error);
+
+                compiled = parsed;
+                grammars.insert(grammar, compiled, grammar.size());
+            }
+
+            // Evaluated generation
+            std::string generation_key = grammar + '\0' + std::to_string(request.depth);
+            std::shared_ptr<const Lsystem> generation = generations.find(generation_key);
+            if (generation != nullptr)
+            {
+                response.cache_flags |= GenerationCached;
+            }
+            else
+            {
+                // Every symbol counts once, so the count is the evaluated length
+                if (compiled->countEvaluated(request.depth, std::vector<uint64_t>(256, 1)) > max_symbols)
+                {
+                    return fail(ResponseStatus::BadRequest, "evaluated L-system too large");
+                }
+
+                auto evaluated = std::make_shared<Lsystem>();
+                evaluated->setAxiom(compiled->getAxiom());
+                evaluated->setSymbols(compiled->getSymbols());
+                evaluated->setRules(compiled->getRules());
+                if (!evaluated->evaluate(request.depth))
+                {
+                    return fail(ResponseStatus::RenderFailed, "cannot evaluate the L-system");
+                }
+
+                generation = evaluated;
+                generations.insert(generation_key, generation, evaluated->getEvaluatedAxiom().size());
+            }
+
+            // Draw on a pooled canvas; the sweep only reads the evaluated L-system, so it can be shared
+            CanvasPool::Key canvas_key(request.width, request.height, request.pixel_format, request.has_viewport != 0);
+            bool reused;
+            std::unique_ptr<Canvas> canvas = canvases.acquire(canvas_key, reused);
+            if (reused) response.cache_flags |= CanvasCached;
+
+            if (request.has_viewport)
+            {
+                canvas->setViewport({request.viewport[0], request.viewport[1], request.viewport[2],
+                                     request.viewport[3]});
+            }
+            else
+            {
+                canvas->setBounds({0, 0, 0, 0});
+            }
+            canvas->penDown();
+
+            ParameterSweep sweep(*generation);
+            sweep.addVariant(sweep.getDefaultVariant());
+            if (!sweep.draw({{request.start_x, request.start_y}, request.start_rotation}, {canvas.get()}))
+            {
+                canvases.release(canvas_key, std::move(canvas));
+                return fail(ResponseStatus::BadRequest, "drawing does not fit the canvas, give a viewport");
+            }
+
+            // Write the image, to an unlinked temporary file if its descriptor is passed
+            int image_fd = -1;
+            std::string image_path = path;
+            if (reply_with_fd)
+            {
+                char temporary_path[] = "/tmp/lsys-daemon-XXXXXX";
+                image_fd = mkostemp(temporary_path, O_CLOEXEC);
+                if (image_fd < 0)
+                {
+                    canvases.release(canvas_key, std::move(canvas));
+                    return fail(ResponseStatus::RenderFailed, "cannot create a temporary file");
+                }
+                image_path = temporary_path;
+            }
+
+            bool written;
+            try
+            {
+                io::BmpImage image(*canvas);
+                written = image.writeToFile(image_path);
+            }
+            catch (...)
+            {
+                if (reply_with_fd)
+                {
+                    ::unlink(image_path.c_str());
+                    ::close(image_fd);
+                }
+                throw;
+            }
+            canvases.release(canvas_key, std::move(canvas));
+
+            struct stat image_stat = {};
+            written = written && ::stat(image_path.c_str(), &image_stat) == 0 && image_stat.st_size > 0;
+            if (reply_with_fd) ::unlink(image_path.c_str());
+
+            if (!written)
+            {
+                if (image_fd >= 0) ::close(image_fd);
+                return fail(ResponseStatus::RenderFailed, "cannot write " + image_path);
+            }
+
+            response.file_size = static_cast<uint64_t>(image_stat.st_size);
+            response.render_microseconds = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_time).count());
+
+            bool sent = sendResponse(connection, response, reply_with_fd ? std::string() : path, image_fd);
+            if (image_fd >= 0) ::close(image_fd);
+
+            return sent;
+        }
+
+        LruCache<Lsystem> grammars;
+        LruCache<Lsystem> generations;
+        CanvasPool canvases;
+
+        uint64_t max_symbols;
+        uint64_t max_pixels;
+    };
+}
+
+namespace
+{
+    std::atomic<bool> stop_requested(false);
+
+    void requestStop(int)
+    {
+        stop_requested.store(true);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace lsys::daemon;
+
+    std::string socket_path = "/tmp/lsys.sock";
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t cache_bytes = static_cast<size_t>(1024) << 20;
+    uint64_t max_symbols = static_cast<uint64_t>(1) << 31;
+    uint64_t max_pixels = static_cast<uint64_t>(1) << 27;
+    unsigned int idle_timeout = 10;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+
+        if (option == "--socket") socket_path = value;
+        else if (option == "--threads") threads = std::max(1ul, std::stoul(value));
+        else if (option == "--cache-mb") cache_bytes = static_cast<size_t>(std::stoull(value)) << 20;
+        else if (option == "--max-symbols") max_symbols = std::stoull(value);
+        else if (option == "--max-pixels") max_pixels = std::stoull(value);
+        else if (option == "--idle-timeout") idle_timeout = std::max(1ul, std::stoul(value));
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 2;
+        }
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path too long" << std::endl;
+        return 2;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(socket_path.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::chmod(socket_path.c_str(), 0600) != 0 || ::listen(listener, 64) != 0)
+    {
+        std::perror("lsys-daemon");
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    RenderServer server(cache_bytes, max_symbols, max_pixels);
+
+    // Workers take accepted connections from a queue
+    std::deque<int> connections;
+    std::mutex connections_mutex;
+    std::condition_variable connection_added;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            while (true)
+            {
+                int connection;
+                {
+                    std::unique_lock<std::mutex> lock(connections_mutex);
+                    connection_added.wait(lock, [&]() { return stopping || !connections.empty(); });
+                    if (connections.empty()) return;
+
+                    connection = connections.front();
+                    connections.pop_front();
+                }
+
+                server.serve(connection);
+                ::close(connection);
+            }
+        });
+    }
+
+    std::cerr << "lsys-daemon listening on " << socket_path << " with " << threads << " workers" << std::endl;
+
+    // Poll with a timeout, so a stop request is noticed even if it comes just before waiting
+    while (!stop_requested.load())
+    {
+        pollfd listening = {listener, POLLIN, 0};
+        if (::poll(&listening, 1, 500) <= 0) continue;
+
+        int connection = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) continue;
+
+        // A worker stops serving a connection whose client neither sends nor reads within the timeout
+        timeval timeout = {static_cast<time_t>(idle_timeout), 0};
+        ::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connections.push_back(connection);
+        connection_added.notify_one();
+    }
+
+    // Finish the accepted connections, then stop the workers
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        stopping = true;
+        connection_added.notify_all();
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    ::close(listener);
+    ::unlink(socket_path.c_str());
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace lsys::daemon
+{
+    /**
+     * Binary protocol between the render daemon and its clients, over a Unix domain stream socket.
+     *
+     * A client sends requests, each a RequestHeader followed by the grammar text and the output path. For every
+     * request the daemon sends a ResponseHeader followed by a message: the path of the image, or an error. If the
+     * request asked for a file descriptor, the image is written to an unlinked temporary file instead, whose
+     * descriptor is passed along with the response header (SCM_RIGHTS), so the image is never copied through the
+     * socket. A connection can carry any number of requests, answered in order.
+     *
+     * All fields are in the byte order of the host, since both ends run on the same machine.
+     *
+     * The grammar text has one directive per line:
+     *
+     *     axiom <string>
+     *     rule <symbol> <successor>
+     *     move <symbol> <distance>
+     *     turn <symbol> <degrees>
+     *     push <symbol>
+     *     pop <symbol>
+     *     penup <symbol>
+     *     pendown <symbol>
+     *     ignore <symbol>
+     *
+     * Empty lines and lines starting with '#' are skipped.
+     */
+    constexpr uint32_t request_magic = 0x5259534C; // "LSYR"
+    constexpr uint32_t response_magic = 0x4159534C; // "LSYA"
+    constexpr uint16_t protocol_version = 1;
+
+    /**
+     * Largest grammar text and output path accepted, to bound what a request can make the daemon allocate.
+     */
+    constexpr uint32_t max_grammar_size = 1 << 20;
+    constexpr uint32_t max_path_size = 4096;
+
+    /**
+     * Largest depth accepted. Evaluating takes an iteration per level even for a grammar that does not grow, so the
+     * size limits alone do not bound the time a request can take.
+     */
+    constexpr uint32_t max_depth = 1024;
+
+    enum RequestFlags : uint16_t
+    {
+        /**
+         * Pass the image as a file descriptor instead of writing it to the output path.
+         */
+        ReplyWithFd = 1
+    };
+
+    enum class ResponseStatus : uint16_t
+    {
+        Ok,
+        BadRequest,
+        BadGrammar,
+        RenderFailed
+    };
+
+    enum CacheFlags : uint16_t
+    {
+        GrammarCached = 1, // The grammar was already compiled
+        GenerationCached = 2, // The L-system was already evaluated for the depth
+        CanvasCached = 4 // The pixels of a previous render were reused
+    };
+
+    #pragma pack(push, 1)
+    struct RequestHeader
+    {
+        uint32_t magic = request_magic;
+        uint16_t version = protocol_version;
+        uint16_t flags = 0;
+
+        uint32_t depth = 0;
+        float start_x = 0;
+        float start_y = 0;
+        int32_t start_rotation = 0;
+
+        uint16_t width = 0;
+        uint16_t height = 0;
+        uint8_t pixel_format = 2; // PixelFormat::Rgb24
+        uint8_t has_viewport = 0;
+        uint16_t reserved = 0;
+        float viewport[4] = {0, 0, 0, 0}; // min x, min y, max x, max y
+
+        uint32_t grammar_size = 0;
+        uint32_t path_size = 0;
+    };
+
+    struct ResponseHeader
+    {
+        uint32_t magic = response_magic;
+        uint16_t version = protocol_version;
+        uint16_t status = static_cast<uint16_t>(ResponseStatus::Ok);
+        uint16_t cache_flags = 0;
+        uint16_t has_fd = 0;
+        uint32_t render_microseconds = 0;
+        uint64_t file_size = 0;
+        uint32_t message_size = 0;
+    };
+    #pragma pack(pop)
+
+    /**
+     * Read exactly size bytes, retrying on interrupts.
+     *
+     * @return Whether all bytes were read (false on error or end of stream)
+     */
+    inline bool readFully(int fd, void* data, size_t size)
+    {
+        auto* bytes = static_cast<char*>(data);
+        while (size > 0)
+        {
+            ssize_t count = ::read(fd, bytes, size);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+
+            bytes += count;
+            size -= static_cast<size_t>(count);
+        }
+
+        return true;
+    }
+
+    /**
+     * Write exactly size bytes, retrying on interrupts.
+     *
+     * @return Whether all bytes were written
+     */
+    inline bool writeFully(int fd, const void* data, size_t size)
+    {
+        const auto* bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            ssize_t count = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+
+            bytes += count;
+            size -= static_cast<size_t>(count);
+        }
+
+        return true;
+    }
+
+    /**
+     * Send a response header, with a file descriptor attached if passed_fd is not -1, followed by the message.
+     *
+     * @return Whether the response was sent
+     */
+    inline bool sendResponse(int fd, ResponseHeader header, const std::string& message, int passed_fd = -1)
+    {
+        header.has_fd = passed_fd >= 0 ? 1 : 0;
+        header.message_size = static_cast<uint32_t>(message.size());
+
+        iovec data = {&header, sizeof(header)};
+        msghdr msg = {};
+        msg.msg_iov = &data;
+        msg.msg_iovlen = 1;
+
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        if (passed_fd >= 0)
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+        }
+
+        // The header is small enough to go in one piece, with the descriptor riding on its first byte
+        ssize_t count;
+        do
+        {
+            count = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (count < 0 && errno == EINTR);
+        if (count < 0) return false;
+
+        if (static_cast<size_t>(count) < sizeof(header) &&
+            !writeFully(fd, reinterpret_cast<char*>(&header) + count, sizeof(header) - count)) return false;
+
+        return writeFully(fd, message.data(), message.size());
+    }
+
+    /**
+     * Receive a response header, the descriptor attached to it if any, and the message.
+     *
+     * @param passed_fd Set to the received descriptor, or -1
+     *
+     * @return Whether a valid response was received
+     */
+    inline bool receiveResponse(int fd, ResponseHeader& header, std::string& message, int& passed_fd)
+    {
+        passed_fd = -1;
+
+        iovec data = {&header, sizeof(header)};
+        msghdr msg = {};
+        msg.msg_iov = &data;
+        msg.msg_iovlen = 1;
+
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t count;
+        do
+        {
+            count = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0) return false;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                std::memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+
+        if (static_cast<size_t>(count) < sizeof(header) &&
+            !readFully(fd, reinterpret_cast<char*>(&header) + count, sizeof(header) - count)) return false;
+        if (header.magic != response_magic || header.version != protocol_version) return false;
+
+        message.resize(header.message_size);
+        return readFully(fd, &message[0], message.size());
+    }
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <fstream>
+#include <functional>
+#include <vector>
 #include "Canvas.hpp"
 
 namespace lsys::io
@@ -24,7 +27,7 @@ namespace lsys::io
      */
     enum BmpBitsPerPixel : uint16_t
     {
-        RGB16 = 16, RGB24 = 24 // Other types not supported
+        MONO1 = 1, INDEXED8 = 8, RGB16 = 16, RGB24 = 24 // Other types not supported
     };
 
     /**
@@ -58,14 +61,31 @@ namespace lsys::io
 
     /**
      * Represents a BMP image.
-     * Currently, only RGB pixels are supported and no compression is implemented.
+     * RGB pixels, and 1-bit and 8-bit paletted pixels are supported. No compression is implemented.
      */
     class BmpImage
     {
     public:
         explicit BmpImage(graphics::PixelContainerType pixels, uint16_t width, u_int16_t height);
+
+        /**
+         * Create a BMP image of the pixels of a canvas, in the canvas' pixel format.
+         * 1-bit canvases are written with a black and white palette, 8-bit canvases with a grayscale palette.
+         * The hit counts of density canvases are tone mapped to 8-bit gray levels.
+         * If the pixels of the canvas were never allocated, the image has no pixels and writing it fails.
+         *
+         * @param canvas The canvas
+         * @param tone_mapping Tone mapping curve of density canvases
+         * @param gamma Gamma of the gamma curve
+         */
+        explicit BmpImage(const graphics::Canvas& canvas,
+                          graphics::ToneMapping tone_mapping = graphics::ToneMapping::Log, float gamma = 2.2f);
         BmpImage() = default;
 
+        // The paletted pixel data can point into the image's own tone mapped data
+        BmpImage(const BmpImage&) = delete;
+        BmpImage& operator=(const BmpImage&) = delete;
+
         /**
          * Set the pixel data for the BMP image.
          * The width and height parameters are used to compute and assign header values such as the file size.
@@ -76,12 +96,47 @@ namespace lsys::io
          */
         void setPixels(graphics::PixelContainerType pixels, uint16_t width, u_int16_t height);
 
+        /**
+         * Set 1-bit or 8-bit paletted pixel data for the BMP image.
+         * Rows go from the top row down, and the leftmost pixel of a 1-bit row is in the most significant bit.
+         *
+         * @param data Pixel data
+         * @param row_stride Number of bytes between the starts of consecutive rows, at least the padded BMP row size
+         * @param width Width of the pixel data
+         * @param height Height of the pixel data
+         * @param bits_per_pixel MONO1 or INDEXED8
+         */
+        void setPixelData(const uint8_t* data, size_t row_stride, uint16_t width, uint16_t height,
+                          BmpBitsPerPixel bits_per_pixel);
+
+        /**
+         * Set the palette of paletted pixel data (2 colors for 1-bit, up to 256 for 8-bit).
+         *
+         * @param palette Colors of the palette indices
+         */
+        void setPalette(const std::vector<graphics::RgbColor>& palette);
+
+        /**
+         * Function called after every row written, with the number of rows written so far.
+         * Returning false stops writing, leaving the file incomplete.
+         */
+        using RowCallback = std::function<bool(uint32_t rows)>;
+
         /**
          * Write the BMP image to a file.
          *
          * @param filename Path to the file
+         *
+         * @return Whether the whole image was written (false if the image has no pixels)
          */
-        void writeToFile(const std::string& filename);
+        bool writeToFile(const std::string& filename);
+
+        /**
+         * Set the function called after every row written (none by default).
+         *
+         * @param row_callback The function
+         */
+        void setRowCallback(RowCallback row_callback);
 
         [[nodiscard]]
         const BmpHeader& getHeader() const;
@@ -95,6 +150,13 @@ namespace lsys::io
         graphics::RgbColor* const* getPixels() const;
 
     private:
+        /**
+         * Write the header, palette and paletted pixel data.
+         *
+         * @param file The file to write to
+         */
+        void writePalettedData(std::ofstream& file);
+
         /**
          * Header.
          */
@@ -108,11 +170,32 @@ namespace lsys::io
         /**
          * Pixel data.
          */
-        graphics::PixelContainerType pixels;
+        graphics::PixelContainerType pixels = nullptr;
+
+        /**
+         * Paletted pixel data, and the number of bytes per row of it.
+         */
+        const uint8_t* pixel_data = nullptr;
+        size_t row_stride = 0;
+
+        /**
+         * Function called after every row written.
+         */
+        RowCallback row_callback;
+
+        /**
+         * Gray levels of a tone mapped density canvas, pointed to by the paletted pixel data.
+         */
+        std::vector<uint8_t> tone_mapped_data;
+
+        /**
+         * Palette of paletted pixel data.
+         */
+        std::vector<graphics::RgbColor> palette;
 
         /**
          * Size of the padding to apply tot he pixel data, if necessary.
         */
-        unsigned int padding_size;
+        unsigned int padding_size = 0;
     };
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <utility>
+#include <vector>
+#include "SegmentBuffer.hpp"
 #include "types.hpp"
 
 namespace lsys::graphics
@@ -21,8 +27,10 @@ namespace lsys::graphics
          * @param bounds Bounds of the 2D plane
          * @param width Width of the discretization in pixels
          * @param height Height of the discretization in pixels
+         * @param pixel_format Format the pixels are stored in
          */
-        Canvas(const Bounds2d& bounds, unsigned short width, unsigned short height);
+        Canvas(const Bounds2d& bounds, unsigned short width, unsigned short height,
+               PixelFormat pixel_format = PixelFormat::Rgb24);
         ~Canvas();
 
         /**
@@ -37,14 +45,194 @@ namespace lsys::graphics
          */
         Point2d drawLine(Point2d start, float length, int angle);
 
+        /**
+         * Draw a line between two points in the canvas.
+         *
+         * @param start The point from which to start drawing the line
+         * @param end The point at which the line ends
+         *
+         * @return End point of the line
+         */
+        Point2d drawLine(Point2d start, Point2d end);
+
+        /**
+         * Draw a batch of lines, given as consecutive pairs of end points, the same way drawLine would.
+         * The lines are rasterized by several threads, each drawing the pixels of its own band of rows.
+         * Density canvases are accumulated by splitting the lines over the threads instead (see accumulateLines).
+         *
+         * @param lines End points of the lines
+         * @param threads Number of threads to rasterize with
+         */
+        void drawLines(const std::vector<Point2d>& lines, unsigned int threads);
+
+        /**
+         * Draw a chunk of segments, the same way drawLine would.
+         * Without a viewport the bounds are grown once with the bounds of the whole chunk, and the end points are
+         * converted to pixels a coordinate array at a time before the lines are rasterized.
+         * The segments were already filtered by the pen of the turtle that drew them, so the pen is not checked.
+         * With more than one thread, the lines are rasterized in bands of rows as drawLines does.
+         *
+         * @param segments The segments
+         * @param threads Number of threads to rasterize with
+         */
+        void drawSegments(const SegmentBuffer& segments, unsigned int threads = 1);
+
         void penUp();
         void penDown();
 
+        [[nodiscard]]
+        bool isPenDown() const;
+
+        /**
+         * Given a point, get a new point at a distance l and an angle d from the point.
+         *
+         * @param point Point to move from
+         * @param distance Distance to move
+         * @param angle Angle in which to move
+         *
+         * @return New point
+         */
+        static Point2d moveFromPoint(Point2d point, float distance, int angle);
+
+        /**
+         * Get the closest pixel given a point in the 2D plane.
+         *
+         * @param point Point in the 2D plane
+         * @return Closest pixel to the point
+         */
+        [[nodiscard]]
+        Pixelxy getPixelFromPoint(Point2d point) const;
+
+        /**
+         * Get the position of a point in pixel units, before it is snapped to a pixel.
+         * The y axis is not flipped yet, so the position increases with the y coordinate of the point.
+         *
+         * @param point Point in the 2D plane
+         * @return Position of the point in pixel units
+         */
+        [[nodiscard]]
+        Point2d getPixelPosition(Point2d point) const;
+
+        /**
+         * Set every pixel at an offset from an origin pixel. Offsets falling outside the canvas are skipped.
+         * Respects the pen and whether drawing is allowed.
+         *
+         * @param origin The origin pixel
+         * @param offsets Offsets (x, y) of the pixels to set
+         */
+        void plotPixels(Pixelxy origin, const std::vector<Vec2<int>>& offsets);
+
+        /**
+         * Record the end points of every line rasterized from now on, as pairs of points.
+         *
+         * @param recorder Vector the end points are appended to (or nullptr to stop recording)
+         */
+        void setLineRecorder(std::vector<Point2d>* recorder);
+
+        /**
+         * Visit the pixels of a line from pixel a to pixel b.
+         * Uses Bresenham's line algorithm.
+         *
+         * @param start Start pixel
+         * @param end End pixel
+         * @param plot Function called with the coordinates (x, y) of every pixel of the line
+         */
+        template<typename PlotFunction>
+        static void traceLine(Pixelxy start, Pixelxy end, PlotFunction plot)
+        {
+            int dx = std::abs(end.x - start.x);
+            int sx = start.x < end.x ? 1 : -1;
+
+            int dy = std::abs(end.y - start.y);
+            int sy = start.y < end.y ? 1 : -1;
+
+            int err = (dx > dy ? dx : -dy) / 2;
+            int e2;
+
+            while (true)
+            {
+                plot(start.x, start.y);
+
+                if (start.x == end.x && start.y == end.y)
+                    break;
+
+                e2 = err;
+
+                if (e2 > -dx)
+                {
+                    err -= dy;
+                    start.x += sx;
+                }
+                if (e2 < dy)
+                {
+                    err += dx;
+                    start.y += sy;
+                }
+            }
+        }
+
+        /**
+         * Fix the bounds of the canvas to a viewport.
+         * The bounds no longer grow to fit the drawing, so no dry run is needed before drawing. Points are mapped
+         * to pixels by scaling the viewport to the size of the canvas, and lines are clipped to the viewport.
+         *
+         * @param viewport The region of the 2D plane shown on the canvas
+         */
+        void setViewport(const Bounds2d& viewport);
+
+        /**
+         * Whether the bounds of the canvas are fixed to a viewport.
+         */
+        [[nodiscard]]
+        bool hasViewport() const;
+
+        /**
+         * Get the number of pixels per unit of the 2D plane.
+         * Without a viewport the canvas maps one unit to one pixel.
+         */
+        [[nodiscard]]
+        float getScale() const;
+
         /**
          * Allocate pixels for this canvas. Must be called first before any rasterization can happen.
+         * Allocating again clears the pixels and keeps their memory, so the canvas must keep its size.
          */
         void allocatePixels();
 
+        /**
+         * Whether a pixel has been drawn on.
+         *
+         * @param x Column of the pixel
+         * @param y Row of the pixel
+         */
+        [[nodiscard]]
+        bool isPixelSet(unsigned short x, unsigned short y) const;
+
+        /**
+         * Clear all pixels. Compact formats are cleared a word at a time.
+         */
+        void clearPixels();
+
+        /**
+         * Add the pixels drawn on another canvas of the same size and format to this canvas.
+         * Compact formats are merged a word at a time, and the hit counts of density canvases are summed.
+         *
+         * @param other The canvas to merge
+         */
+        void mergePixels(const Canvas& other);
+
+        /**
+         * Map the hit counts of a density canvas to 8-bit gray levels, relative to the largest count.
+         * Rows go from the top row down and are padded to a multiple of 8 bytes, as for the 8-bit format.
+         *
+         * @param mapping The tone mapping curve
+         * @param gamma Gamma of the gamma curve
+         *
+         * @return The gray levels (empty if the pixel format is not density)
+         */
+        [[nodiscard]]
+        std::vector<uint8_t> toneMap(ToneMapping mapping, float gamma = 2.2f) const;
+
         /**
          * Print the canvas in ASCII.
          */
@@ -68,23 +256,39 @@ namespace lsys::graphics
         const Spacing2d& getSpacing() const;
         void setSpacing(const Spacing2d& spacing);
 
+        /**
+         * Get the pixels, if the pixel format is RGB24 (nullptr otherwise).
+         */
         [[nodiscard]]
         const PixelContainerType& getPixels() const;
         void setPixels(const PixelContainerType& pixels);
 
         [[nodiscard]]
-        bool getAllowDrawing() const;
-        void setAllowDrawing(bool allow_drawing);
+        PixelFormat getPixelFormat() const;
 
-    private:
         /**
-         * Get the closest pixel given a point in the 2D plane.
-         *
-         * @param point Point in the 2D plane
-         * @return Closest pixel to the point
+         * Get the rows of pixels, if the pixel format is 1-bit or 8-bit (nullptr otherwise).
+         * Rows start every row stride bytes, from the top row down.
          */
         [[nodiscard]]
-        Pixelxy getPixelFromPoint(Point2d point) const;
+        const uint8_t* getPixelData() const;
+
+        /**
+         * Get the number of bytes between the starts of consecutive rows of pixel data, a multiple of 8.
+         */
+        [[nodiscard]]
+        size_t getRowStride() const;
+
+        /**
+         * Get the hit counts, if the pixel format is density (nullptr otherwise).
+         * Counts are stored width per row, from the top row down.
+         */
+        [[nodiscard]]
+        const uint32_t* getHitCounts() const;
+
+        [[nodiscard]]
+        bool getAllowDrawing() const;
+        void setAllowDrawing(bool allow_drawing);
 
         /**
          * Update the bounds of the 2D plane to include the reference point.
@@ -93,16 +297,28 @@ namespace lsys::graphics
          */
         void updateBounds(Point2d reference);
 
+    private:
         /**
-         * Given a point, get a new point at a distance l and an angle d from the point.
+         * Clip a line to the bounds of the canvas.
+         * Uses the Liang-Barsky algorithm.
          *
-         * @param point Point to move from
-         * @param distance Distance to move
-         * @param angle Angle in which to move
+         * @param start Start point of the line, moved to the bounds if outside
+         * @param end End point of the line, moved to the bounds if outside
          *
-         * @return New point
+         * @return Whether any part of the line is within the bounds
          */
-        static Point2d moveFromPoint(Point2d point, float distance, int angle);
+        bool clipLine(Point2d& start, Point2d& end) const;
+
+        /**
+         * Convert coordinates along one axis to pixel columns or rows, as getPixelFromPoint does.
+         *
+         * @param coordinates The coordinates
+         * @param count Number of coordinates
+         * @param vertical Whether the coordinates are y coordinates (mapped to rows, from the top down)
+         * @param pixels The pixel columns or rows
+         */
+        void coordinatesToPixels(const float* coordinates, size_t count, bool vertical,
+                                 std::vector<unsigned short>& pixels) const;
 
         /**
          * Rasterize a line from pixel a to pixel b.
@@ -113,6 +329,74 @@ namespace lsys::graphics
          */
         void rasterizeLine(Pixelxy start, Pixelxy end);
 
+        /**
+         * Rasterize the part of a line that lies in a band of rows, setting the same pixels as Bresenham's line
+         * algorithm. Horizontal lines are filled as spans, and vertical and diagonal lines, which have one pixel
+         * per row, are walked with a fixed step; other lines are traced.
+         *
+         * @param start Start pixel
+         * @param end End pixel
+         * @param first_row First row of the band
+         * @param last_row Row after the last row of the band
+         */
+        void rasterizeLine(Pixelxy start, Pixelxy end, int first_row, int last_row);
+
+        /**
+         * Draw on the pixels first_x to last_x (inclusive) of a row.
+         */
+        void fillRow(int y, int first_x, int last_x);
+
+        /**
+         * Draw on one pixel in each of count rows starting from (x, y), moving step_x columns per row.
+         */
+        void fillColumn(int x, int y, int step_x, int count);
+
+        /**
+         * Trace a line with traceLine, only plotting the pixels in a band of rows.
+         * The rows are only checked per pixel if the line leaves the band.
+         */
+        template<typename PlotFunction>
+        static void traceLineInRows(Pixelxy start, Pixelxy end, int first_row, int last_row, PlotFunction plot)
+        {
+            if (std::min(start.y, end.y) >= first_row && std::max(start.y, end.y) < last_row)
+            {
+                traceLine(start, end, plot);
+                return;
+            }
+
+            traceLine(start, end, [first_row, last_row, &plot](int x, int y)
+            {
+                if (y >= first_row && y < last_row) plot(x, y);
+            });
+        }
+
+        /**
+         * Rasterize lines mapped to pixels with several threads, each drawing the pixels of its own band of rows.
+         * Density canvases are accumulated with accumulateLines instead.
+         *
+         * @param pixel_lines The lines, mapped to pixels
+         * @param threads Number of threads to rasterize with
+         */
+        void rasterizeLines(const std::vector<std::pair<Pixelxy, Pixelxy>>& pixel_lines, unsigned int threads);
+
+        /**
+         * Accumulate lines on a density canvas with several threads.
+         * Every thread traces its share of the lines into a private buffer of hit counts with plain increments,
+         * and the buffers are then summed into the canvas, each thread summing its own band of rows.
+         *
+         * @param pixel_lines The lines, mapped to pixels
+         * @param threads Number of threads to accumulate with
+         */
+        void accumulateLines(const std::vector<std::pair<Pixelxy, Pixelxy>>& pixel_lines, unsigned int threads);
+
+        /**
+         * Draw on a pixel, in any pixel format.
+         *
+         * @param x Column of the pixel
+         * @param y Row of the pixel
+         */
+        void setPixel(int x, int y);
+
         ///////////////////////////////
 
         /**
@@ -136,10 +420,30 @@ namespace lsys::graphics
         unsigned short height;
 
         /**
-         * Pixels of the canvas.
+         * Pixels of the canvas, in RGB24.
          */
         PixelContainerType pixels;
 
+        /**
+         * Format of the pixels.
+         */
+        PixelFormat pixel_format;
+
+        /**
+         * Pixels of the canvas, in the 1-bit and 8-bit formats.
+         */
+        std::vector<uint8_t> pixel_data;
+
+        /**
+         * Hit counts of the canvas, in the density format.
+         */
+        std::vector<uint32_t> hit_counts;
+
+        /**
+         * Number of bytes per row of pixel data.
+         */
+        size_t row_stride;
+
         /**
          * Whether a turtle can write to the canvas.
          */
@@ -150,5 +454,15 @@ namespace lsys::graphics
          * Overrides pen_down.
          */
         bool allow_drawing;
+
+        /**
+         * Whether the bounds are fixed to a viewport.
+         */
+        bool has_viewport;
+
+        /**
+         * Receives the end points of rasterized lines while recording (nullptr otherwise).
+         */
+        std::vector<Point2d>* line_recorder;
     };
 }
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "TurtleCommand.hpp"
+
+namespace lsys
+{
+    /**
+     * Statistics of a pass of the command optimizer.
+     */
+    struct OptimizationStats
+    {
+        size_t input_commands = 0;
+        size_t output_commands = 0;
+
+        /**
+         * Number of turn commands folded into a neighbouring turn or dropped because they cancel out.
+         */
+        size_t folded_turns = 0;
+
+        /**
+         * Number of move commands merged into the previous collinear move.
+         */
+        size_t merged_moves = 0;
+
+        /**
+         * Number of push/pop pairs removed because nothing between them had any effect.
+         */
+        size_t removed_brackets = 0;
+
+        /**
+         * Number of commands removed because they never have any effect (null commands and full turns).
+         */
+        size_t removed_noops = 0;
+
+        /**
+         * Get the fraction of the input commands that were removed, from 0 (nothing removed) to 1.
+         */
+        [[nodiscard]]
+        float getReductionRatio() const;
+    };
+
+    /**
+     * Peephole optimizer over a turtle command stream.
+     * Rewrites a stream into a shorter one that draws the same geometry:
+     *  - Runs of turns are folded into a single turn, or dropped if they sum to a full turn.
+     *  - Consecutive moves in the same direction are merged into a single longer move.
+     *  - Null commands are dropped.
+     *  - Push/pop pairs with nothing drawn in between are dropped, as well as turns right before a pop.
+     *
+     * Pen commands and custom commands are never moved and act as barriers.
+     *
+     * Merged moves trace exactly the same lines, but the rasterized pixels can differ slightly from the original
+     * stream since the intermediate vertices are no longer snapped to pixels. Merging can be disabled if the
+     * output has to be pixel-identical.
+     */
+    class CommandOptimizer
+    {
+    public:
+        /**
+         * @param merge_moves Whether consecutive collinear moves are merged
+         */
+        explicit CommandOptimizer(bool merge_moves = true);
+
+        /**
+         * Optimize a command stream in place.
+         *
+         * @param commands The commands to optimize
+         *
+         * @return Statistics of the pass
+         */
+        OptimizationStats optimize(std::vector<std::shared_ptr<TurtleCommand>>& commands);
+
+    private:
+        /**
+         * Emit the pending move and turn, in that order.
+         */
+        void flushPending();
+
+        /**
+         * Emit a command with a visible effect, marking the enclosing brackets as not empty.
+         *
+         * @param command The command to emit
+         */
+        void emit(const std::shared_ptr<TurtleCommand>& command);
+
+        /**
+         * Move the trailing turn and move of the output back into the pending ones, so they can be merged with
+         * the commands that follow. Used after removing an empty bracket pair.
+         */
+        void reopenPending();
+
+        ///////////////////////////////
+
+        /**
+         * Whether consecutive collinear moves are merged.
+         */
+        bool merge_moves;
+
+        /**
+         * A push command in the output that has not been matched by a pop yet.
+         */
+        struct OpenBracket
+        {
+            size_t output_index;
+            bool has_effect;
+        };
+
+        /**
+         * Output stream.
+         */
+        std::vector<std::shared_ptr<TurtleCommand>> output;
+
+        /**
+         * Push commands in the output that have not been matched by a pop yet.
+         */
+        std::vector<OpenBracket> open_brackets;
+
+        /**
+         * Pending move, not emitted yet so that following collinear moves can be merged into it.
+         */
+        std::shared_ptr<TurtleCommand> pending_move;
+        float pending_distance = 0;
+        size_t pending_move_count = 0;
+
+        /**
+         * Pending turn (after the pending move), not emitted yet so that following turns can be folded into it.
+         */
+        std::shared_ptr<TurtleCommand> pending_turn;
+        int pending_degrees = 0;
+        size_t pending_turn_count = 0;
+
+        OptimizationStats stats;
+    };
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Lsystem.hpp"
+#include "types.hpp"
+
+namespace lsys
+{
+    /**
+     * Summary of the expansion of a symbol after a number of iterations (a subtree of the derivation).
+     */
+    struct SubtreeInfo
+    {
+        /**
+         * Number of symbols in the expansion (saturates at the maximum value).
+         */
+        uint64_t length = 0;
+
+        /**
+         * Number of move commands in the expansion (saturates at the maximum value).
+         */
+        uint64_t moves = 0;
+
+        /**
+         * Net number of states pushed to the stack by the expansion.
+         */
+        int64_t stack_net = 0;
+
+        /**
+         * Lowest stack level reached relative to the start of the expansion (negative if it pops states it did not push).
+         */
+        int64_t stack_min = 0;
+
+        /**
+         * Whether the expansion contains pen or custom commands, whose effect outlives the expansion.
+         */
+        bool has_barrier = false;
+
+        /**
+         * Position of the turtle after the expansion relative to its start position, for a turtle starting
+         * with a rotation of 0 degrees.
+         */
+        graphics::Vec2<double> displacement = {0, 0};
+
+        /**
+         * Rotation of the turtle after the expansion relative to its start rotation, in [0, 360) degrees.
+         */
+        int rotation = 0;
+
+        /**
+         * Upper bound of the distance between the start position and any point the expansion visits.
+         * Negative if the geometry of the expansion is unknown (custom commands or unmatched push/pop).
+         */
+        double radius = 0;
+
+        /**
+         * Whether the expansion leaves the turtle stack and pen as it found them, so it can be drawn in isolation.
+         */
+        [[nodiscard]]
+        bool isSelfContained() const;
+    };
+
+    /**
+     * Location of a symbol of the evaluated axiom in the derivation tree: the index of its ancestor in the axiom,
+     * then the index of the next ancestor in the production of that one, and so on down to the symbol itself.
+     * The path only depends on the grammar, not on the turtle.
+     */
+    using DerivationPath = std::vector<uint32_t>;
+
+    /**
+     * The derivation tree of an L-system evaluated for a number of iterations.
+     * The evaluated axiom is never materialized; instead every symbol of the axiom is the root of a subtree
+     * obtained by recursively replacing symbols with their productions. Summaries of every (symbol, depth) subtree
+     * are precomputed so renderers can reason about a subtree without expanding it.
+     */
+    class Derivation
+    {
+    public:
+        /**
+         * Build the derivation of an L-system.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations
+         */
+        Derivation(const Lsystem& lsystem, unsigned int depth);
+
+        [[nodiscard]]
+        const std::string& getAxiom() const;
+
+        [[nodiscard]]
+        unsigned int getDepth() const;
+
+        /**
+         * Get the production of a symbol for a single iteration.
+         *
+         * @param symbol The symbol
+         * @return The production (the symbol itself if it is terminal)
+         */
+        [[nodiscard]]
+        const std::string& getProduction(char symbol) const;
+
+        /**
+         * Whether a symbol is never rewritten.
+         *
+         * @param symbol The symbol
+         */
+        [[nodiscard]]
+        bool isTerminal(char symbol) const;
+
+        /**
+         * Get the turtle command bound to a symbol.
+         *
+         * @param symbol The symbol
+         * @return The command (or nullptr)
+         */
+        [[nodiscard]]
+        TurtleCommand* getCommand(char symbol) const;
+
+        /**
+         * Get the summary of the expansion of a symbol.
+         *
+         * @param symbol The symbol
+         * @param depth Number of iterations, at most the depth of the derivation
+         */
+        [[nodiscard]]
+        const SubtreeInfo& getInfo(char symbol, unsigned int depth) const;
+
+        /**
+         * Get the number of symbols of the evaluated axiom (saturates at the maximum value).
+         */
+        [[nodiscard]]
+        uint64_t getLength() const;
+
+        /**
+         * Find the path to a symbol of the evaluated axiom without expanding it.
+         * The subtree lengths are used to pick the child containing the offset at every level, so the cost is
+         * proportional to the depth (and the length of the productions).
+         *
+         * @param offset Offset of the symbol in the evaluated axiom
+         * @param path Path to the symbol
+         *
+         * @return Whether the offset is within the evaluated axiom
+         */
+        bool seek(uint64_t offset, DerivationPath& path) const;
+
+    private:
+        /**
+         * Index of a symbol in the per-symbol tables.
+         */
+        static size_t index(char symbol);
+
+        /**
+         * Compute the geometry (displacement, rotation and radius) of the expansion of a symbol from the level below.
+         *
+         * @param symbol The symbol
+         * @param depth Depth of the expansion, at least 1
+         */
+        void computeGeometry(char symbol, unsigned int depth);
+
+        /**
+         * Axiom of the L-system.
+         */
+        std::string axiom;
+
+        /**
+         * Number of iterations.
+         */
+        unsigned int depth;
+
+        /**
+         * Production of every symbol.
+         */
+        std::vector<std::string> productions;
+
+        /**
+         * Whether every symbol is terminal.
+         */
+        std::vector<bool> terminal;
+
+        /**
+         * Command bound to every symbol.
+         */
+        std::vector<std::shared_ptr<TurtleCommand>> commands;
+
+        /**
+         * Subtree summaries, indexed by depth and then symbol.
+         */
+        std::vector<std::vector<SubtreeInfo>> infos;
+
+        /**
+         * Offset in the evaluated axiom of the expansion of every symbol of the axiom, followed by the total length.
+         */
+        std::vector<uint64_t> axiom_offsets;
+    };
+
+    /**
+     * Generates the evaluated axiom of a derivation from any offset on, without expanding what comes before it.
+     * Workers can each start a cursor at the beginning of their own range of the output.
+     */
+    class DerivationCursor
+    {
+    public:
+        /**
+         * Start a cursor at a symbol of the evaluated axiom.
+         *
+         * @param derivation The derivation, which must outlive the cursor
+         * @param path Path to the symbol (see Derivation::seek)
+         */
+        DerivationCursor(const Derivation& derivation, const DerivationPath& path);
+
+        /**
+         * Start a cursor at an offset of the evaluated axiom.
+         * The cursor is at the end if the offset is past the evaluated axiom.
+         *
+         * @param derivation The derivation, which must outlive the cursor
+         * @param offset Offset of the symbol
+         */
+        DerivationCursor(const Derivation& derivation, uint64_t offset);
+
+        /**
+         * Get the symbol at the cursor and move past it.
+         *
+         * @param symbol The symbol
+         *
+         * @return Whether there was a symbol (false at the end of the evaluated axiom)
+         */
+        bool next(char& symbol);
+
+    private:
+        /**
+         * Build the frames leading to a symbol.
+         *
+         * @param path Path to the symbol
+         */
+        void start(const DerivationPath& path);
+
+        /**
+         * A string being expanded: the axiom or a production, the index of the symbol being expanded or emitted,
+         * and the number of iterations applied to reach it.
+         */
+        struct Frame
+        {
+            const std::string* text;
+            size_t index;
+            unsigned int level;
+        };
+
+        const Derivation& derivation;
+
+        /**
+         * Strings from the axiom down to the one containing the cursor.
+         */
+        std::vector<Frame> frames;
+    };
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <vector>
+#include "Derivation.hpp"
+#include "StampCache.hpp"
+#include "Turtle.hpp"
+
+namespace lsys
+{
+    /**
+     * Counters of the subtree optimizations of a derivation renderer.
+     */
+    struct DerivationRenderStats
+    {
+        /**
+         * Subtrees drawn as their representative segment because they were below the level of detail.
+         */
+        size_t simplified_subtrees = 0;
+
+        /**
+         * Subtrees skipped without expansion because they are entirely outside the viewport.
+         */
+        size_t culled_subtrees = 0;
+    };
+
+    /**
+     * Draws a derivation with a turtle by walking its tree, instead of materializing the evaluated axiom and
+     * queueing one command per symbol. The walk knows which subtree every command belongs to, which enables
+     * optimizations that work on whole subtrees.
+     *
+     * Like the turtle, the walk follows lattice programs on the exact integer lattice (see Turtle::isLatticeProgram),
+     * and moves past a subtree it does not expand by its exact lattice displacement. Without any optimization
+     * enabled, the result is identical to evaluating and drawing the L-system.
+     */
+    class DerivationRenderer
+    {
+    public:
+        /**
+         * @param derivation The derivation to draw
+         */
+        explicit DerivationRenderer(const Derivation& derivation);
+
+        /**
+         * Draw the derivation with a turtle.
+         * Like Turtle::run, a dry run first estimates the canvas bounds, then a second run rasterizes the drawing.
+         *
+         * If the canvas has a fixed viewport, the dry run is skipped and subtrees entirely outside the viewport are
+         * skipped without being expanded, so the cost only depends on the visible part of the drawing.
+         *
+         * @param turtle The turtle to draw with
+         */
+        void draw(Turtle& turtle);
+
+        /**
+         * Use a stamp cache to draw repeated subtrees. The cache is cleared at the start of every draw.
+         *
+         * @param stamp_cache The cache (or nullptr to draw every subtree normally)
+         */
+        void setStampCache(StampCache* stamp_cache);
+
+        /**
+         * Set the level of detail. Subtrees whose projected bounding box is smaller than the given size are not
+         * expanded any further, and are drawn as a single segment from their start to their end position instead.
+         * The bounding box of a subtree is derived from the step lengths of its moves and the scale of the canvas.
+         *
+         * @param min_subtree_size Size in pixels below which subtrees are simplified (or 0 to expand everything)
+         */
+        void setLevelOfDetail(float min_subtree_size);
+
+        [[nodiscard]]
+        const DerivationRenderStats& getStats() const;
+
+    private:
+        /**
+         * Draw the subtree of a symbol.
+         *
+         * @param turtle The turtle to draw with
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree
+         * @param use_stamps Whether the stamp cache can be used
+         */
+        void walk(Turtle& turtle, char symbol, unsigned int depth, bool use_stamps);
+
+        /**
+         * Draw a subtree using the stamp cache, either blitting its stamp or recording a new one.
+         *
+         * @return Whether the subtree was drawn
+         */
+        bool drawStamped(Turtle& turtle, char symbol, unsigned int depth);
+
+        /**
+         * Skip a subtree if it is entirely outside the viewport of the canvas.
+         *
+         * @return Whether the subtree was skipped
+         */
+        bool cull(Turtle& turtle, char symbol, unsigned int depth);
+
+        /**
+         * Get the position of the turtle after a subtree, without expanding it.
+         *
+         * @param start Transform of the turtle at the start of the subtree
+         * @param info Summary of the subtree
+         */
+        static Point2d getEndPosition(const Transform2d& start, const SubtreeInfo& info);
+
+        /**
+         * Move the turtle past a self-contained subtree without drawing it.
+         *
+         * @param start Transform of the turtle at the start of the subtree
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree
+         *
+         * @return Transform of the turtle at the end of the subtree
+         */
+        Transform2d skipSubtree(const Transform2d& start, char symbol, unsigned int depth);
+
+        /**
+         * Whether every command of the evaluated axiom can be executed on the lattice, as Turtle::isLatticeProgram
+         * decides for the queued commands.
+         *
+         * @param turtle The turtle to draw with
+         */
+        [[nodiscard]]
+        bool isLatticeDerivation(const Turtle& turtle) const;
+
+        /**
+         * Execute a command on the lattice, drawing moves.
+         */
+        void executeOnLattice(Turtle& turtle, TurtleCommand& command);
+
+        /**
+         * Apply a command to a lattice state and stack, without drawing.
+         */
+        static void stepOnLattice(LatticeState& state, std::vector<LatticeState>& stack, const TurtleCommand& command);
+
+        /**
+         * Apply a whole subtree to a lattice state and stack, without drawing.
+         */
+        void applyOnLattice(LatticeState& state, std::vector<LatticeState>& stack, char symbol, unsigned int depth);
+
+        /**
+         * Get the lattice displacement of a self-contained subtree for a turtle starting in direction 0.
+         *
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree, at least 1
+         */
+        const LatticePosition& getLatticeDisplacement(char symbol, unsigned int depth);
+
+        /**
+         * Draw a subtree as its representative segment if it is below the level of detail.
+         *
+         * @return Whether the subtree was drawn
+         */
+        bool drawSimplified(Turtle& turtle, char symbol, unsigned int depth);
+
+        /**
+         * The derivation to draw.
+         */
+        const Derivation& derivation;
+
+        /**
+         * Cache of stamps for repeated subtrees (or nullptr).
+         */
+        StampCache* stamp_cache;
+
+        /**
+         * Size in pixels below which subtrees are simplified (0 if disabled).
+         */
+        float min_subtree_size;
+
+        DerivationRenderStats stats;
+
+        /**
+         * End points of the lines drawn while recording a stamp.
+         */
+        std::vector<Point2d> recorded_lines;
+
+        /**
+         * Whether the current draw walks on the lattice, and the origin, state and stack of the walk.
+         */
+        bool lattice;
+        Point2d lattice_origin;
+        LatticeState lattice_state;
+        std::vector<LatticeState> lattice_stack;
+
+        /**
+         * Lattice displacement of a self-contained subtree, once computed.
+         */
+        struct LatticeSubtree
+        {
+            bool known = false;
+            LatticePosition displacement = {0, 0, 0, 0};
+        };
+
+        /**
+         * Lattice displacements of subtrees, indexed by depth and then symbol.
+         */
+        std::vector<std::vector<LatticeSubtree>> lattice_subtrees;
+    };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "SegmentBuffer.hpp"
+#include "Turtle.hpp"
+
+namespace lsys
+{
+    /**
+     * Placement of one copy of an instanced drawing: the local segments are rotated, scaled and then translated.
+     */
+    struct Instance
+    {
+        Point2d position;
+
+        /**
+         * Counterclockwise rotation in degrees.
+         */
+        float rotation;
+
+        float scale;
+    };
+
+    /**
+     * Counters of the last draw of an instanced drawing.
+     */
+    struct InstancedDrawingStats
+    {
+        uint64_t instances_drawn = 0;
+        uint64_t instances_culled = 0;
+        uint64_t segments = 0;
+    };
+
+    /**
+     * Draws many copies of one L-system, e.g. the plants of a forest.
+     * The L-system is interpreted once into segments in local space, the space of the turtle that drew them. Every
+     * instance then only transforms these segments, a coordinate array at a time, instead of copying the command
+     * queue and running the turtle again.
+     *
+     * On a canvas with a viewport, instances whose transformed local bounds miss the viewport are culled without
+     * transforming their segments. The segments of the other instances are rasterized in chunks, each chunk by
+     * several threads drawing their own bands of rows, so overlapping instances never write the same pixel at once.
+     */
+    class InstancedDrawing
+    {
+    public:
+        /**
+         * Create an empty drawing.
+         *
+         * @param chunk_size Number of transformed segments rasterized at a time
+         */
+        explicit InstancedDrawing(size_t chunk_size = 1 << 16);
+
+        /**
+         * Interpret an evaluated L-system into the local segments, replacing the previous ones.
+         * The turtle's initial transform is the origin of the local space, so it is usually placed at (0, 0).
+         *
+         * @param lsystem The evaluated L-system
+         * @param turtle The turtle to interpret it with
+         */
+        void interpret(Lsystem& lsystem, Turtle& turtle);
+
+        void addInstance(const Instance& instance);
+        void clearInstances();
+
+        /**
+         * Draw every instance on a canvas, allocating its pixels first.
+         * Without a viewport, a dry run over the transformed segments finds the bounds first, as Turtle::run does.
+         *
+         * @param canvas The canvas
+         * @param threads Number of threads to rasterize with
+         */
+        void draw(Canvas& canvas, unsigned int threads = 1);
+
+        /////////////////////////////////////////////
+
+        /**
+         * Segments of the L-system in local space.
+         */
+        [[nodiscard]]
+        const SegmentBuffer& getSegments() const;
+
+        [[nodiscard]]
+        const std::vector<Instance>& getInstances() const;
+
+        [[nodiscard]]
+        const InstancedDrawingStats& getStats() const;
+
+    private:
+        /**
+         * Transform every instance into a buffer, culling those outside of the viewport if there is one.
+         *
+         * @param output The buffer receiving the transformed segments
+         * @param viewport The viewport to cull against, or nullptr to keep every instance
+         */
+        void transformInstances(SegmentBuffer& output, const Bounds2d* viewport);
+
+        /**
+         * Get the bounds of the local segments once transformed by an instance.
+         * The corners of the local bounds are transformed, so the bounds may be larger than the segments'.
+         */
+        [[nodiscard]]
+        Bounds2d getInstanceBounds(const Instance& instance) const;
+
+        size_t chunk_size;
+
+        SegmentBuffer segments;
+        Bounds2d local_bounds;
+
+        std::vector<Instance> instances;
+
+        InstancedDrawingStats stats;
+    };
+}
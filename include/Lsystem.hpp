@@ -1,9 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include "CommandOptimizer.hpp"
+#include "MappedFile.hpp"
+#include "PackedSequence.hpp"
+#include "ProgramFile.hpp"
+#include "SegmentSink.hpp"
 #include "TurtleCommand.hpp"
 
 namespace lsys
@@ -25,12 +31,24 @@ namespace lsys
          */
         void draw(Turtle& turtle);
 
+        /**
+         * Draw the L-system with a turtle, streaming the segments to a sink instead of the turtle's canvas.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments
+         */
+        void draw(Turtle& turtle, graphics::SegmentSink& sink);
+
         /**
          * Evaluate the L-system for a given number of iterations.
+         * Only out-of-core evaluation can fail, if a generation cannot be spilled or mapped. The L-system is then left
+         * unevaluated and draws nothing.
          *
          * @param iterations Number of recursive iterations
+         *
+         * @return Whether the L-system is evaluated
          */
-        void evaluate(unsigned int iterations);
+        bool evaluate(unsigned int iterations);
 
         /**
          * Add a new symbol that maps to a given turtle command (or nullptr).
@@ -53,13 +71,201 @@ namespace lsys
 
         const std::string& getEvaluatedAxiom() const;
 
+        /**
+         * Get the evaluated axiom when the L-system is evaluated with packed storage.
+         */
+        const PackedSequence& getPackedAxiom() const;
+
+        /**
+         * Get the evaluated axiom when it is mapped from disk, because the L-system was evaluated out of core or
+         * loaded from a program file.
+         */
+        const io::MappedFile& getMappedAxiom() const;
+
+        /**
+         * Get the number of symbols in the evaluated axiom, whichever way it is stored.
+         */
+        uint64_t getEvaluatedLength() const;
+
         const std::unordered_map<char, std::shared_ptr<TurtleCommand>>& getSymbols() const;
         void setSymbols(const std::unordered_map<char, std::shared_ptr<TurtleCommand>>& symbols);
 
         const std::unordered_map<char, std::string>& getRules() const;
         void setRules(const std::unordered_map<char, std::string>& rules);
 
+        /**
+         * Get the string each symbol is rewritten to by a single iteration of the L-system.
+         * Within an iteration the rules are applied one after the other, so a symbol written by one rule can still be
+         * rewritten by a rule applied later. The productions resolve this, so an iteration is equivalent to replacing
+         * every symbol with its production. Symbols without a production are left unchanged.
+         *
+         * @return Map of characters to productions
+         */
+        std::unordered_map<char, std::string> getProductions() const;
+
+        /**
+         * Count the symbols of the axiom evaluated for a number of iterations, without evaluating it.
+         * Every symbol counts with its weight, so weights of 1 give the evaluated length. Counts saturate, so
+         * evaluations too large to hold stay too large, and the iterations stop once the counts no longer change.
+         *
+         * @param iterations Number of recursive iterations
+         * @param weights Weight of every symbol, indexed by its unsigned value (256 entries)
+         *
+         * @return The weighted count of the symbols
+         */
+        uint64_t countEvaluated(unsigned int iterations, const std::vector<uint64_t>& weights) const;
+
+        /**
+         * Whether the turtle commands are run through the peephole optimizer before drawing.
+         */
+        bool getOptimizeCommands() const;
+        void setOptimizeCommands(bool optimize_commands);
+
+        /**
+         * Whether the optimizer merges collinear moves (disabled by default). Merged moves are rasterized as one line
+         * from rounded end points, so they can set slightly different pixels; without merging the optimized
+         * commands draw exactly the same pixels.
+         */
+        bool getMergeMoves() const;
+        void setMergeMoves(bool merge_moves);
+
+        /**
+         * Statistics of the optimization pass of the last draw, if the commands were optimized.
+         */
+        const OptimizationStats& getOptimizationStats() const;
+
+        /**
+         * Whether the evaluated axiom is stored as a packed sequence of 2, 4 or 8 bits per symbol instead of a string.
+         * With packed storage, getEvaluatedAxiom() is left empty and getPackedAxiom() holds the result.
+         */
+        bool getPackedStorage() const;
+        void setPackedStorage(bool packed_storage);
+
+        /**
+         * Directory the L-system spills its generations to when evaluated out of core (empty to evaluate in memory).
+         * Each generation is written sequentially to a temporary file and the previous one is read back through a
+         * memory mapping, so the evaluated axiom can be larger than the available memory. The files are removed as
+         * soon as they are mapped. Out-of-core evaluation takes precedence over packed storage.
+         */
+        const std::string& getSpillDirectory() const;
+        void setSpillDirectory(const std::string& spill_directory);
+
+        /**
+         * Get a hash of the grammar: the axiom, the rules, and the command every symbol maps to.
+         * Custom commands only contribute their type.
+         */
+        uint64_t getGrammarHash() const;
+
+        /**
+         * Save the evaluated L-system as a program file (see io::ProgramFileHeader).
+         * The file also stores the bounds of the drawing for the initial transform of a turtle, so loading it and
+         * drawing with the same transform needs no dry run.
+         *
+         * @param filename Path to the file
+         * @param turtle Turtle whose initial transform the bounds are computed for
+         *
+         * @return Whether the file was written
+         */
+        bool saveProgram(const std::string& filename, const Turtle& turtle);
+
+        /**
+         * Load an evaluated L-system from a program file, mapping it into memory instead of evaluating it.
+         * The file is only accepted if it was saved from the same grammar evaluated for the same number of iterations.
+         * Drawing the loaded program gives the same pixels as evaluating and drawing the L-system.
+         *
+         * @param filename Path to the file
+         * @param iterations Number of iterations the L-system is evaluated for
+         *
+         * @return Whether the program was loaded
+         */
+        bool loadProgram(const std::string& filename, unsigned int iterations);
+
     private:
+        /**
+         * Evaluate the L-system into the packed axiom, rewriting every symbol with its production at once.
+         *
+         * @param iterations Number of recursive iterations
+         */
+        void evaluatePacked(unsigned int iterations);
+
+        /**
+         * Evaluate the L-system out of core, spilling every generation to the spill directory.
+         *
+         * @param iterations Number of recursive iterations
+         *
+         * @return Whether every generation was spilled and mapped
+         */
+        bool evaluateSpilled(unsigned int iterations);
+
+        /**
+         * Draw the mapped axiom, loading its commands into the turtle a chunk at a time.
+         * Like drawPacked, the chunks carry their lattice state over, so the result is the same as drawing the axiom
+         * queued whole. The dry run is skipped if a loaded program has bounds for the turtle.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments (nullptr to rasterize on the turtle's canvas)
+         */
+        void drawMapped(Turtle& turtle, graphics::SegmentSink* sink);
+
+        /**
+         * Run all chunks of an axiom once.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments (nullptr to rasterize on the turtle's canvas)
+         * @param data Symbols of the axiom
+         * @param size Number of symbols
+         * @param lattice Whether the whole axiom runs on the lattice
+         */
+        void runChunks(Turtle& turtle, graphics::SegmentSink* sink, const char* data, uint64_t size, bool lattice);
+
+        /**
+         * Optimize and execute the commands queued in the turtle as one chunk of a program, then clear the queue.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments (nullptr to rasterize on the turtle's canvas)
+         * @param first Whether this is the first chunk of the program
+         * @param lattice Whether the whole program runs on the lattice
+         */
+        void runChunk(Turtle& turtle, graphics::SegmentSink* sink, bool first, bool lattice);
+
+        /**
+         * Whether every symbol occurring in an axiom maps to a command that can run on the lattice
+         * (see Turtle::isLatticeCommand).
+         *
+         * @param data Symbols of the axiom
+         * @param size Number of symbols
+         */
+        bool hasLatticeSymbols(const char* data, uint64_t size) const;
+
+        /**
+         * Draw the packed axiom, interpreting it a chunk at a time as it is unpacked.
+         * The command queue only ever holds a chunk, so drawing needs little memory beyond the packed axiom. The
+         * chunks carry their lattice state over, so the result is the same as drawing the axiom queued whole, but
+         * they run sequentially whatever the thread count of the turtle, and are optimized one at a time.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments (nullptr to rasterize on the turtle's canvas)
+         */
+        void drawPacked(Turtle& turtle, graphics::SegmentSink* sink);
+
+        /**
+         * Run all chunks of the packed axiom once.
+         *
+         * @param turtle The turtle to draw with
+         * @param sink The sink receiving the segments (nullptr to rasterize on the turtle's canvas)
+         * @param commands Command of every code of the packed axiom
+         * @param lattice Whether the packed axiom is a lattice program
+         */
+        void runPacked(Turtle& turtle, graphics::SegmentSink* sink,
+                       const std::vector<std::shared_ptr<TurtleCommand>>& commands, bool lattice);
+
+        /**
+         * Fill the turtle's command queue with the commands of the evaluated axiom.
+         *
+         * @param turtle The turtle to fill
+         */
+        void loadCommands(Turtle& turtle);
+
         /**
          * The initial string of the L-system.
          */
@@ -70,6 +276,27 @@ namespace lsys
          */
         std::string evaluated_axiom;
 
+        /**
+         * The evaluated axiom, when packed storage is used.
+         */
+        PackedSequence packed_axiom;
+
+        /**
+         * The evaluated axiom, when evaluated out of core or loaded from a program file.
+         */
+        io::MappedFile mapped_axiom;
+
+        /**
+         * Number of iterations the L-system was evaluated for.
+         */
+        unsigned int evaluated_iterations;
+
+        /**
+         * Header of the program file the evaluated axiom was loaded from, if any.
+         */
+        io::ProgramFileHeader program_header;
+        bool is_program_loaded;
+
         /**
          * Symbols in the L-system grammar.
          * Map of characters to turtle commands.
@@ -86,5 +313,30 @@ namespace lsys
          * Whether the L-system has been evaluated.
          */
         bool is_evaluated;
+
+        /**
+         * Whether the turtle commands are optimized before drawing.
+         */
+        bool optimize_commands;
+
+        /**
+         * Whether the optimizer merges collinear moves.
+         */
+        bool merge_moves;
+
+        /**
+         * Whether the evaluated axiom is stored packed.
+         */
+        bool packed_storage;
+
+        /**
+         * Directory for spilled generations.
+         */
+        std::string spill_directory;
+
+        /**
+         * Statistics of the last optimization pass.
+         */
+        OptimizationStats optimization_stats;
     };
 }
\ No newline at end of file
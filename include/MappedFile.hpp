@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace lsys::io
+{
+    /**
+     * A file mapped read-only into memory.
+     * The pages are loaded by the operating system on demand, so files larger than the available memory can be read.
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        /**
+         * Map a file, unmapping the previous one. The file can be removed once it is mapped.
+         *
+         * @param filename Path to the file
+         * @param offset Number of bytes at the start of the file that are skipped by getData() and getSize()
+         *
+         * @return Whether the file was mapped
+         */
+        bool open(const std::string& filename, uint64_t offset = 0);
+
+        /**
+         * Unmap the file.
+         */
+        void close();
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        bool isOpen() const;
+
+        /**
+         * Get the contents of the file past the offset (nullptr if there are none).
+         */
+        [[nodiscard]]
+        const char* getData() const;
+
+        [[nodiscard]]
+        uint64_t getSize() const;
+
+    private:
+        /**
+         * Start of the mapping.
+         */
+        void* data;
+
+        /**
+         * Size of the file in bytes.
+         */
+        uint64_t size;
+
+        /**
+         * Number of bytes skipped at the start of the file.
+         */
+        uint64_t offset;
+
+        bool is_open;
+    };
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lsys
+{
+    /**
+     * A sequence of symbols stored with 2, 4 or 8 bits per symbol.
+     * The symbols of an alphabet are remapped to dense codes, and the number of bits is the smallest that fits
+     * every code. Codes are packed into 64-bit words, least significant bits first, and never straddle words.
+     */
+    class PackedSequence
+    {
+    public:
+        /**
+         * Create an empty sequence over an alphabet.
+         *
+         * @param alphabet The distinct symbols of the alphabet, in code order (at most 256)
+         */
+        explicit PackedSequence(const std::string& alphabet = "");
+
+        /**
+         * Append a symbol. The symbol must be in the alphabet.
+         *
+         * @param symbol The symbol
+         */
+        void push_back(char symbol);
+
+        /**
+         * Append all symbols of a string. The symbols must be in the alphabet.
+         *
+         * @param symbols The symbols
+         */
+        void append(const std::string& symbols);
+
+        /**
+         * Append another sequence over the same alphabet.
+         *
+         * @param other The sequence to append
+         */
+        void append(const PackedSequence& other);
+
+        /**
+         * Get the symbol at a position.
+         *
+         * @param index Position of the symbol
+         */
+        [[nodiscard]]
+        char at(uint64_t index) const;
+
+        /**
+         * Replace every symbol of the sequence with its production, working on whole words at a time.
+         *
+         * @param productions Production of every code, over the same alphabet
+         *
+         * @return The rewritten sequence
+         */
+        [[nodiscard]]
+        PackedSequence rewrite(const std::vector<PackedSequence>& productions) const;
+
+        /**
+         * Visit every symbol of the sequence in order, decoding a word at a time.
+         *
+         * @param visit Function called with the code of every symbol
+         */
+        template<typename Visitor>
+        void forEachCode(Visitor visit) const
+        {
+            const uint64_t mask = (uint64_t(1) << bits_per_symbol) - 1;
+            uint64_t remaining = length;
+
+            for (uint64_t word : words)
+            {
+                unsigned int count = remaining < symbols_per_word ? static_cast<unsigned int>(remaining) : symbols_per_word;
+                for (unsigned int i = 0; i < count; ++i)
+                {
+                    visit(static_cast<uint8_t>(word & mask));
+                    word >>= bits_per_symbol;
+                }
+                remaining -= count;
+            }
+        }
+
+        /**
+         * Unpack the sequence into a string.
+         */
+        [[nodiscard]]
+        std::string toString() const;
+
+        /**
+         * Remove all symbols, keeping the alphabet.
+         */
+        void clear();
+
+        /**
+         * Pick the alphabet of a grammar from all the symbols it uses.
+         *
+         * @param symbols Every symbol the grammar can produce, duplicates allowed
+         *
+         * @return The distinct symbols, in code order
+         */
+        static std::string makeAlphabet(const std::string& symbols);
+
+        [[nodiscard]]
+        const std::string& getAlphabet() const;
+
+        [[nodiscard]]
+        uint8_t getCode(char symbol) const;
+
+        [[nodiscard]]
+        char getSymbol(uint8_t code) const;
+
+        [[nodiscard]]
+        unsigned int getBitsPerSymbol() const;
+
+        [[nodiscard]]
+        uint64_t size() const;
+
+        /**
+         * Get the size of the packed data, in bytes.
+         */
+        [[nodiscard]]
+        size_t getPackedSize() const;
+
+        [[nodiscard]]
+        const std::vector<uint64_t>& getWords() const;
+
+    private:
+        /**
+         * Append up to 64 bits of codes to the end of the sequence.
+         *
+         * @param bits The codes, least significant first
+         * @param count Number of codes
+         */
+        void appendBits(uint64_t bits, unsigned int count);
+
+        /**
+         * Distinct symbols, in code order.
+         */
+        std::string alphabet;
+
+        /**
+         * Code of every symbol.
+         */
+        uint8_t codes[256];
+
+        unsigned int bits_per_symbol;
+        unsigned int symbols_per_word;
+
+        /**
+         * Packed codes.
+         */
+        std::vector<uint64_t> words;
+
+        /**
+         * Number of symbols.
+         */
+        uint64_t length;
+    };
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "Turtle.hpp"
+
+namespace lsys
+{
+    /**
+     * Parameters bound to the symbols of an L-system for one variant of a sweep.
+     * The values are kept in tables indexed by symbol, so a variant is a small flat object that is cheap to copy and
+     * to look up while interpreting.
+     */
+    class SweepVariant
+    {
+    public:
+        SweepVariant();
+
+        /**
+         * Set the distance a move symbol moves the turtle forward.
+         */
+        void setDistance(char symbol, float distance);
+
+        /**
+         * Set the degrees a turn symbol turns the turtle.
+         */
+        void setDegrees(char symbol, int degrees);
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        float getDistance(char symbol) const;
+
+        [[nodiscard]]
+        int getDegrees(char symbol) const;
+
+    private:
+        std::array<float, 256> distances;
+        std::array<int, 256> degrees;
+    };
+
+    /**
+     * Draws one evaluated L-system with many sets of parameters, e.g. to explore turn angles and step lengths.
+     * The evaluated axiom is shared read-only by every variant: each variant only binds new values to the move and
+     * turn symbols, and is interpreted straight from the evaluated axiom, without building turtle commands. The
+     * variants are drawn concurrently, each on its own canvas.
+     *
+     * The kind of every symbol (move, turn, push, pop, pen up or down) is taken from the L-system's commands when the
+     * sweep is created. Symbols with custom commands are not interpreted. Moves are drawn on the floating-point path,
+     * as with Turtle::run with the lattice disabled.
+     */
+    class ParameterSweep
+    {
+    public:
+        /**
+         * Create a sweep over an L-system. The L-system must outlive the sweep, and stay unchanged while drawing.
+         *
+         * @param lsystem The L-system, evaluated as a string or mapped from disk (not with packed storage)
+         */
+        explicit ParameterSweep(const Lsystem& lsystem);
+
+        /**
+         * Get the variant with the parameters of the L-system's own commands, to start new variants from.
+         */
+        [[nodiscard]]
+        SweepVariant getDefaultVariant() const;
+
+        void addVariant(const SweepVariant& variant);
+        void clearVariants();
+
+        /**
+         * Draw every variant on its canvas, allocating the pixels of the canvases first.
+         * Canvases without a viewport get a dry run to find their bounds, as Turtle::run does.
+         *
+         * @param start The initial transform of the turtle
+         * @param canvases One canvas per variant, in the order the variants were added
+         * @param threads Number of variants drawn at the same time
+         *
+         * @return Whether the variants were drawn (false if there is no evaluated axiom, the canvases do not match, or
+         *         a drawing does not fit a canvas without a viewport, which is then left blank)
+         */
+        bool draw(const Transform2d& start, const std::vector<Canvas*>& canvases, unsigned int threads = 1) const;
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        const std::vector<SweepVariant>& getVariants() const;
+
+    private:
+        /**
+         * Interpret the evaluated axiom once with the parameters of a variant, drawing on a canvas.
+         *
+         * @param symbols The evaluated axiom
+         * @param count Number of symbols
+         * @param variant The parameters
+         * @param start The initial transform of the turtle
+         * @param canvas The canvas to draw on
+         */
+        void interpret(const char* symbols, uint64_t count, const SweepVariant& variant, const Transform2d& start,
+                       Canvas& canvas) const;
+
+        const Lsystem& lsystem;
+
+        /**
+         * Kind of command of every symbol. Symbols without a command, or with a custom one, are of the custom type.
+         */
+        std::array<TurtleCommandType, 256> types;
+
+        SweepVariant default_variant;
+
+        std::vector<SweepVariant> variants;
+    };
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "types.hpp"
+
+namespace lsys::io
+{
+    /**
+     * Version of the program file format. Files of any other version are rejected when loaded.
+     */
+    constexpr uint32_t program_file_version = 2;
+
+    /**
+     * Alignment of the symbols of a program file, in bytes.
+     */
+    constexpr uint64_t program_file_alignment = 64;
+
+    /**
+     * Represents the header of a file holding an evaluated L-system program.
+     * The header is followed by the symbol table, and then by the symbols of the evaluated axiom (one byte each)
+     * starting at the data offset. Everything is stored in native byte order so the file can be mapped into memory
+     * and used without parsing.
+     */
+    #pragma pack(push, 1)
+    struct ProgramFileHeader
+    {
+        char magic[8] = {'L', 'S', 'Y', 'S', 'P', 'R', 'O', 'G'};
+        uint32_t version = program_file_version;
+        uint32_t depth = 0; // Number of iterations the program was evaluated for
+        uint64_t grammar_hash = 0;
+        uint64_t length = 0; // Number of symbols
+        uint64_t data_offset = 0;
+        uint32_t symbol_count = 0;
+
+        // Initial transform of the turtle the bounds were computed for
+        float start_x = 0;
+        float start_y = 0;
+        int32_t start_rotation = 0;
+
+        // Bounds of the drawing, as found by a dry run of the program
+        graphics::Bounds2d bounds = {0, 0, 0, 0};
+
+        // Whether every symbol of the program maps to a lattice command (see Turtle::isLatticeCommand). If so, the
+        // dry run ran on the lattice whenever the start rotation allows it, as drawing does by default.
+        uint8_t lattice_symbols = 0;
+    };
+    #pragma pack(pop)
+
+    /**
+     * Represents an entry of the symbol table of a program file, holding the turtle command a symbol maps to.
+     */
+    #pragma pack(push, 1)
+    struct ProgramFileSymbol
+    {
+        uint8_t symbol = 0;
+        uint8_t command_type = 0; // TurtleCommandType, or 0xFF if the symbol has no command
+        uint16_t reserved = 0;
+        float value = 0; // Distance of moves, degrees of turns
+    };
+    #pragma pack(pop)
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Lsystem.hpp"
+#include "Turtle.hpp"
+
+namespace lsys::io
+{
+    /**
+     * Everything that determines the output of a render.
+     * Two renders with the same specification produce the same output, so the hash of the specification can be
+     * used as the address of the output.
+     *
+     * Custom commands only contribute their type to the grammar hash, so the specification of a grammar with custom
+     * commands is only cacheable if the caller identifies them with a custom key.
+     */
+    #pragma pack(push, 1)
+    struct RenderSpec
+    {
+        uint64_t grammar_hash = 0;
+        uint64_t custom_key = 0; // Chosen by the caller, to tell apart custom commands (0 if not given)
+        uint32_t depth = 0;
+        uint32_t output_format = 0; // Chosen by the caller, to tell apart e.g. BMP and SVG outputs
+        uint16_t width = 0;
+        uint16_t height = 0;
+        float start_x = 0;
+        float start_y = 0;
+        int32_t start_rotation = 0;
+        uint8_t has_viewport = 0;
+        uint8_t optimize_commands = 0;
+        uint8_t lattice_enabled = 0;
+        uint8_t pen_down = 0;
+        uint8_t has_custom_commands = 0;
+        uint8_t pixel_format = 0; // graphics::PixelFormat of the canvas
+        uint8_t merge_moves = 0;
+        uint8_t reserved = 0;
+        graphics::Bounds2d bounds = {0, 0, 0, 0}; // The viewport, or the bounds the drawing grows from
+
+        /**
+         * Describe the render of an L-system with a turtle.
+         * The custom key is left 0, so grammars with custom commands are not cacheable until the caller sets it.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations the L-system is evaluated for
+         * @param turtle The turtle drawing the L-system, on the canvas it draws to
+         * @param output_format Kind of output
+         *
+         * @return The specification
+         */
+        static RenderSpec describe(const Lsystem& lsystem, unsigned int depth, const Turtle& turtle,
+                                   uint32_t output_format = 0);
+
+        /**
+         * Whether the specification determines the output, so it can be cached: the grammar has no custom commands,
+         * or the caller has identified them with a custom key.
+         */
+        [[nodiscard]]
+        bool isCacheable() const;
+
+        [[nodiscard]]
+        uint64_t getHash() const;
+    };
+    #pragma pack(pop)
+
+    /**
+     * Counters of a render cache.
+     */
+    struct RenderCacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        uint64_t evictions = 0;
+    };
+
+    /**
+     * A cache of render outputs in a directory, addressed by the hash of their render specification.
+     * The total size of the directory is bounded, and the least recently used outputs are removed when it is exceeded.
+     * The modification time of an output records its last use, so the order survives between processes.
+     * Every output is stored with its specification, which has to match on lookup, so outputs of specifications
+     * with the same hash are never mixed up. Specifications that are not cacheable are never stored nor found.
+     */
+    class RenderCache
+    {
+    public:
+        /**
+         * Open a cache directory, creating it if needed.
+         *
+         * @param directory Path to the directory
+         * @param max_bytes Maximum total size of the cached outputs
+         */
+        RenderCache(const std::string& directory, uint64_t max_bytes);
+
+        /**
+         * Look up the output of a render.
+         *
+         * @param spec Specification of the render
+         *
+         * @return Path to the cached output, or an empty string if it is not cached
+         */
+        std::string find(const RenderSpec& spec);
+
+        /**
+         * Copy the output of a render into the cache, evicting the least recently used outputs to make room.
+         *
+         * @param spec Specification of the render
+         * @param filename Path to the output
+         *
+         * @return Whether the output was stored
+         */
+        bool store(const RenderSpec& spec, const std::string& filename);
+
+        /**
+         * Produce the output of a render, taking it from the cache if possible.
+         * On a miss the render function is called to write the output, which is then stored in the cache.
+         *
+         * @param spec Specification of the render
+         * @param filename Path the output is written to
+         * @param render Function writing the output to a given path, returning whether it succeeded
+         *
+         * @return Whether the output was written
+         */
+        template<typename RenderFunction>
+        bool render(const RenderSpec& spec, const std::string& filename, RenderFunction render)
+        {
+            std::string cached = find(spec);
+            if (!cached.empty() && copyFile(cached, filename)) return true;
+
+            if (!render(filename)) return false;
+
+            store(spec, filename);
+            return true;
+        }
+
+        /**
+         * Remove all cached outputs.
+         */
+        void clear();
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        const std::string& getDirectory() const;
+
+        [[nodiscard]]
+        uint64_t getMaxBytes() const;
+
+        /**
+         * Get the total size of the cached outputs.
+         */
+        [[nodiscard]]
+        uint64_t getTotalBytes() const;
+
+        [[nodiscard]]
+        const RenderCacheStats& getStats() const;
+
+    private:
+        /**
+         * Get the path of the cached output of a render.
+         *
+         * @param spec Specification of the render
+         */
+        [[nodiscard]]
+        std::string getEntryPath(const RenderSpec& spec) const;
+
+        /**
+         * Get the path of the specification stored with a cached output.
+         *
+         * @param entry_path Path of the cached output
+         */
+        [[nodiscard]]
+        static std::string getSpecPath(const std::string& entry_path);
+
+        /**
+         * Remove the least recently used outputs until the cache fits in its maximum size.
+         */
+        void evict();
+
+        /**
+         * Copy a file.
+         *
+         * @param source Path to the file to copy
+         * @param destination Path to the copy
+         *
+         * @return Whether the file was copied
+         */
+        static bool copyFile(const std::string& source, const std::string& destination);
+
+        /**
+         * Directory holding the outputs.
+         */
+        std::string directory;
+
+        uint64_t max_bytes;
+
+        /**
+         * Total size of the outputs, found when the cache is opened and kept up to date since.
+         */
+        uint64_t total_bytes;
+
+        RenderCacheStats stats;
+    };
+}
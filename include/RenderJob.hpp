@@ -0,0 +1,155 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Lsystem.hpp"
+#include "RenderPipeline.hpp"
+#include "Turtle.hpp"
+
+namespace lsys
+{
+    /**
+     * State of a render job.
+     */
+    enum class RenderStatus
+    {
+        Running,
+        Completed,
+        Cancelled,
+        DeadlineExceeded,
+        Failed
+    };
+
+    /**
+     * What a render job draws, and where it writes the image.
+     */
+    struct RenderRequest
+    {
+        /**
+         * Number of iterations the L-system is evaluated for.
+         */
+        unsigned int depth = 0;
+
+        /**
+         * Initial transform of the turtle.
+         */
+        Transform2d start = {{0, 0}, 0};
+
+        unsigned short width = 1000;
+        unsigned short height = 1000;
+        PixelFormat pixel_format = PixelFormat::Rgb24;
+
+        /**
+         * Region of the plane shown on the canvas, if has_viewport is set. Otherwise the canvas grows to fit the
+         * drawing, with a dry run first.
+         */
+        bool has_viewport = false;
+        Bounds2d viewport = {0, 0, 0, 0};
+
+        /**
+         * Path of the BMP image (no image is written if empty).
+         */
+        std::string filename;
+
+        /**
+         * Time by which the render must be done (none by default).
+         */
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    };
+
+    /**
+     * Renders an L-system on a thread of its own with a RenderPipeline, and serves as a handle to the running render.
+     * The job owns its canvas and its copy of the L-system's grammar, so the L-system it was created from can change
+     * once the job started.
+     *
+     * A job stops within a batch of every pipeline stage once it is cancelled or reaches its deadline, and fails if
+     * the render throws (e.g. out of memory) or the image cannot be written. The canvas and batches of a job that
+     * stopped or failed are freed before it reports so, and a partly written image is removed. The canvas of a
+     * completed job is kept, so a job without a filename draws for its owner.
+     */
+    class RenderJob
+    {
+    public:
+        /**
+         * Start rendering an L-system. The L-system does not need to be evaluated.
+         *
+         * @param lsystem The L-system, whose axiom, symbols and rules are copied
+         * @param request What to draw, and where to write the image
+         * @param batch_size Number of symbols or segments in a batch of the pipeline
+         */
+        RenderJob(const Lsystem& lsystem, const RenderRequest& request, size_t batch_size = 1 << 16);
+
+        /**
+         * Cancel the render if it is still running, and wait for it to stop.
+         */
+        ~RenderJob();
+
+        RenderJob(const RenderJob&) = delete;
+        RenderJob& operator=(const RenderJob&) = delete;
+
+        /**
+         * Ask the render to stop. Returns at once; wait for the job to know when it stopped.
+         */
+        void cancel();
+
+        /**
+         * Wait until the render is done or stopped.
+         *
+         * @return The final status
+         */
+        RenderStatus wait();
+
+        /**
+         * Wait until the render is done or stopped, or the timeout expires.
+         *
+         * @param timeout Longest time to wait
+         *
+         * @return The status, Running if the timeout expired first
+         */
+        RenderStatus waitFor(std::chrono::milliseconds timeout);
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        RenderStatus getStatus() const;
+
+        [[nodiscard]]
+        RenderProgress getProgress() const;
+
+        /**
+         * Why the job failed, empty unless its status is Failed.
+         */
+        [[nodiscard]]
+        std::string getError() const;
+
+        /**
+         * The drawn canvas, once the job completed (nullptr before, or if it stopped or failed).
+         */
+        [[nodiscard]]
+        const Canvas* getCanvas() const;
+
+    private:
+        /**
+         * Run the render on the job's thread.
+         */
+        void run();
+
+        Lsystem lsystem;
+        RenderRequest request;
+
+        RenderControl control;
+        RenderPipeline pipeline;
+
+        mutable std::mutex status_mutex;
+        std::condition_variable status_changed;
+        RenderStatus status;
+        std::string error;
+        std::unique_ptr<Canvas> canvas;
+
+        std::thread worker;
+    };
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "Lsystem.hpp"
+#include "Turtle.hpp"
+
+namespace lsys
+{
+    /**
+     * Counters of a pipelined render.
+     */
+    struct RenderPipelineStats
+    {
+        uint64_t symbols = 0;
+        uint64_t segments = 0;
+        uint64_t symbol_batches = 0;
+        uint64_t segment_batches = 0;
+    };
+
+    /**
+     * Progress of a render: how much of every stage is done, out of its total.
+     * Without a viewport the totals include the dry run. The segment total counts the moves, so it is only reached
+     * if the pen stays down.
+     */
+    struct RenderProgress
+    {
+        uint64_t symbols_done = 0;
+        uint64_t symbols_total = 0;
+        uint64_t segments_done = 0;
+        uint64_t segments_total = 0;
+        uint64_t rows_done = 0;
+        uint64_t rows_total = 0;
+    };
+
+    /**
+     * Lets other threads follow a render and stop it.
+     * The stages of the pipeline report their progress and check whether to stop once per batch, so a render stops
+     * within a batch of every stage after being cancelled or reaching its deadline.
+     */
+    class RenderControl
+    {
+    public:
+        RenderControl();
+
+        /**
+         * Ask the render to stop. Can be called from any thread.
+         */
+        void cancel();
+
+        /**
+         * Set the time by which the render must be done (none by default). Must be set before the render starts.
+         *
+         * @param deadline Time of the steady clock at which the render stops
+         */
+        void setDeadline(std::chrono::steady_clock::time_point deadline);
+
+        /**
+         * Whether the render has to stop, because it was cancelled or reached its deadline.
+         * Once true, it stays true.
+         */
+        bool shouldStop();
+
+        /**
+         * Set the totals of the progress and clear what is done.
+         */
+        void start(uint64_t symbols_total, uint64_t segments_total, uint64_t rows_total);
+
+        /**
+         * Add to the progress of a stage.
+         */
+        void addSymbols(uint64_t count);
+        void addSegments(uint64_t count);
+        void addRows(uint64_t count);
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        RenderProgress getProgress() const;
+
+        /**
+         * Whether the render was stopped before it was done.
+         */
+        [[nodiscard]]
+        bool isStopped() const;
+
+        [[nodiscard]]
+        bool isCancelled() const;
+
+    private:
+        std::atomic<bool> cancelled;
+        std::atomic<bool> stopped;
+        std::chrono::steady_clock::time_point deadline;
+
+        std::atomic<uint64_t> symbols_done;
+        std::atomic<uint64_t> symbols_total;
+        std::atomic<uint64_t> segments_done;
+        std::atomic<uint64_t> segments_total;
+        std::atomic<uint64_t> rows_done;
+        std::atomic<uint64_t> rows_total;
+    };
+
+    /**
+     * Renders an L-system with a pipeline of stages running on their own threads.
+     * The evaluate stage expands the axiom depth first and emits the symbols of the last generation, the interpret
+     * stage runs them through a turtle and emits line segments, and the rasterize stage draws the segments on the
+     * canvas. The stages pass fixed-size batches through bounded single-producer single-consumer queues, so the
+     * evaluated axiom and the command queue are never held in full, and the stages overlap.
+     *
+     * Without a viewport, the bounds are found first by running the pipeline without drawing, as Turtle::run does
+     * with its dry run. The image is encoded once the last segment is drawn, since any segment can touch any row.
+     */
+    class RenderPipeline
+    {
+    public:
+        /**
+         * Create a pipeline.
+         *
+         * @param batch_size Number of symbols or segments in a batch
+         * @param queue_capacity Number of batches each queue holds
+         */
+        explicit RenderPipeline(size_t batch_size = 1 << 16, size_t queue_capacity = 4);
+
+        /**
+         * Render an L-system to a BMP image. The L-system does not need to be evaluated.
+         * The turtle's commands are executed on the floating-point path, as with a sink.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations the L-system is evaluated for
+         * @param turtle The turtle giving the initial transform and the canvas to draw on
+         * @param filename Path to the image
+         *
+         * @return Whether the whole image was written
+         */
+        bool render(const Lsystem& lsystem, unsigned int depth, Turtle& turtle, const std::string& filename);
+
+        /**
+         * Render an L-system on the turtle's canvas, without encoding it.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations the L-system is evaluated for
+         * @param turtle The turtle giving the initial transform and the canvas to draw on
+         */
+        void draw(const Lsystem& lsystem, unsigned int depth, Turtle& turtle);
+
+        [[nodiscard]]
+        const RenderPipelineStats& getStats() const;
+
+        /**
+         * Control the following renders report their progress to and stop on (none by default).
+         * A stopped render leaves the canvas partly drawn, and the image partly written.
+         */
+        [[nodiscard]]
+        RenderControl* getControl() const;
+        void setControl(RenderControl* control);
+
+    private:
+        /**
+         * Draw the L-system, with a dry run first if there is no viewport.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations the L-system is evaluated for
+         * @param turtle The turtle giving the initial transform and the canvas to draw on
+         * @param rows_total Number of rows encoded after drawing, for the progress
+         */
+        void drawPasses(const Lsystem& lsystem, unsigned int depth, Turtle& turtle, uint64_t rows_total);
+
+        /**
+         * Count the symbols with a command, and the moves among them, in the L-system evaluated for a depth.
+         */
+        static void countCommands(const Lsystem& lsystem, unsigned int depth, uint64_t& symbols, uint64_t& moves);
+
+        /**
+         * Run the evaluate, interpret and rasterize stages once.
+         *
+         * @param lsystem The L-system
+         * @param depth Number of iterations the L-system is evaluated for
+         * @param turtle The turtle giving the initial transform and the canvas to draw on
+         */
+        void runStages(const Lsystem& lsystem, unsigned int depth, Turtle& turtle);
+
+        size_t batch_size;
+        size_t queue_capacity;
+
+        RenderPipelineStats stats;
+
+        RenderControl* control;
+    };
+}
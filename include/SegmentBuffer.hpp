@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "SegmentSink.hpp"
+#include "types.hpp"
+
+namespace lsys::graphics
+{
+    /**
+     * Collects the segments of a turtle program in structure-of-arrays buffers and hands them to a consumer in
+     * large chunks. Keeping every coordinate in its own array lets the consumers (rasterization, vector output,
+     * binning, statistics) run transforms, reductions and pixel conversions as plain loops over the whole chunk.
+     *
+     * Only the segments are kept, not the push/pop and pen events. Consumers that need path breaks can find them
+     * where a segment does not start at the end of the previous one.
+     */
+    class SegmentBuffer : public SegmentSink
+    {
+    public:
+        /**
+         * Function receiving every full chunk, and the last partial one on flush.
+         */
+        using Consumer = std::function<void(const SegmentBuffer&)>;
+
+        /**
+         * Create a buffer.
+         *
+         * @param capacity Number of segments in a chunk
+         * @param consumer Function receiving the chunks (none to keep every segment)
+         */
+        explicit SegmentBuffer(size_t capacity = 1 << 16, Consumer consumer = Consumer());
+
+        void addSegment(Point2d start, Point2d end) override;
+        void pushState() override;
+        void popState() override;
+
+        /**
+         * Hand the buffered segments to the consumer, if any, and clear the buffer.
+         * Without a consumer, the segments are kept.
+         */
+        void flush();
+
+        /**
+         * Remove every segment.
+         */
+        void clear();
+
+        /**
+         * Get the bounds of all segments in the buffer (all zero if empty).
+         */
+        [[nodiscard]]
+        Bounds2d getBounds() const;
+
+        /**
+         * Get the sum of the lengths of all segments in the buffer.
+         */
+        [[nodiscard]]
+        double getTotalLength() const;
+
+        /**
+         * Scale and translate every segment: x' = x * scale_x + offset_x, and likewise for y.
+         */
+        void transform(float scale_x, float scale_y, float offset_x, float offset_y);
+
+        /**
+         * Append the segments of another buffer, rotated, scaled and then translated, as if drawn by a copy of its
+         * turtle placed at an offset. The buffer is flushed whenever it reaches its capacity.
+         *
+         * @param source The segments to append, in their local space
+         * @param rotation Counterclockwise rotation in degrees
+         * @param scale Uniform scale
+         * @param offset Translation applied last
+         */
+        void appendTransformed(const SegmentBuffer& source, float rotation, float scale, Point2d offset);
+
+        /**
+         * Pass every segment in the buffer to another sink, in order.
+         *
+         * @param sink The sink
+         */
+        void forwardTo(SegmentSink& sink) const;
+
+        /////////////////////////////////////////////
+
+        [[nodiscard]]
+        size_t size() const;
+
+        [[nodiscard]]
+        bool empty() const;
+
+        [[nodiscard]]
+        size_t getCapacity() const;
+
+        /**
+         * Coordinates of the start and end points of the segments, one array per coordinate.
+         */
+        [[nodiscard]]
+        const float* getStartX() const;
+
+        [[nodiscard]]
+        const float* getStartY() const;
+
+        [[nodiscard]]
+        const float* getEndX() const;
+
+        [[nodiscard]]
+        const float* getEndY() const;
+
+        /**
+         * Depth of the turtle's state stack when each segment was drawn.
+         */
+        [[nodiscard]]
+        const uint32_t* getDepths() const;
+
+    private:
+        size_t capacity;
+        Consumer consumer;
+
+        std::vector<float> start_x;
+        std::vector<float> start_y;
+        std::vector<float> end_x;
+        std::vector<float> end_y;
+        std::vector<uint32_t> depths;
+
+        /**
+         * Current depth of the turtle's state stack.
+         */
+        uint32_t depth;
+    };
+}
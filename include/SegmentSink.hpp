@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace lsys::graphics
+{
+    /**
+     * Receives the geometry produced by a turtle as a stream of line segments.
+     * A sink can be used instead of a canvas when the output is not a raster image (e.g. vector output),
+     * in which case no pixels are ever allocated.
+     *
+     * Besides segments, a sink is notified of the events that break the continuity of the turtle's path.
+     */
+    class SegmentSink
+    {
+    public:
+        virtual ~SegmentSink() = default;
+
+        /**
+         * Add a line segment drawn by the turtle.
+         *
+         * @param start Start point of the segment
+         * @param end End point of the segment
+         */
+        virtual void addSegment(Point2d start, Point2d end) = 0;
+
+        /**
+         * Called when the turtle pushes its state to the stack.
+         */
+        virtual void pushState() {}
+
+        /**
+         * Called when the turtle pops its state from the stack.
+         */
+        virtual void popState() {}
+
+        /**
+         * Called when the turtle stops drawing.
+         */
+        virtual void penUp() {}
+
+        /**
+         * Called when the turtle starts drawing again.
+         */
+        virtual void penDown() {}
+    };
+}
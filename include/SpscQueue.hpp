@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace lsys
+{
+    /**
+     * A bounded lock-free queue with a single producer thread and a single consumer thread.
+     * The producer closes the queue once it is done, after which the consumer drains the remaining items.
+     *
+     * @tparam T Type of the items, moved in and out of the queue
+     */
+    template<typename T>
+    class SpscQueue
+    {
+    public:
+        /**
+         * Create an empty queue.
+         *
+         * @param capacity Maximum number of items in the queue
+         */
+        explicit SpscQueue(size_t capacity)
+            : slots(capacity + 1)
+            , head(0)
+            , tail(0)
+            , closed(false)
+        {
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        /**
+         * Add an item, waiting while the queue is full. Must only be called by the producer.
+         *
+         * @param item The item
+         */
+        void push(T&& item)
+        {
+            size_t current_tail = tail.load(std::memory_order_relaxed);
+            size_t next_tail = (current_tail + 1) % slots.size();
+
+            while (next_tail == head.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            slots[current_tail] = std::move(item);
+            tail.store(next_tail, std::memory_order_release);
+        }
+
+        /**
+         * Take the oldest item, waiting while the queue is empty. Must only be called by the consumer.
+         *
+         * @param item Set to the item
+         *
+         * @return Whether an item was taken (false once the queue is closed and empty)
+         */
+        bool pop(T& item)
+        {
+            size_t current_head = head.load(std::memory_order_relaxed);
+
+            while (current_head == tail.load(std::memory_order_acquire))
+            {
+                // Check the tail again after seeing the queue closed, since the last push may have come just before
+                if (closed.load(std::memory_order_acquire))
+                {
+                    if (current_head == tail.load(std::memory_order_acquire)) return false;
+                    break;
+                }
+
+                std::this_thread::yield();
+            }
+
+            item = std::move(slots[current_head]);
+            head.store((current_head + 1) % slots.size(), std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Signal that no more items will be added. Must only be called by the producer.
+         */
+        void close()
+        {
+            closed.store(true, std::memory_order_release);
+        }
+
+    private:
+        /**
+         * Ring of items, with one slot always left empty to tell a full queue from an empty one.
+         */
+        std::vector<T> slots;
+
+        /**
+         * Index of the oldest item, advanced by the consumer.
+         * The indices are kept on separate cache lines, so the two threads do not contend for one line.
+         */
+        alignas(64) std::atomic<size_t> head;
+
+        /**
+         * Index of the next free slot, advanced by the producer.
+         */
+        alignas(64) std::atomic<size_t> tail;
+
+        std::atomic<bool> closed;
+    };
+}
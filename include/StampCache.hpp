@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Canvas.hpp"
+
+namespace lsys
+{
+    using namespace graphics;
+
+    /**
+     * The pixels drawn by a subtree of a derivation, relative to the pixel of the turtle when the subtree starts.
+     *
+     * The pixels of a line only depend on the pixels of its end points, so a stamp can be blitted anywhere the
+     * turtle starts with the same heading, as long as every vertex of the subtree falls on the same pixel
+     * relative to the start pixel. This holds while the subpixel offset of the start stays within the validity
+     * range of the stamp, which is computed from the vertices when the stamp is recorded, and while the stamp stays
+     * within the canvas, where lines are neither clipped nor dropped.
+     */
+    struct RasterStamp
+    {
+        /**
+         * Offsets of the pixels to set, relative to the start pixel.
+         */
+        std::vector<Vec2<int>> offsets;
+
+        /**
+         * Bounding box of the offsets, inclusive.
+         */
+        Vec2<int> min_offset = {0, 0};
+        Vec2<int> max_offset = {0, 0};
+
+        /**
+         * Position of the turtle after the subtree, relative to its start position.
+         */
+        Point2d end_offset;
+
+        /**
+         * Rotation of the turtle after the subtree.
+         */
+        int end_rotation = 0;
+
+        /**
+         * Range [min, max) of subpixel offsets of the start position for which the stamp is exact.
+         */
+        double min_x = 0;
+        double max_x = 1;
+        double min_y = 0;
+        double max_y = 1;
+
+        /**
+         * Whether the stamp is exact for a start position with the given subpixel offset.
+         *
+         * @param x Subpixel offset in x, in [0, 1)
+         * @param y Subpixel offset in y, in [0, 1)
+         */
+        [[nodiscard]]
+        bool isExactAt(double x, double y) const;
+
+        /**
+         * Whether the stamp blitted from a start pixel lies entirely within a canvas.
+         *
+         * @param start_pixel Pixel of the start position
+         * @param width Width of the canvas
+         * @param height Height of the canvas
+         */
+        [[nodiscard]]
+        bool fitsAt(Pixelxy start_pixel, unsigned short width, unsigned short height) const;
+    };
+
+    /**
+     * Counters of a stamp cache.
+     */
+    struct StampCacheStats
+    {
+        /**
+         * Subtrees drawn by blitting a stamp.
+         */
+        size_t hits = 0;
+
+        /**
+         * Subtrees drawn normally without a stamp, either while recording a new one or on their first occurrence.
+         */
+        size_t misses = 0;
+
+        /**
+         * Subtrees drawn normally because the cached stamp was not exact at their position, or would cross the edge
+         * of the canvas.
+         */
+        size_t fallbacks = 0;
+
+        /**
+         * Number of stamps and total number of pixels stored in them.
+         */
+        size_t stamps = 0;
+        size_t stored_pixels = 0;
+    };
+
+    /**
+     * Cache of raster stamps for repeated subtrees of a derivation.
+     * Stamps are keyed on the symbol and depth of the subtree, the heading of the turtle and the subpixel offset
+     * of its start position, quantized into buckets.
+     *
+     * Small subtrees are cheaper to draw than to look up, and large ones would need large stamps, so only subtrees
+     * with a number of moves within a configurable range are cached. Subtrees deeper than max_depth are not cached,
+     * so the depth keeps a field of its own in the key.
+     */
+    class StampCache
+    {
+    public:
+        static constexpr unsigned int max_depth = (1u << 31) - 1;
+
+        /**
+         * @param subpixel_buckets Number of buckets the subpixel offset is quantized into, per axis
+         * @param min_moves Minimum number of moves of a cached subtree
+         * @param max_moves Maximum number of moves of a cached subtree
+         * @param max_pixels Maximum total number of pixels stored, after which no more stamps are recorded
+         */
+        explicit StampCache(unsigned int subpixel_buckets = 8, uint64_t min_moves = 32, uint64_t max_moves = 1 << 16,
+                            size_t max_pixels = 1 << 24);
+
+        /**
+         * Whether a subtree should be cached.
+         *
+         * @param depth Depth of the subtree
+         * @param moves Number of moves of the subtree
+         */
+        [[nodiscard]]
+        bool isCacheable(unsigned int depth, uint64_t moves) const;
+
+        /**
+         * Whether more stamps can be recorded.
+         */
+        [[nodiscard]]
+        bool isFull() const;
+
+        /**
+         * Find the stamp of a subtree.
+         *
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree
+         * @param rotation Rotation of the turtle at the start of the subtree
+         * @param subpixel Subpixel offset of the start position
+         *
+         * @return The stamp, or nullptr if none was recorded yet
+         */
+        [[nodiscard]]
+        const RasterStamp* find(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel) const;
+
+        /**
+         * Whether a stamp should be recorded for a subtree that has no stamp yet.
+         * Most subtrees near the root of a derivation occur only once, so a stamp is only recorded the second time
+         * a key is seen.
+         *
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree
+         * @param rotation Rotation of the turtle at the start of the subtree
+         * @param subpixel Subpixel offset of the start position
+         */
+        bool shouldRecord(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel);
+
+        /**
+         * Record the stamp of a subtree from the lines it drew.
+         *
+         * @param symbol Symbol at the root of the subtree
+         * @param depth Depth of the subtree
+         * @param start_position Position of the turtle at the start of the subtree
+         * @param start_rotation Rotation of the turtle at the start of the subtree
+         * @param end_position Position of the turtle at the end of the subtree
+         * @param end_rotation Rotation of the turtle at the end of the subtree
+         * @param lines End points of the lines drawn by the subtree, as pairs of points
+         * @param canvas The canvas the lines were drawn on
+         */
+        void record(char symbol, unsigned int depth, Point2d start_position, int start_rotation,
+                    Point2d end_position, int end_rotation, const std::vector<Point2d>& lines, const Canvas& canvas);
+
+        /**
+         * Remove all stamps. Must be called when the canvas bounds change, since stamps depend on them.
+         */
+        void clear();
+
+        [[nodiscard]]
+        const StampCacheStats& getStats() const;
+        StampCacheStats& getStats();
+
+    private:
+        /**
+         * Pack a cache key.
+         */
+        [[nodiscard]]
+        uint64_t makeKey(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel) const;
+
+        /**
+         * Number of buckets the subpixel offset is quantized into, per axis.
+         */
+        unsigned int subpixel_buckets;
+
+        /**
+         * Range of the number of moves of cached subtrees.
+         */
+        uint64_t min_moves;
+        uint64_t max_moves;
+
+        /**
+         * Maximum total number of pixels stored.
+         */
+        size_t max_pixels;
+
+        /**
+         * Stamps by key.
+         */
+        std::unordered_map<uint64_t, RasterStamp> stamps;
+
+        /**
+         * Keys seen once, without a stamp yet.
+         */
+        std::unordered_set<uint64_t> seen;
+
+        StampCacheStats stats;
+    };
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "StaticLsystem.hpp"
+
+namespace lsys::grammar
+{
+    /**
+     * Axioms and successors of the shipped grammars.
+     * They are members of a class template so they have a single definition across translation units.
+     */
+    template<typename T = void>
+    struct CatalogueStrings
+    {
+        static constexpr char binary_fractal_axiom[] = "0";
+        static constexpr char binary_fractal_0[] = "1[+0]-0";
+        static constexpr char binary_fractal_1[] = "11";
+
+        static constexpr char koch_curve_axiom[] = "F";
+        static constexpr char koch_curve_f[] = "F+F-F-F+F";
+
+        static constexpr char sierpinski_triangle_axiom[] = "F-G-G";
+        static constexpr char sierpinski_triangle_f[] = "F-G+F+G-F";
+        static constexpr char sierpinski_triangle_g[] = "GG";
+
+        static constexpr char fractal_plant_axiom[] = "X";
+        static constexpr char fractal_plant_x[] = "F+[[X]-X]-F[-FX]+X";
+        static constexpr char fractal_plant_f[] = "FF";
+    };
+
+    template<typename T> constexpr char CatalogueStrings<T>::binary_fractal_axiom[];
+    template<typename T> constexpr char CatalogueStrings<T>::binary_fractal_0[];
+    template<typename T> constexpr char CatalogueStrings<T>::binary_fractal_1[];
+    template<typename T> constexpr char CatalogueStrings<T>::koch_curve_axiom[];
+    template<typename T> constexpr char CatalogueStrings<T>::koch_curve_f[];
+    template<typename T> constexpr char CatalogueStrings<T>::sierpinski_triangle_axiom[];
+    template<typename T> constexpr char CatalogueStrings<T>::sierpinski_triangle_f[];
+    template<typename T> constexpr char CatalogueStrings<T>::sierpinski_triangle_g[];
+    template<typename T> constexpr char CatalogueStrings<T>::fractal_plant_axiom[];
+    template<typename T> constexpr char CatalogueStrings<T>::fractal_plant_x[];
+    template<typename T> constexpr char CatalogueStrings<T>::fractal_plant_f[];
+
+    using BinaryFractal = Grammar<
+        CatalogueStrings<>::binary_fractal_axiom,
+        List<Symbol<'1', Move<5>>, Symbol<'[', Push>, Symbol<']', Pop>, Symbol<'+', Turn<45>>, Symbol<'-', Turn<-45>>>,
+        List<Rule<'0', CatalogueStrings<>::binary_fractal_0>, Rule<'1', CatalogueStrings<>::binary_fractal_1>>>;
+
+    using KochCurve = Grammar<
+        CatalogueStrings<>::koch_curve_axiom,
+        List<Symbol<'F', Move<5>>, Symbol<'+', Turn<90>>, Symbol<'-', Turn<-90>>>,
+        List<Rule<'F', CatalogueStrings<>::koch_curve_f>>>;
+
+    using SierpinskiTriangle = Grammar<
+        CatalogueStrings<>::sierpinski_triangle_axiom,
+        List<Symbol<'F', Move<20>>, Symbol<'G', Move<20>>, Symbol<'+', Turn<120>>, Symbol<'-', Turn<-120>>>,
+        List<Rule<'F', CatalogueStrings<>::sierpinski_triangle_f>,
+             Rule<'G', CatalogueStrings<>::sierpinski_triangle_g>>>;
+
+    using FractalPlant = Grammar<
+        CatalogueStrings<>::fractal_plant_axiom,
+        List<Symbol<'F', Move<15>>, Symbol<'+', Turn<25>>, Symbol<'-', Turn<-25>>, Symbol<'[', Push>, Symbol<']', Pop>>,
+        List<Rule<'X', CatalogueStrings<>::fractal_plant_x>, Rule<'F', CatalogueStrings<>::fractal_plant_f>>>;
+}
@@ -0,0 +1,514 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Canvas.hpp"
+#include "SegmentSink.hpp"
+#include "Turtle.hpp"
+
+namespace lsys::grammar
+{
+    /////////////////////////////////////////////
+    // Grammar definition
+    /////////////////////////////////////////////
+
+    /**
+     * Move forward by Numerator / Denominator units, drawing if the pen is down.
+     */
+    template<int Numerator, int Denominator = 1>
+    struct Move
+    {
+        static constexpr float distance = static_cast<float>(Numerator) / Denominator;
+    };
+
+    /**
+     * Turn by a constant number of degrees. Left if positive, right if negative.
+     */
+    template<int Degrees>
+    struct Turn
+    {
+        static constexpr int degrees = (Degrees % 360 + 360) % 360;
+    };
+
+    struct Push {};
+    struct Pop {};
+    struct PenUp {};
+    struct PenDown {};
+
+    /**
+     * Symbol without a command, only used by the rules.
+     */
+    struct NoOp {};
+
+    /**
+     * Associate a symbol with the action it performs.
+     */
+    template<char Name, typename Action>
+    struct Symbol {};
+
+    /**
+     * Production rule replacing a symbol with a string.
+     * The string must be a constexpr character array with static storage.
+     */
+    template<char Predecessor, const char* Successor>
+    struct Rule {};
+
+    /**
+     * List of symbols or rules.
+     */
+    template<typename... Items>
+    struct List {};
+
+    /**
+     * A grammar fixed at compile time. The axiom must be a constexpr character array with static storage.
+     *
+     * @tparam Axiom The axiom
+     * @tparam Symbols List of Symbol
+     * @tparam Rules List of Rule
+     */
+    template<const char* Axiom, typename Symbols, typename Rules>
+    struct Grammar {};
+
+    /////////////////////////////////////////////
+    // Compile-time lookups
+    /////////////////////////////////////////////
+
+    /**
+     * Length of a constant string.
+     */
+    constexpr size_t length(const char* text)
+    {
+        size_t size = 0;
+        while (text[size] != '\0') ++size;
+        return size;
+    }
+
+    /**
+     * Action of a symbol in a list of symbols (NoOp if the symbol is not in the list).
+     */
+    template<char Name, typename Symbols>
+    struct FindAction
+    {
+        using type = NoOp;
+    };
+
+    template<char Name, typename Action, typename... Rest>
+    struct FindAction<Name, List<Symbol<Name, Action>, Rest...>>
+    {
+        using type = Action;
+    };
+
+    template<char Name, char Other, typename Action, typename... Rest>
+    struct FindAction<Name, List<Symbol<Other, Action>, Rest...>>
+    {
+        using type = typename FindAction<Name, List<Rest...>>::type;
+    };
+
+    /**
+     * Marks a symbol without a rule.
+     */
+    struct NoRule {};
+
+    /**
+     * Rule of a symbol in a list of rules (NoRule if the symbol has no rule).
+     */
+    template<char Name, typename Rules>
+    struct FindRule
+    {
+        using type = NoRule;
+    };
+
+    template<char Name, const char* Successor, typename... Rest>
+    struct FindRule<Name, List<Rule<Name, Successor>, Rest...>>
+    {
+        using type = Rule<Name, Successor>;
+    };
+
+    template<char Name, char Other, const char* Successor, typename... Rest>
+    struct FindRule<Name, List<Rule<Other, Successor>, Rest...>>
+    {
+        using type = typename FindRule<Name, List<Rest...>>::type;
+    };
+
+    /**
+     * Cosine and sine of every whole degree, folded at compile time.
+     * The angles are rounded to float radians first, as Canvas::moveFromPoint does at run time, and the results are
+     * correctly rounded to float. The C library can be one ulp off at a few angles (13, 19, 22, 103 and 188 degrees
+     * with glibc), where points can differ from the runtime ones by float rounding.
+     */
+    struct TrigTable
+    {
+        float cos[360];
+        float sin[360];
+
+        constexpr TrigTable()
+            : cos()
+            , sin()
+        {
+            for (int degrees = 0; degrees < 360; ++degrees)
+            {
+                auto radians = static_cast<long double>(static_cast<float>(degrees * M_PI / 180.0));
+
+                // Reduce to [-pi, pi] so the series converges quickly
+                long double pi = 3.141592653589793238462643383279502884L;
+                if (radians > pi) radians -= 2 * pi;
+
+                long double cos_sum = 0;
+                long double sin_sum = 0;
+                long double term = 1;
+                for (int n = 0; n < 40; ++n)
+                {
+                    if (n % 2 == 0)
+                        cos_sum += (n % 4 == 0 ? term : -term);
+                    else
+                        sin_sum += (n % 4 == 1 ? term : -term);
+                    term *= radians / (n + 1);
+                }
+
+                cos[degrees] = static_cast<float>(cos_sum);
+                sin[degrees] = static_cast<float>(sin_sum);
+            }
+        }
+    };
+
+    template<typename T = void>
+    struct Trig
+    {
+        static constexpr TrigTable table{};
+    };
+
+    template<typename T>
+    constexpr TrigTable Trig<T>::table;
+
+    /////////////////////////////////////////////
+    // Interpretation
+    /////////////////////////////////////////////
+
+    /**
+     * State of the turtle while a grammar is interpreted, drawing to a canvas or streaming to a segment sink.
+     */
+    struct StaticTurtle
+    {
+        graphics::Point2d position;
+        int rotation;
+        std::vector<std::pair<graphics::Point2d, int>> stack;
+
+        graphics::Canvas* canvas;
+        graphics::SegmentSink* sink;
+        bool pen_down;
+    };
+
+    template<typename Action>
+    struct Perform
+    {
+        static void run(StaticTurtle&) {}
+    };
+
+    template<int Numerator, int Denominator>
+    struct Perform<Move<Numerator, Denominator>>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            constexpr float distance = Move<Numerator, Denominator>::distance;
+
+            graphics::Point2d end = turtle.position;
+            end.x += Trig<>::table.cos[turtle.rotation] * distance;
+            end.y += Trig<>::table.sin[turtle.rotation] * distance;
+
+            if (turtle.sink != nullptr)
+            {
+                if (turtle.pen_down) turtle.sink->addSegment(turtle.position, end);
+            }
+            else
+            {
+                turtle.canvas->drawLine(turtle.position, end);
+            }
+
+            turtle.position = end;
+        }
+    };
+
+    template<int Degrees>
+    struct Perform<Turn<Degrees>>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            turtle.rotation += Turn<Degrees>::degrees;
+            if (turtle.rotation >= 360) turtle.rotation -= 360;
+        }
+    };
+
+    template<>
+    struct Perform<Push>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            turtle.stack.emplace_back(turtle.position, turtle.rotation);
+            if (turtle.sink != nullptr) turtle.sink->pushState();
+        }
+    };
+
+    template<>
+    struct Perform<Pop>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            if (turtle.stack.empty()) return;
+
+            turtle.position = turtle.stack.back().first;
+            turtle.rotation = turtle.stack.back().second;
+            turtle.stack.pop_back();
+            if (turtle.sink != nullptr) turtle.sink->popState();
+        }
+    };
+
+    template<>
+    struct Perform<PenUp>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            turtle.pen_down = false;
+            if (turtle.sink != nullptr) turtle.sink->penUp();
+            else turtle.canvas->penUp();
+        }
+    };
+
+    template<>
+    struct Perform<PenDown>
+    {
+        static void run(StaticTurtle& turtle)
+        {
+            turtle.pen_down = true;
+            if (turtle.sink != nullptr) turtle.sink->penDown();
+            else turtle.canvas->penDown();
+        }
+    };
+
+    /////////////////////////////////////////////
+    // Expansion
+    /////////////////////////////////////////////
+
+    template<typename G, char Name, unsigned int Depth, typename Visitor, typename Rule>
+    struct ExpandRule;
+
+    /**
+     * Expand every character of a constant string.
+     */
+    template<typename G, const char* Text, unsigned int Depth, typename Visitor, size_t... I>
+    inline void expandText(Visitor& visitor, std::index_sequence<I...>);
+
+    /**
+     * Expand a symbol for a number of generations.
+     */
+    template<typename G, char Name, unsigned int Depth, typename Visitor>
+    struct Expand;
+
+    template<const char* Axiom, typename Symbols, typename Rules, char Name, unsigned int Depth, typename Visitor>
+    struct Expand<Grammar<Axiom, Symbols, Rules>, Name, Depth, Visitor>
+    {
+        static void run(Visitor& visitor)
+        {
+            ExpandRule<Grammar<Axiom, Symbols, Rules>, Name, Depth, Visitor,
+                       typename FindRule<Name, Rules>::type>::run(visitor);
+        }
+    };
+
+    /**
+     * A symbol of the last generation: visit it.
+     */
+    template<const char* Axiom, typename Symbols, typename Rules, char Name, typename Visitor>
+    struct Expand<Grammar<Axiom, Symbols, Rules>, Name, 0, Visitor>
+    {
+        static void run(Visitor& visitor)
+        {
+            visitor.template visit<Name>();
+        }
+    };
+
+    /**
+     * A symbol without a rule: visit it.
+     */
+    template<typename G, char Name, unsigned int Depth, typename Visitor>
+    struct ExpandRule<G, Name, Depth, Visitor, NoRule>
+    {
+        static void run(Visitor& visitor)
+        {
+            visitor.template visit<Name>();
+        }
+    };
+
+    /**
+     * A symbol with a rule: expand its successor one generation deeper.
+     */
+    template<typename G, char Name, unsigned int Depth, typename Visitor, const char* Successor>
+    struct ExpandRule<G, Name, Depth, Visitor, Rule<Name, Successor>>
+    {
+        static void run(Visitor& visitor)
+        {
+            expandText<G, Successor, Depth - 1>(visitor, std::make_index_sequence<length(Successor)>());
+        }
+    };
+
+    template<typename G, const char* Text, unsigned int Depth, typename Visitor, size_t... I>
+    inline void expandText(Visitor& visitor, std::index_sequence<I...>)
+    {
+        using swallow = int[];
+        (void)swallow{0, (Expand<G, Text[I], Depth, Visitor>::run(visitor), 0)...};
+    }
+
+    /**
+     * Visitor interpreting the symbols of the last generation.
+     */
+    template<typename Symbols>
+    struct Interpreter
+    {
+        StaticTurtle& turtle;
+
+        template<char Name>
+        void visit()
+        {
+            Perform<typename FindAction<Name, Symbols>::type>::run(turtle);
+        }
+    };
+
+    /**
+     * Visitor appending the symbols of the last generation to a string.
+     */
+    struct Writer
+    {
+        std::string& text;
+
+        template<char Name>
+        void visit()
+        {
+            text.push_back(Name);
+        }
+    };
+
+    /**
+     * Maximum depth a static L-system can be evaluated for. Every depth up to it is instantiated.
+     */
+    constexpr unsigned int max_static_depth = 16;
+
+    template<typename G>
+    class StaticLsystem;
+
+    /**
+     * An L-system whose grammar is fixed at compile time.
+     * The expansion and the interpretation are generated for the grammar: each rule is inlined into the code of its
+     * predecessor, each symbol calls its action directly instead of through a virtual TurtleCommand, turn angles are
+     * constants and the trigonometry is looked up in a table folded at compile time. The symbols are interpreted as
+     * they are generated, so the evaluated axiom is never stored.
+     *
+     * The turtle follows the floating-point path of Turtle, so the drawing is the same as the one of the runtime
+     * Lsystem with the lattice disabled and the optimizer off (up to the rounding noted in TrigTable). The runtime
+     * Lsystem remains for dynamic grammars.
+     *
+     * @tparam Axiom The axiom
+     * @tparam Symbols List of Symbol
+     * @tparam Rules List of Rule
+     */
+    template<const char* Axiom, typename Symbols, typename Rules>
+    class StaticLsystem<Grammar<Axiom, Symbols, Rules>>
+    {
+        using G = Grammar<Axiom, Symbols, Rules>;
+
+    public:
+        /**
+         * Evaluate the L-system and draw it with a turtle, as Turtle::run does.
+         * First perform a dry run to estimate canvas bounds, then a second run drawing the results.
+         * The dry run is skipped if the canvas has a fixed viewport.
+         *
+         * @param depth Number of iterations (at most max_static_depth)
+         * @param turtle The turtle giving the initial transform and the canvas to draw on
+         *
+         * @return Whether the L-system was drawn (false if the depth is too large)
+         */
+        static bool draw(unsigned int depth, Turtle& turtle)
+        {
+            if (depth > max_static_depth) return false;
+
+            Canvas& canvas = turtle.getCanvas();
+            if (!canvas.hasViewport())
+            {
+                canvas.setAllowDrawing(false);
+                interpret(depth, turtle, nullptr);
+                canvas.setAllowDrawing(true);
+            }
+
+            canvas.allocatePixels();
+            interpret(depth, turtle, nullptr);
+            return true;
+        }
+
+        /**
+         * Evaluate the L-system and stream its segments to a sink.
+         *
+         * @param depth Number of iterations (at most max_static_depth)
+         * @param turtle The turtle giving the initial transform and the pen state
+         * @param sink The sink receiving the segments
+         *
+         * @return Whether the L-system was drawn (false if the depth is too large)
+         */
+        static bool draw(unsigned int depth, Turtle& turtle, graphics::SegmentSink& sink)
+        {
+            if (depth > max_static_depth) return false;
+
+            interpret(depth, turtle, &sink);
+            return true;
+        }
+
+        /**
+         * Evaluate the L-system to a string.
+         *
+         * @param depth Number of iterations (at most max_static_depth)
+         *
+         * @return The evaluated axiom (empty if the depth is too large)
+         */
+        static std::string evaluate(unsigned int depth)
+        {
+            std::string text;
+            if (depth > max_static_depth) return text;
+
+            Writer writer{text};
+            dispatch<Writer>(depth, writer, std::make_index_sequence<max_static_depth + 1>());
+            return text;
+        }
+
+    private:
+        /**
+         * Run the interpretation once from the initial transform of the turtle.
+         */
+        static void interpret(unsigned int depth, Turtle& turtle, graphics::SegmentSink* sink)
+        {
+            const Transform2d& initial = turtle.getInitialTransform();
+
+            StaticTurtle state{initial.position, ((initial.rotation % 360) + 360) % 360, {},
+                               &turtle.getCanvas(), sink, turtle.getCanvas().isPenDown()};
+            Interpreter<Symbols> interpreter{state};
+            dispatch<Interpreter<Symbols>>(depth, interpreter, std::make_index_sequence<max_static_depth + 1>());
+
+            turtle.setTransform({state.position, state.rotation});
+        }
+
+        /**
+         * Expand the axiom with the depth as a template argument, picked from a table of every depth.
+         */
+        template<typename Visitor, size_t... Depths>
+        static void dispatch(unsigned int depth, Visitor& visitor, std::index_sequence<Depths...>)
+        {
+            using Function = void (*)(Visitor&);
+            static constexpr Function expanders[] = {&expandAxiom<Visitor, Depths>...};
+            expanders[depth](visitor);
+        }
+
+        template<typename Visitor, size_t Depth>
+        static void expandAxiom(Visitor& visitor)
+        {
+            expandText<G, Axiom, Depth>(visitor, std::make_index_sequence<length(Axiom)>());
+        }
+    };
+}
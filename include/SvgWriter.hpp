@@ -0,0 +1,155 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "SegmentSink.hpp"
+
+namespace lsys::io
+{
+    /**
+     * Writes the segments of a turtle program as an SVG image.
+     * The image is streamed to the file in a single pass with a fixed-size buffer, so the memory used does not
+     * depend on the size of the drawing and no canvas has to be allocated.
+     *
+     * Consecutive segments are joined into polylines and collinear runs are merged into a single vertex.
+     * Paths are broken on push/pop and pen changes. Since the bounds of the drawing are only known at the end,
+     * the view box is reserved in the header and patched in when the image is closed.
+     */
+    class SvgWriter : public graphics::SegmentSink
+    {
+    public:
+        /**
+         * Open a new SVG image for writing.
+         *
+         * @param filename Path to the file
+         * @param stroke_width Width of the lines
+         * @param precision Number of decimals written for each coordinate, at most 12
+         */
+        explicit SvgWriter(const std::string& filename, float stroke_width = 1.0f, unsigned int precision = 2);
+        ~SvgWriter() override;
+
+        SvgWriter(const SvgWriter&) = delete;
+        SvgWriter& operator=(const SvgWriter&) = delete;
+
+        void addSegment(graphics::Point2d start, graphics::Point2d end) override;
+        void pushState() override;
+        void popState() override;
+        void penUp() override;
+        void penDown() override;
+
+        /**
+         * Finish the current path, write the footer and the view box, and close the file.
+         * Called automatically on destruction if not called before.
+         *
+         * @return Whether the whole image was written (false if the file could not be opened or written)
+         */
+        bool close();
+
+        [[nodiscard]]
+        size_t getTotalSegments() const;
+
+        [[nodiscard]]
+        size_t getTotalPolylines() const;
+
+        [[nodiscard]]
+        size_t getTotalPoints() const;
+
+    private:
+        /**
+         * Write the last vertex of the current path and close the polyline element.
+         */
+        void endPath();
+
+        /**
+         * Append a vertex to the current polyline element.
+         *
+         * @param point The vertex
+         */
+        void writePoint(graphics::Point2d point);
+
+        /**
+         * Append raw data to the write buffer, flushing it to the file when full. Data larger than the buffer is
+         * written to the file directly.
+         *
+         * @param data The data to append
+         * @param size The size of the data
+         */
+        void write(const char* data, size_t size);
+        void write(const std::string& data);
+
+        /**
+         * Write the contents of the buffer to the file.
+         */
+        void flushBuffer();
+
+        /**
+         * Grow the bounds of the drawing to include the point.
+         *
+         * @param point Point to include
+         */
+        void updateBounds(graphics::Point2d point);
+
+        ///////////////////////////////
+
+        /**
+         * The output file.
+         */
+        std::ofstream file;
+
+        /**
+         * Write buffer.
+         */
+        std::vector<char> buffer;
+
+        /**
+         * Number of bytes currently used in the buffer.
+         */
+        size_t buffer_used;
+
+        /**
+         * File position and size of the reserved view box attribute.
+         */
+        std::streamoff view_box_offset;
+        size_t view_box_size;
+
+        /**
+         * Number of decimals written for each coordinate.
+         */
+        unsigned int precision;
+
+        /**
+         * Whether a polyline element is currently open.
+         */
+        bool path_open;
+
+        /**
+         * Last vertex of the current path. It is only written once the path turns or ends.
+         */
+        graphics::Point2d path_end;
+
+        /**
+         * Direction of the last run of collinear segments in the current path.
+         */
+        graphics::Point2d path_direction;
+
+        /**
+         * Bounds of all written vertices.
+         */
+        graphics::Bounds2d bounds;
+
+        /**
+         * Whether any vertex has been written yet.
+         */
+        bool has_bounds;
+
+        /**
+         * Whether the image was closed after being written completely.
+         */
+        bool written;
+
+        size_t total_segments;
+        size_t total_polylines;
+        size_t total_points;
+    };
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "SegmentSink.hpp"
+
+namespace lsys::io
+{
+    /**
+     * Writes the segments of a turtle program as a multi-resolution pyramid of square tiles, for pan and zoom viewers.
+     * Level 0 is a single tile showing the whole viewport, and every level doubles the number of tiles along each
+     * side, so the last level has 2^(levels - 1) tiles per side. Tiles are 8-bit grayscale BMP images written to
+     * <directory>/<level>/<column>_<row>.bmp, with row 0 at the top. Only tiles that have been drawn on are written.
+     *
+     * Segments are binned by the band (row of tiles) of the last level they cross. Bins are spilled to files in the
+     * directory when too many segments are buffered. On close, the bands are rasterized one at a time, and every two
+     * bands of a level are downsampled by averaging into one band of the level above, in parallel over the tiles.
+     * Memory is bounded by the buffered segments, the segments of one band, and one band of tiles per level.
+     */
+    class TilePyramid : public graphics::SegmentSink
+    {
+    public:
+        /**
+         * Create a tile pyramid in a directory, creating it if needed.
+         *
+         * @param directory Path to the directory
+         * @param viewport The region of the 2D plane shown by the pyramid
+         * @param levels Number of levels (at least 1)
+         * @param tile_size Width and height of the tiles in pixels, rounded up to an even number
+         * @param max_buffered_segments Number of binned segments kept in memory before the bins are spilled
+         */
+        TilePyramid(const std::string& directory, const graphics::Bounds2d& viewport, unsigned int levels,
+                    unsigned short tile_size = 256, size_t max_buffered_segments = 1 << 20);
+        ~TilePyramid() override;
+
+        TilePyramid(const TilePyramid&) = delete;
+        TilePyramid& operator=(const TilePyramid&) = delete;
+
+        void addSegment(graphics::Point2d start, graphics::Point2d end) override;
+
+        /**
+         * Rasterize the last level, build the levels above it and write all tiles.
+         * Called automatically on destruction if not called before.
+         */
+        void close();
+
+        /////////////////////////////////////////////
+
+        /**
+         * Number of threads tiles are rasterized and downsampled with (hardware concurrency by default).
+         */
+        [[nodiscard]]
+        unsigned int getThreadCount() const;
+        void setThreadCount(unsigned int thread_count);
+
+        [[nodiscard]]
+        unsigned int getLevels() const;
+
+        [[nodiscard]]
+        unsigned short getTileSize() const;
+
+        [[nodiscard]]
+        size_t getTotalSegments() const;
+
+        [[nodiscard]]
+        size_t getTilesWritten() const;
+
+    private:
+        /**
+         * Pixels of a tile, 8 bits per pixel from the top row down (empty if nothing was drawn on the tile).
+         */
+        using Tile = std::vector<uint8_t>;
+
+        /**
+         * Append the buffered segments of every band to the band's spill file.
+         */
+        void spillBins();
+
+        /**
+         * Rasterize the tiles of a band of the last level.
+         *
+         * @param row Row of the band
+         * @param segments End points of the segments crossing the band, as pairs of points
+         *
+         * @return The tiles of the band
+         */
+        std::vector<Tile> rasterizeBand(unsigned int row, const std::vector<graphics::Point2d>& segments) const;
+
+        /**
+         * Write the tiles of a finished band, and downsample it into the level above once both bands covering
+         * the same band of the level above are finished.
+         *
+         * @param level Level of the band
+         * @param row Row of the band
+         * @param tiles The tiles of the band
+         */
+        void finishBand(unsigned int level, unsigned int row, std::vector<Tile> tiles);
+
+        /**
+         * Average two bands of a level into one band of the level above.
+         *
+         * @param top Tiles of the upper band
+         * @param bottom Tiles of the lower band
+         *
+         * @return Tiles of the band above, half as many
+         */
+        std::vector<Tile> downsample(const std::vector<Tile>& top, const std::vector<Tile>& bottom) const;
+
+        /**
+         * Write a tile as a BMP image.
+         *
+         * @param level Level of the tile
+         * @param column Column of the tile
+         * @param row Row of the tile
+         * @param tile Pixels of the tile
+         */
+        void writeTile(unsigned int level, unsigned int column, unsigned int row, const Tile& tile);
+
+        /**
+         * Run a function for every index in [0, count), split over the threads.
+         *
+         * @param count Number of indices
+         * @param function Function called with every index
+         */
+        template<typename Function>
+        void parallelFor(unsigned int count, Function function) const;
+
+        [[nodiscard]]
+        std::string getSpillPath(unsigned int row) const;
+
+        ///////////////////////////////
+
+        /**
+         * Path to the directory.
+         */
+        std::string directory;
+
+        /**
+         * The region of the 2D plane shown by the pyramid.
+         */
+        graphics::Bounds2d viewport;
+
+        /**
+         * Number of levels, tiles per side of the last level, and width and height of the tiles.
+         */
+        unsigned int levels;
+        unsigned int base_tiles;
+        unsigned short tile_size;
+
+        /**
+         * Number of bytes between the starts of consecutive rows of a tile.
+         */
+        size_t tile_stride;
+
+        /**
+         * Buffered segments of every band of the last level, as pairs of points.
+         */
+        std::vector<std::vector<graphics::Point2d>> bins;
+
+        /**
+         * Number of buffered segments over all bins, and the number that triggers a spill.
+         */
+        size_t buffered_segments;
+        size_t max_buffered_segments;
+
+        /**
+         * Whether each band has a spill file.
+         */
+        std::vector<bool> spilled;
+
+        /**
+         * Finished upper band of every level, waiting for the band below it to be downsampled.
+         */
+        std::vector<std::vector<Tile>> pending_bands;
+
+        unsigned int thread_count;
+        bool closed;
+
+        size_t total_segments;
+        size_t tiles_written;
+    };
+}
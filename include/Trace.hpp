@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace lsys::trace
+{
+    /**
+     * A traced scope: its name, and when it started and ended in nanoseconds of the steady clock.
+     */
+    struct TraceEvent
+    {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    /**
+     * Number of events kept per thread. Older events are overwritten once a thread's ring buffer is full.
+     */
+    constexpr size_t trace_buffer_size = 1 << 16;
+
+    namespace detail
+    {
+        extern std::atomic<bool> trace_enabled;
+    }
+
+    /**
+     * Whether trace points record events (disabled by default).
+     * When disabled, a compiled-in trace point costs a relaxed load and a branch.
+     */
+    inline bool isEnabled()
+    {
+        return detail::trace_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled);
+
+    /**
+     * Get the current time of the steady clock, in nanoseconds.
+     */
+    uint64_t now();
+
+    /**
+     * Record an event in the calling thread's ring buffer.
+     * The buffer belongs to the calling thread only, so no locks or atomic read-modify-writes are needed; the
+     * buffer is taken once, on the first event of the thread, from those of exited threads or newly registered.
+     *
+     * @param name Name of the event, a string that outlives the trace (e.g. a literal)
+     * @param start Start time in nanoseconds
+     * @param end End time in nanoseconds
+     */
+    void record(const char* name, uint64_t start, uint64_t end);
+
+    /**
+     * Write the events of every thread as Chrome Trace Event JSON, viewable in chrome://tracing or Perfetto.
+     * Should be called while no traced code is running, since the ring buffers are read without locking them.
+     *
+     * @param filename Path to the file
+     *
+     * @return Whether the file was written
+     */
+    bool writeChromeTrace(const std::string& filename);
+
+    /**
+     * Forget the events of every thread.
+     * Must not be called while traced code is running, since a thread may be writing to the buffer being reset.
+     */
+    void clear();
+
+    /**
+     * Records an event spanning its lifetime, if tracing is enabled when it is created.
+     */
+    class TraceScope
+    {
+    public:
+        explicit TraceScope(const char* name)
+            : name(isEnabled() ? name : nullptr)
+            , start(this->name != nullptr ? now() : 0)
+        {
+        }
+
+        ~TraceScope()
+        {
+            if (name != nullptr) record(name, start, now());
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* name;
+        uint64_t start;
+    };
+}
+
+/**
+ * Trace the enclosing scope under a name. Compiled out unless LSYS_TRACE is defined.
+ */
+#ifdef LSYS_TRACE
+#define LSYS_TRACE_JOIN_(a, b) a##b
+#define LSYS_TRACE_JOIN(a, b) LSYS_TRACE_JOIN_(a, b)
+#define LSYS_TRACE_SCOPE(name) ::lsys::trace::TraceScope LSYS_TRACE_JOIN(lsys_trace_scope_, __LINE__)(name)
+#else
+#define LSYS_TRACE_SCOPE(name) ((void)0)
+#endif
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <stack>
 #include "Canvas.hpp"
+#include "CommandOptimizer.hpp"
+#include "SegmentSink.hpp"
 #include "TurtleCommand.hpp"
 
 namespace lsys
@@ -18,6 +21,28 @@ namespace lsys
         int rotation; // degrees
     };
 
+    /**
+     * Exact position reachable with integer steps at multiples of 45 degrees, relative to an origin.
+     * Each coordinate is axis + diagonal * sqrt(2) / 2, where axis accumulates the axis-aligned steps and diagonal
+     * the diagonal ones.
+     */
+    struct LatticePosition
+    {
+        int64_t x_axis;
+        int64_t x_diagonal;
+        int64_t y_axis;
+        int64_t y_diagonal;
+    };
+
+    /**
+     * State of a turtle on the integer lattice, relative to the origin of the lattice.
+     */
+    struct LatticeState
+    {
+        LatticePosition position;
+        int direction; // Multiple of 45 degrees, in [0, 8)
+    };
+
     /**
      * Represents a turtle in a 2D plane. Contains a 2D canvas for drawing.
      */
@@ -35,9 +60,27 @@ namespace lsys
         /**
          * Execute a full cycle of a turtle program.
          * First perform a dry run to estimate plane bounds, then do a second run drawing the results.
+         * The dry run is skipped if the canvas has a fixed viewport.
          */
         void run();
 
+        /**
+         * Execute a turtle program once, streaming the generated line segments to a sink instead of rasterizing them.
+         * The canvas pixels are never allocated, so this can be used to produce output of any size.
+         *
+         * @param sink The sink receiving the segments
+         */
+        void run(SegmentSink& sink);
+
+        /**
+         * Execute a full cycle of a turtle program like run(), with the geometry and the rasterization as separate
+         * stages: the segments are collected in chunks in a segment buffer, and each chunk is drawn with
+         * Canvas::drawSegments. Moves with the pen up do not grow the bounds of the canvas.
+         *
+         * @param chunk_size Number of segments in a chunk
+         */
+        void runBuffered(size_t chunk_size = 1 << 16);
+
         /**
          * Execute all turtle commands in the queue.
          * Must ensure that the canvas has proper bounds before drawing.
@@ -45,6 +88,65 @@ namespace lsys
         void executeCommands();
         void executeCommandsDebug();
 
+        /**
+         * Execute the commands in the queue as one chunk of a program too large to be queued at once.
+         * Every chunk continues from the transform, stack and pen the previous chunk left, and on the integer lattice
+         * from the exact lattice state, so a program executed in chunks draws the same as when it is queued whole.
+         * Chunks are always executed sequentially.
+         *
+         * @param first Whether the chunk is the first one of the program
+         * @param lattice Whether the whole program is a lattice program (see isLatticeCommand), so every chunk is
+         *                executed on the lattice
+         * @param sink The sink receiving the segments (nullptr to rasterize on the canvas)
+         */
+        void executeChunk(bool first, bool lattice, SegmentSink* sink = nullptr);
+
+        /**
+         * Whether the commands in the queue can be executed on the exact integer lattice.
+         * That is the case when the turtle starts at a multiple of 45 degrees, every turn is a multiple of 45 degrees,
+         * every move is by an integer distance, and there are no custom commands.
+         * The result is cached until the queue changes.
+         */
+        [[nodiscard]]
+        bool isLatticeProgram() const;
+
+        /**
+         * Whether a command can be part of a lattice program: a move by an integer distance, a turn by a multiple of
+         * 45 degrees, or any command other than a custom one.
+         */
+        [[nodiscard]]
+        static bool isLatticeCommand(const TurtleCommand& command);
+
+        /**
+         * Move a lattice state forward in its direction.
+         */
+        static void moveOnLattice(LatticeState& state, int64_t distance);
+
+        /**
+         * Rotate a lattice position around the origin of the lattice by a multiple of 45 degrees.
+         * The rotation is exact: a rotated axis step is a diagonal step and a rotated diagonal step an axis one.
+         *
+         * @param position The position, reached with integer steps
+         * @param direction Multiple of 45 degrees to rotate by, counterclockwise
+         */
+        [[nodiscard]]
+        static LatticePosition rotateOnLattice(const LatticePosition& position, int direction);
+
+        /**
+         * Get the point of a lattice position, relative to the origin of the lattice.
+         */
+        [[nodiscard]]
+        static Point2d getLatticePoint(const Point2d& origin, const LatticePosition& position);
+
+        /**
+         * Run the peephole optimizer over the commands in the queue, shortening it without changing the geometry.
+         *
+         * @param merge_moves Whether collinear moves are merged (see CommandOptimizer)
+         *
+         * @return Statistics of the optimization pass
+         */
+        OptimizationStats optimizeCommands(bool merge_moves = true);
+
         /**
          * Clear all commands currently in the turtle's queue.
          */
@@ -106,6 +208,9 @@ namespace lsys
         const Transform2d& getTransform() const;
         void setTransform(const Transform2d& transform);
 
+        [[nodiscard]]
+        const Transform2d& getInitialTransform() const;
+
         [[nodiscard]]
         Canvas& getCanvas() const;
         void setCanvas(Canvas& canvas);
@@ -113,12 +218,69 @@ namespace lsys
         [[nodiscard]]
         size_t getTotalCommands() const;
 
+        /**
+         * Whether lattice programs are executed on the exact integer lattice (enabled by default).
+         * Positions on the lattice are tracked with integers and converted to points only when drawing, so they
+         * do not drift and no trigonometry is needed.
+         */
+        [[nodiscard]]
+        bool getLatticeEnabled() const;
+        void setLatticeEnabled(bool lattice_enabled);
+
+        /**
+         * Number of threads the commands are executed with (1 by default).
+         * With more than one thread, large lattice programs are executed in parallel, with the same result as a
+         * sequential run. Other programs and running with a segment sink are always sequential, and so is drawing that
+         * would still grow the bounds of the canvas, as happens without a dry run.
+         */
+        [[nodiscard]]
+        unsigned int getThreadCount() const;
+        void setThreadCount(unsigned int thread_count);
+
         /**
          * Print the current transform of the turtle.
          */
         void printTurtleTransform() const;
 
     private:
+        /**
+         * Execute all turtle commands in the queue on the exact integer lattice.
+         * Must only be called if the queue is a lattice program.
+         *
+         * @param resume Whether to continue from the lattice state the previous call left, instead of starting from
+         *               the turtle's transform with an empty stack
+         */
+        void executeCommandsLattice(bool resume = false);
+
+        /**
+         * Execute all turtle commands in the queue on several threads, if the queue is a lattice program.
+         * The queue is split into chunks, and the effect of every chunk on the lattice state, stack and pen it starts
+         * with is found in parallel. The effects are exact, so combining them in order gives the exact state every
+         * chunk starts in. The chunks are then interpreted in parallel and their lines drawn by bands of rows.
+         *
+         * @return Whether the commands were executed (false if the queue has to be executed sequentially)
+         */
+        bool executeCommandsParallel();
+
+        /**
+         * Forget the compact copy of the command queue.
+         * Must be called whenever the command queue changes.
+         */
+        void invalidateCompiledCommands();
+
+        /**
+         * A command of a lattice program.
+         */
+        struct LatticeCommand
+        {
+            TurtleCommandType type;
+
+            /**
+             * Distance for moves, multiple of 45 degrees for turns.
+             */
+            int32_t value;
+        };
+
         /**
          * The turtle's transform.
          */
@@ -144,9 +306,44 @@ namespace lsys
          */
         Canvas& canvas;
 
+        /**
+         * Sink receiving the segments while running with a sink (nullptr otherwise).
+         */
+        SegmentSink* segment_sink;
+
+        /**
+         * Whether lattice programs are executed on the exact integer lattice.
+         */
+        bool lattice_enabled;
+
+        /**
+         * Whether the command queue has been checked for being a lattice program, and the result of the check.
+         */
+        mutable bool lattice_checked;
+        mutable bool lattice_program;
+
+        /**
+         * Compact copy of the command queue, if it is a lattice program.
+         */
+        mutable std::vector<LatticeCommand> lattice_commands;
+
+        /**
+         * Origin, state and stack the last lattice execution left, so the next chunk of a program can resume them.
+         */
+        Point2d lattice_origin;
+        LatticeState lattice_state;
+        std::vector<LatticeState> lattice_stack;
+
+        /**
+         * Number of threads the commands are executed with.
+         */
+        unsigned int thread_count;
+
         friend MoveForwardCommand;
         friend TurnCommand;
         friend PushStateCommand;
         friend PopStateCommand;
+        friend PenUpCommand;
+        friend PenDownCommand;
     };
 }
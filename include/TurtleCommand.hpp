@@ -4,6 +4,21 @@ namespace lsys
 {
     class Turtle;
 
+    /**
+     * Types of turtle commands.
+     * Used by passes that need to reason about a command stream (e.g. the optimizer) without executing it.
+     */
+    enum class TurtleCommandType
+    {
+        Custom, // Any command not known to the library
+        MoveForward,
+        Turn,
+        PushState,
+        PopState,
+        PenUp,
+        PenDown
+    };
+
     /**
      * Base for a turtle command.
      * A command is executed by the turtle by calling its "execute" function.
@@ -11,6 +26,12 @@ namespace lsys
     struct TurtleCommand
     {
         virtual void execute(Turtle& turtle) = 0;
+
+        /**
+         * Get the type of the command. Commands defined outside the library are of the custom type.
+         */
+        [[nodiscard]]
+        virtual TurtleCommandType getType() const;
     };
 
     /**
@@ -25,6 +46,9 @@ namespace lsys
 
         void execute(Turtle& turtle) override;
 
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
+
         explicit MoveForwardCommand(float distance);
     };
 
@@ -40,6 +64,9 @@ namespace lsys
 
         void execute(Turtle& turtle) override;
 
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
+
         explicit TurnCommand(int degrees);
     };
 
@@ -49,6 +76,9 @@ namespace lsys
     struct PushStateCommand : TurtleCommand
     {
         void execute(Turtle& turtle) override;
+
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
     };
 
     /**
@@ -57,6 +87,9 @@ namespace lsys
     struct PopStateCommand : TurtleCommand
     {
         void execute(Turtle& turtle) override;
+
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
     };
 
     /**
@@ -65,6 +98,9 @@ namespace lsys
     struct PenUpCommand : TurtleCommand
     {
         void execute(Turtle& turtle) override;
+
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
     };
 
     /**
@@ -73,5 +109,8 @@ namespace lsys
     struct PenDownCommand : TurtleCommand
     {
         void execute(Turtle& turtle) override;
+
+        [[nodiscard]]
+        TurtleCommandType getType() const override;
     };
 }
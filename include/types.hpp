@@ -48,4 +48,24 @@ namespace lsys::graphics
         RgbColor(unsigned char r, unsigned char g, unsigned char b);
     };
     using PixelContainerType = RgbColor**; // Pixel data array type
+
+    /**
+     * Format the pixels of a canvas are stored in.
+     */
+    enum class PixelFormat
+    {
+        Mono1, // 1 bit per pixel, leftmost pixel in the most significant bit
+        Gray8, // 8 bits per pixel, a gray level or palette index
+        Rgb24, // RgbColor per pixel
+        Density32 // 32-bit count of the times a pixel was drawn on, tone mapped for output
+    };
+
+    /**
+     * Curve mapping the hit counts of a density canvas to gray levels.
+     */
+    enum class ToneMapping
+    {
+        Log, // log(1 + count) / log(1 + max_count)
+        Gamma // (count / max_count)^(1 / gamma)
+    };
 }
@@ -1,5 +1,7 @@
 #include <fstream>
+#include <utility>
 #include "BmpImage.hpp"
+#include "Trace.hpp"
 
 namespace lsys::io
 {
@@ -8,9 +10,45 @@ namespace lsys::io
         setPixels(pixels, width, height);
     }
 
+    BmpImage::BmpImage(const graphics::Canvas& canvas, graphics::ToneMapping tone_mapping, float gamma)
+    {
+        if (canvas.getPixelFormat() == graphics::PixelFormat::Rgb24)
+        {
+            setPixels(canvas.getPixels(), canvas.getWidth(), canvas.getHeight());
+            return;
+        }
+
+        bool is_mono = canvas.getPixelFormat() == graphics::PixelFormat::Mono1;
+        if (canvas.getPixelFormat() == graphics::PixelFormat::Density32)
+        {
+            // Nothing is tone mapped if the pixels were never allocated
+            tone_mapped_data = canvas.toneMap(tone_mapping, gamma);
+            const uint8_t* data = tone_mapped_data.empty() ? nullptr : tone_mapped_data.data();
+            setPixelData(data, (canvas.getWidth() + 7) / 8 * 8, canvas.getWidth(), canvas.getHeight(),
+                         BmpBitsPerPixel::INDEXED8);
+        }
+        else
+        {
+            setPixelData(canvas.getPixelData(), canvas.getRowStride(), canvas.getWidth(), canvas.getHeight(),
+                         is_mono ? BmpBitsPerPixel::MONO1 : BmpBitsPerPixel::INDEXED8);
+        }
+
+        std::vector<graphics::RgbColor> colors;
+        for (unsigned int i = 0; i < (is_mono ? 2u : 256u); ++i)
+        {
+            auto level = static_cast<unsigned char>(is_mono ? i * 255 : i);
+            colors.emplace_back(level, level, level);
+        }
+        setPalette(colors);
+    }
+
     void BmpImage::setPixels(graphics::PixelContainerType pixels, uint16_t width, u_int16_t height)
     {
         this->pixels = pixels;
+        this->pixel_data = nullptr;
+        this->info_header.bits_per_pixel = BmpBitsPerPixel::RGB24;
+        this->info_header.num_colors_used = 0;
+        this->header.data_offset = sizeof(header) + sizeof(info_header);
         this->info_header.image_width = width;
         this->info_header.image_height = height;
 
@@ -18,11 +56,47 @@ namespace lsys::io
         this->header.file_size = sizeof(header) + sizeof(info_header) + sizeof(graphics::RgbColor) * (width + padding_size) * height;
     }
 
-    void BmpImage::writeToFile(const std::string& filename)
+    void BmpImage::setPixelData(const uint8_t* data, size_t row_stride, uint16_t width, uint16_t height,
+                                BmpBitsPerPixel bits_per_pixel)
     {
+        this->pixels = nullptr;
+        this->pixel_data = data;
+        this->row_stride = row_stride;
+        this->info_header.image_width = width;
+        this->info_header.image_height = height;
+        this->info_header.bits_per_pixel = bits_per_pixel;
+
+        setPalette(palette);
+    }
+
+    void BmpImage::setPalette(const std::vector<graphics::RgbColor>& palette)
+    {
+        this->palette = palette;
+        if (pixel_data == nullptr) return;
+
+        // Rows are padded to 4 bytes
+        uint32_t row_size = (info_header.image_width * info_header.bits_per_pixel + 31) / 32 * 4;
+
+        this->info_header.num_colors_used = static_cast<uint32_t>(palette.size());
+        this->header.data_offset = sizeof(header) + sizeof(info_header) + 4 * palette.size();
+        this->header.file_size = header.data_offset + row_size * info_header.image_height;
+    }
+
+    bool BmpImage::writeToFile(const std::string& filename)
+    {
+        LSYS_TRACE_SCOPE("BmpImage::writeToFile");
+
+        if (pixel_data == nullptr && pixels == nullptr) return false;
+
         std::ofstream file;
         file.open(filename, std::ios::trunc | std::ios::binary);
 
+        if (pixel_data != nullptr)
+        {
+            writePalettedData(file);
+            return static_cast<bool>(file);
+        }
+
         // Write header
         file.write(reinterpret_cast<char*>(&header), sizeof(header));
 
@@ -44,9 +118,45 @@ namespace lsys::io
                 file.write(reinterpret_cast<char*>(&rgb_color), sizeof(graphics::RgbColor));
             }
             file.write(reinterpret_cast<char*>(&padding), padding_size);
+
+            if (row_callback && !row_callback(info_header.image_height - y)) return false;
         }
 
         file.flush();
+        return static_cast<bool>(file);
+    }
+
+    void BmpImage::writePalettedData(std::ofstream& file)
+    {
+        file.write(reinterpret_cast<char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+
+        // Palette entries are stored as BGR plus a reserved byte
+        for (const auto& color : palette)
+        {
+            unsigned char entry[4] = {color.b, color.g, color.r, 0};
+            file.write(reinterpret_cast<char*>(&entry), sizeof(entry));
+        }
+
+        // The rows are already padded, so each one is written at once
+        uint32_t row_size = (info_header.image_width * info_header.bits_per_pixel + 31) / 32 * 4;
+        for (uint32_t y = info_header.image_height - 1; y < info_header.image_height; --y)
+        {
+            file.write(reinterpret_cast<const char*>(pixel_data + y * row_stride), row_size);
+
+            if (row_callback && !row_callback(info_header.image_height - y))
+            {
+                file.setstate(std::ios::failbit);
+                return;
+            }
+        }
+
+        file.flush();
+    }
+
+    void BmpImage::setRowCallback(RowCallback row_callback)
+    {
+        this->row_callback = std::move(row_callback);
     }
 
     const BmpHeader& BmpImage::getHeader() const
@@ -1,16 +1,26 @@
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <thread>
+#include <utility>
 #include "Canvas.hpp"
+#include "Trace.hpp"
 
 namespace lsys::graphics
 {
-    Canvas::Canvas(const Bounds2d& bounds, unsigned short width, unsigned short height)
+    Canvas::Canvas(const Bounds2d& bounds, unsigned short width, unsigned short height, PixelFormat pixel_format)
         : bounds(bounds)
         , width(width)
         , height(height)
         , pixels(nullptr)
+        , pixel_format(pixel_format)
+        , row_stride(0)
         , pen_down(true)
         , allow_drawing(true)
+        , has_viewport(false)
+        , line_recorder(nullptr)
     {
         spacing.x = (bounds.max_x - bounds.min_x) / (float)width;
         spacing.y = (bounds.max_y - bounds.min_y) / (float)height;
@@ -29,16 +39,37 @@ namespace lsys::graphics
         }
     }
 
+    Point2d Canvas::getPixelPosition(Point2d point) const
+    {
+        if (has_viewport)
+        {
+            return Point2d((point.x - bounds.min_x) / spacing.x, (point.y - bounds.min_y) / spacing.y);
+        }
+
+        return Point2d(point.x - bounds.min_x / spacing.x, point.y - bounds.min_y / spacing.y);
+    }
+
     Pixelxy Canvas::getPixelFromPoint(Point2d point) const
     {
-        auto pixel_x = static_cast<unsigned short>(point.x - bounds.min_x / spacing.x);
-        auto pixel_y = static_cast<unsigned short>(point.y - bounds.min_y / spacing.y);
+        Point2d position = getPixelPosition(point);
+
+        if (has_viewport)
+        {
+            // Points on the upper bounds of the viewport fall just outside the last pixel
+            position.x = std::max(0.0f, std::min(position.x, width - 1.0f));
+            position.y = std::max(0.0f, std::min(position.y, height - 1.0f));
+        }
+
+        auto pixel_x = static_cast<unsigned short>(position.x);
+        auto pixel_y = static_cast<unsigned short>(position.y);
 
         return Pixelxy(pixel_x, (height - 1) - pixel_y);
     }
 
     void Canvas::updateBounds(Point2d reference)
     {
+        if (has_viewport) return;
+
         if (reference.x > bounds.max_x)
         {
             bounds.max_x = reference.x;
@@ -69,11 +100,36 @@ namespace lsys::graphics
 
     Point2d Canvas::drawLine(Point2d start, float length, int angle)
     {
+        return drawLine(start, moveFromPoint(start, length, angle));
+    }
+
+    Point2d Canvas::drawLine(Point2d start, Point2d end)
+    {
+        if (has_viewport)
+        {
+            if (this->allow_drawing && this->pen_down)
+            {
+                if (line_recorder != nullptr)
+                {
+                    line_recorder->push_back(start);
+                    line_recorder->push_back(end);
+                }
+
+                Point2d clipped_start = start;
+                Point2d clipped_end = end;
+                if (clipLine(clipped_start, clipped_end))
+                {
+                    rasterizeLine(getPixelFromPoint(clipped_start), getPixelFromPoint(clipped_end));
+                }
+            }
+
+            return end;
+        }
+
         // Need to ensure that the canvas is large enough before drawing line
         updateBounds(start);
 
         Pixelxy start_pixel = getPixelFromPoint(start);
-        Point2d end = moveFromPoint(start, length, angle);
         Pixelxy end_pixel = getPixelFromPoint(end);
 
         // Need to ensure that the canvas is large enough before drawing line
@@ -82,44 +138,634 @@ namespace lsys::graphics
         if (this->allow_drawing && this->pen_down)
         {
             rasterizeLine(start_pixel, end_pixel);
+
+            if (line_recorder != nullptr)
+            {
+                line_recorder->push_back(start);
+                line_recorder->push_back(end);
+            }
         }
 
         return end;
     }
 
+    void Canvas::drawLines(const std::vector<Point2d>& lines, unsigned int threads)
+    {
+        LSYS_TRACE_SCOPE("Canvas::drawLines");
+
+        bool is_drawing = this->allow_drawing && this->pen_down;
+
+        // Map the lines to pixels as drawLine does
+        std::vector<std::pair<Pixelxy, Pixelxy>> pixel_lines;
+        pixel_lines.reserve(is_drawing ? lines.size() / 2 : 0);
+
+        for (size_t i = 0; i + 1 < lines.size(); i += 2)
+        {
+            Point2d start = lines[i];
+            Point2d end = lines[i + 1];
+
+            if (has_viewport)
+            {
+                if (!is_drawing) continue;
+
+                if (line_recorder != nullptr)
+                {
+                    line_recorder->push_back(start);
+                    line_recorder->push_back(end);
+                }
+
+                if (clipLine(start, end))
+                {
+                    pixel_lines.emplace_back(getPixelFromPoint(start), getPixelFromPoint(end));
+                }
+                continue;
+            }
+
+            updateBounds(start);
+            Pixelxy start_pixel = getPixelFromPoint(start);
+            Pixelxy end_pixel = getPixelFromPoint(end);
+            updateBounds(end);
+
+            if (is_drawing)
+            {
+                pixel_lines.emplace_back(start_pixel, end_pixel);
+
+                if (line_recorder != nullptr)
+                {
+                    line_recorder->push_back(start);
+                    line_recorder->push_back(end);
+                }
+            }
+        }
+
+        rasterizeLines(pixel_lines, threads);
+    }
+
+    void Canvas::rasterizeLines(const std::vector<std::pair<Pixelxy, Pixelxy>>& pixel_lines, unsigned int threads)
+    {
+        if (pixel_lines.empty()) return;
+
+        if (pixel_format == PixelFormat::Density32 && threads > 1)
+        {
+            accumulateLines(pixel_lines, threads);
+            return;
+        }
+
+        // Bands of rows never share pixels, so they can be drawn concurrently
+        auto rasterizeBand = [this, &pixel_lines](int first_row, int last_row)
+        {
+            LSYS_TRACE_SCOPE("Canvas::rasterizeBand");
+
+            for (const auto& line : pixel_lines)
+            {
+                int min_y = std::min(line.first.y, line.second.y);
+                int max_y = std::max(line.first.y, line.second.y);
+                if (max_y < first_row || min_y >= last_row) continue;
+
+                rasterizeLine(line.first, line.second, first_row, last_row);
+            }
+        };
+
+        threads = std::max(1u, std::min<unsigned int>(threads, height));
+        if (threads == 1)
+        {
+            rasterizeBand(0, height);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(rasterizeBand, height * i / threads, height * (i + 1) / threads);
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void Canvas::drawSegments(const SegmentBuffer& segments, unsigned int threads)
+    {
+        LSYS_TRACE_SCOPE("Canvas::drawSegments");
+
+        size_t count = segments.size();
+        if (count == 0) return;
+
+        if (!has_viewport)
+        {
+            // The union of the chunk's bounds, as updating with every end point would give
+            Bounds2d chunk_bounds = segments.getBounds();
+            updateBounds(Point2d(chunk_bounds.min_x, chunk_bounds.min_y));
+            updateBounds(Point2d(chunk_bounds.max_x, chunk_bounds.max_y));
+        }
+
+        if (!allow_drawing) return;
+
+        const float* start_x = segments.getStartX();
+        const float* start_y = segments.getStartY();
+        const float* end_x = segments.getEndX();
+        const float* end_y = segments.getEndY();
+
+        if (line_recorder != nullptr)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                line_recorder->push_back(Point2d(start_x[i], start_y[i]));
+                line_recorder->push_back(Point2d(end_x[i], end_y[i]));
+            }
+        }
+
+        // Lines are clipped to the viewport first, dropping those outside of it
+        std::vector<float> clipped[4];
+        if (has_viewport)
+        {
+            for (auto& coordinates : clipped)
+            {
+                coordinates.reserve(count);
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                Point2d start(start_x[i], start_y[i]);
+                Point2d end(end_x[i], end_y[i]);
+                if (!clipLine(start, end)) continue;
+
+                clipped[0].push_back(start.x);
+                clipped[1].push_back(start.y);
+                clipped[2].push_back(end.x);
+                clipped[3].push_back(end.y);
+            }
+
+            count = clipped[0].size();
+            start_x = clipped[0].data();
+            start_y = clipped[1].data();
+            end_x = clipped[2].data();
+            end_y = clipped[3].data();
+        }
+
+        std::vector<unsigned short> pixels[4];
+        coordinatesToPixels(start_x, count, false, pixels[0]);
+        coordinatesToPixels(start_y, count, true, pixels[1]);
+        coordinatesToPixels(end_x, count, false, pixels[2]);
+        coordinatesToPixels(end_y, count, true, pixels[3]);
+
+        if (threads > 1)
+        {
+            std::vector<std::pair<Pixelxy, Pixelxy>> pixel_lines;
+            pixel_lines.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                pixel_lines.emplace_back(Pixelxy(pixels[0][i], pixels[1][i]), Pixelxy(pixels[2][i], pixels[3][i]));
+            }
+
+            rasterizeLines(pixel_lines, threads);
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            rasterizeLine(Pixelxy(pixels[0][i], pixels[1][i]), Pixelxy(pixels[2][i], pixels[3][i]));
+        }
+    }
+
+    void Canvas::coordinatesToPixels(const float* coordinates, size_t count, bool vertical,
+                                     std::vector<unsigned short>& pixels) const
+    {
+        pixels.resize(count);
+
+        float min = vertical ? bounds.min_y : bounds.min_x;
+        float step = vertical ? spacing.y : spacing.x;
+        float last = (vertical ? height : width) - 1.0f;
+
+        if (has_viewport)
+        {
+            // Points on the upper bounds of the viewport fall just outside the last pixel
+            for (size_t i = 0; i < count; ++i)
+            {
+                float position = std::max(0.0f, std::min((coordinates[i] - min) / step, last));
+                pixels[i] = static_cast<unsigned short>(position);
+            }
+        }
+        else
+        {
+            // One unit per pixel, offset as getPixelPosition does
+            float offset = min / step;
+            for (size_t i = 0; i < count; ++i)
+            {
+                pixels[i] = static_cast<unsigned short>(coordinates[i] - offset);
+            }
+        }
+
+        if (!vertical) return;
+
+        // Rows go from the top down
+        for (size_t i = 0; i < count; ++i)
+        {
+            pixels[i] = static_cast<unsigned short>((height - 1) - pixels[i]);
+        }
+    }
+
+    void Canvas::accumulateLines(const std::vector<std::pair<Pixelxy, Pixelxy>>& pixel_lines, unsigned int threads)
+    {
+        LSYS_TRACE_SCOPE("Canvas::accumulateLines");
+
+        threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(pixel_lines.size())));
+        size_t count = static_cast<size_t>(width) * height;
+
+        // The first thread accumulates into the canvas itself
+        std::vector<std::vector<uint32_t>> buffers(threads - 1, std::vector<uint32_t>(count, 0));
+        auto accumulate = [this, &pixel_lines, &buffers, threads](unsigned int thread)
+        {
+            LSYS_TRACE_SCOPE("Canvas::accumulate");
+
+            uint32_t* counts = thread == 0 ? hit_counts.data() : buffers[thread - 1].data();
+            size_t stride = width;
+
+            size_t first = pixel_lines.size() * thread / threads;
+            size_t last = pixel_lines.size() * (thread + 1) / threads;
+            for (size_t i = first; i < last; ++i)
+            {
+                traceLine(pixel_lines[i].first, pixel_lines[i].second, [counts, stride](int x, int y)
+                {
+                    ++counts[y * stride + x];
+                });
+            }
+        };
+
+        // Sum the private buffers into the canvas, a band of rows per thread
+        auto reduce = [this, &buffers, threads, count](unsigned int thread)
+        {
+            LSYS_TRACE_SCOPE("Canvas::reduce");
+
+            size_t first = count * thread / threads;
+            size_t last = count * (thread + 1) / threads;
+
+            uint32_t* __restrict counts = hit_counts.data();
+            for (const auto& buffer : buffers)
+            {
+                const uint32_t* __restrict other = buffer.data();
+                for (size_t i = first; i < last; ++i)
+                {
+                    counts[i] += other[i];
+                }
+            }
+        };
+
+        auto runStage = [threads](const std::function<void(unsigned int)>& stage)
+        {
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < threads; ++i)
+            {
+                workers.emplace_back(stage, i);
+            }
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        };
+
+        runStage(accumulate);
+        runStage(reduce);
+    }
+
+    bool Canvas::clipLine(Point2d& start, Point2d& end) const
+    {
+        float dx = end.x - start.x;
+        float dy = end.y - start.y;
+
+        // Distances to the left, right, bottom and top edges, along the line and perpendicular to them
+        float p[4] = {-dx, dx, -dy, dy};
+        float q[4] = {start.x - bounds.min_x, bounds.max_x - start.x, start.y - bounds.min_y, bounds.max_y - start.y};
+
+        float t0 = 0;
+        float t1 = 1;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (p[i] == 0)
+            {
+                // Parallel to the edge, and outside of it
+                if (q[i] < 0) return false;
+                continue;
+            }
+
+            float t = q[i] / p[i];
+            if (p[i] < 0)
+            {
+                if (t > t1) return false;
+                t0 = std::max(t0, t);
+            }
+            else
+            {
+                if (t < t0) return false;
+                t1 = std::min(t1, t);
+            }
+        }
+
+        Point2d origin = start;
+        if (t0 > 0)
+        {
+            start = Point2d(origin.x + t0 * dx, origin.y + t0 * dy);
+        }
+        if (t1 < 1)
+        {
+            end = Point2d(origin.x + t1 * dx, origin.y + t1 * dy);
+        }
+
+        return true;
+    }
+
     void Canvas::rasterizeLine(Pixelxy start, Pixelxy end)
     {
-        int dx = std::abs(end.x - start.x);
-        int sx = start.x < end.x ? 1 : -1;
+        rasterizeLine(start, end, 0, height);
+    }
 
-        int dy = std::abs(end.y - start.y);
-        int sy = start.y < end.y ? 1 : -1;
+    void Canvas::rasterizeLine(Pixelxy start, Pixelxy end, int first_row, int last_row)
+    {
+        int dx = end.x - start.x;
+        int dy = end.y - start.y;
 
-        int err = (dx > dy ? dx : -dy) / 2;
-        int e2;
+        // Horizontal lines are a single span of a row
+        if (dy == 0)
+        {
+            if (start.y >= first_row && start.y < last_row)
+            {
+                fillRow(start.y, std::min(start.x, end.x), std::max(start.x, end.x));
+            }
+            return;
+        }
+
+        // Bresenham sets exactly one pixel per row on vertical and diagonal lines, so they are walked top down
+        if (dx == 0 || std::abs(dx) == std::abs(dy))
+        {
+            if (dy < 0)
+            {
+                std::swap(start, end);
+                dx = -dx;
+            }
 
-        while (true)
+            int step_x = dx == 0 ? 0 : (dx > 0 ? 1 : -1);
+            int top = std::max<int>(start.y, first_row);
+            int bottom = std::min<int>(end.y, last_row - 1);
+            if (top <= bottom)
+            {
+                fillColumn(start.x + (top - start.y) * step_x, top, step_x, bottom - top + 1);
+            }
+            return;
+        }
+
+        // Pick the format once per line rather than once per pixel
+        switch (pixel_format)
         {
-            pixels[start.y][start.x] = RgbColor(255, 255, 255);
+            case PixelFormat::Mono1:
+            {
+                uint8_t* data = pixel_data.data();
+                size_t stride = row_stride;
+                traceLineInRows(start, end, first_row, last_row, [data, stride](int x, int y)
+                {
+                    data[y * stride + (x >> 3)] |= static_cast<uint8_t>(0x80 >> (x & 7));
+                });
+                break;
+            }
+            case PixelFormat::Gray8:
+            {
+                uint8_t* data = pixel_data.data();
+                size_t stride = row_stride;
+                traceLineInRows(start, end, first_row, last_row, [data, stride](int x, int y)
+                {
+                    data[y * stride + x] = 255;
+                });
+                break;
+            }
+            case PixelFormat::Rgb24:
+                traceLineInRows(start, end, first_row, last_row, [this](int x, int y)
+                {
+                    pixels[y][x] = RgbColor(255, 255, 255);
+                });
+                break;
+            case PixelFormat::Density32:
+            {
+                uint32_t* counts = hit_counts.data();
+                size_t stride = width;
+                traceLineInRows(start, end, first_row, last_row, [counts, stride](int x, int y)
+                {
+                    ++counts[y * stride + x];
+                });
+                break;
+            }
+        }
+    }
+
+    void Canvas::fillRow(int y, int first_x, int last_x)
+    {
+        size_t count = last_x - first_x + 1;
+
+        switch (pixel_format)
+        {
+            case PixelFormat::Mono1:
+            {
+                uint8_t* row = pixel_data.data() + y * row_stride;
+                int first_byte = first_x >> 3;
+                int last_byte = last_x >> 3;
+                auto first_mask = static_cast<uint8_t>(0xFF >> (first_x & 7));
+                auto last_mask = static_cast<uint8_t>(0xFF << (7 - (last_x & 7)));
+
+                if (first_byte == last_byte)
+                {
+                    row[first_byte] |= first_mask & last_mask;
+                    break;
+                }
+
+                row[first_byte] |= first_mask;
+                std::memset(row + first_byte + 1, 0xFF, last_byte - first_byte - 1);
+                row[last_byte] |= last_mask;
+                break;
+            }
+            case PixelFormat::Gray8:
+                std::memset(pixel_data.data() + y * row_stride + first_x, 255, count);
+                break;
+            case PixelFormat::Rgb24:
+                // A white pixel is three 0xFF bytes
+                static_assert(sizeof(RgbColor) == 3, "RgbColor must be packed to be filled as bytes");
+                std::memset(static_cast<void*>(pixels[y] + first_x), 0xFF, count * sizeof(RgbColor));
+                break;
+            case PixelFormat::Density32:
+            {
+                uint32_t* counts = hit_counts.data() + static_cast<size_t>(y) * width + first_x;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    ++counts[i];
+                }
+                break;
+            }
+        }
+    }
+
+    void Canvas::fillColumn(int x, int y, int step_x, int count)
+    {
+        switch (pixel_format)
+        {
+            case PixelFormat::Mono1:
+            {
+                uint8_t* row = pixel_data.data() + y * row_stride;
+                for (int i = 0; i < count; ++i, x += step_x, row += row_stride)
+                {
+                    row[x >> 3] |= static_cast<uint8_t>(0x80 >> (x & 7));
+                }
+                break;
+            }
+            case PixelFormat::Gray8:
+            {
+                // Walk the pixels directly, one row down and step_x across at a time
+                uint8_t* pixel = pixel_data.data() + y * row_stride + x;
+                std::ptrdiff_t step = static_cast<std::ptrdiff_t>(row_stride) + step_x;
+                for (int i = 0; i < count; ++i, pixel += step)
+                {
+                    *pixel = 255;
+                }
+                break;
+            }
+            case PixelFormat::Rgb24:
+                for (int i = 0; i < count; ++i, x += step_x)
+                {
+                    pixels[y + i][x] = RgbColor(255, 255, 255);
+                }
+                break;
+            case PixelFormat::Density32:
+            {
+                uint32_t* pixel = hit_counts.data() + static_cast<size_t>(y) * width + x;
+                std::ptrdiff_t step = static_cast<std::ptrdiff_t>(width) + step_x;
+                for (int i = 0; i < count; ++i, pixel += step)
+                {
+                    ++*pixel;
+                }
+                break;
+            }
+        }
+    }
 
-            if (start.x == end.x && start.y == end.y)
+    void Canvas::setPixel(int x, int y)
+    {
+        switch (pixel_format)
+        {
+            case PixelFormat::Mono1:
+                pixel_data[y * row_stride + (x >> 3)] |= static_cast<uint8_t>(0x80 >> (x & 7));
+                break;
+            case PixelFormat::Gray8:
+                pixel_data[y * row_stride + x] = 255;
+                break;
+            case PixelFormat::Rgb24:
+                pixels[y][x] = RgbColor(255, 255, 255);
                 break;
+            case PixelFormat::Density32:
+                ++hit_counts[y * width + x];
+                break;
+        }
+    }
+
+    bool Canvas::isPixelSet(unsigned short x, unsigned short y) const
+    {
+        switch (pixel_format)
+        {
+            case PixelFormat::Mono1:
+                return (pixel_data[y * row_stride + (x >> 3)] & (0x80 >> (x & 7))) != 0;
+            case PixelFormat::Gray8:
+                return pixel_data[y * row_stride + x] != 0;
+            case PixelFormat::Rgb24:
+                return pixels[y][x].r != 0 || pixels[y][x].g != 0 || pixels[y][x].b != 0;
+            case PixelFormat::Density32:
+                return hit_counts[y * width + x] != 0;
+        }
+
+        return false;
+    }
+
+    void Canvas::clearPixels()
+    {
+        if (pixel_format == PixelFormat::Density32)
+        {
+            std::fill(hit_counts.begin(), hit_counts.end(), 0);
+            return;
+        }
+
+        if (pixel_format != PixelFormat::Rgb24)
+        {
+            std::memset(pixel_data.data(), 0, pixel_data.size());
+            return;
+        }
+
+        if (pixels == nullptr) return;
+
+        for (unsigned short y = 0; y < height; ++y)
+        {
+            std::fill(pixels[y], pixels[y] + width, RgbColor());
+        }
+    }
+
+    void Canvas::mergePixels(const Canvas& other)
+    {
+        if (other.pixel_format != pixel_format || other.width != width || other.height != height) return;
 
-            e2 = err;
+        if (pixel_format == PixelFormat::Density32)
+        {
+            if (other.hit_counts.size() != hit_counts.size()) return;
+
+            for (size_t i = 0; i < hit_counts.size(); ++i)
+            {
+                hit_counts[i] += other.hit_counts[i];
+            }
+            return;
+        }
 
-            if (e2 > -dx)
+        if (pixel_format != PixelFormat::Rgb24)
+        {
+            if (other.pixel_data.size() != pixel_data.size()) return;
+
+            // Rows are padded to whole words
+            size_t words = pixel_data.size() / sizeof(uint64_t);
+            for (size_t i = 0; i < words; ++i)
             {
-                err -= dy;
-                start.x += sx;
+                uint64_t word;
+                uint64_t other_word;
+                std::memcpy(&word, pixel_data.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+                std::memcpy(&other_word, other.pixel_data.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+
+                word |= other_word;
+                std::memcpy(pixel_data.data() + i * sizeof(uint64_t), &word, sizeof(uint64_t));
             }
-            if (e2 < dy)
+            return;
+        }
+
+        if (pixels == nullptr || other.pixels == nullptr) return;
+
+        for (unsigned short y = 0; y < height; ++y)
+        {
+            for (unsigned short x = 0; x < width; ++x)
             {
-                err += dx;
-                start.y += sy;
+                pixels[y][x].r |= other.pixels[y][x].r;
+                pixels[y][x].g |= other.pixels[y][x].g;
+                pixels[y][x].b |= other.pixels[y][x].b;
             }
         }
     }
 
+    void Canvas::plotPixels(Pixelxy origin, const std::vector<Vec2<int>>& offsets)
+    {
+        if (!this->allow_drawing || !this->pen_down) return;
+
+        for (const auto& offset : offsets)
+        {
+            int x = origin.x + offset.x;
+            int y = origin.y + offset.y;
+            if (x < 0 || y < 0 || x >= width || y >= height) continue;
+
+            setPixel(x, y);
+        }
+    }
+
+    void Canvas::setLineRecorder(std::vector<Point2d>* recorder)
+    {
+        this->line_recorder = recorder;
+    }
+
     void Canvas::penUp()
     {
         this->pen_down = false;
@@ -130,13 +776,58 @@ namespace lsys::graphics
         this->pen_down = true;
     }
 
+    bool Canvas::isPenDown() const
+    {
+        return pen_down;
+    }
+
+    void Canvas::setViewport(const Bounds2d& viewport)
+    {
+        bounds = viewport;
+        has_viewport = true;
+
+        spacing.x = (bounds.max_x - bounds.min_x) / (float)width;
+        spacing.y = (bounds.max_y - bounds.min_y) / (float)height;
+    }
+
+    bool Canvas::hasViewport() const
+    {
+        return has_viewport;
+    }
+
+    float Canvas::getScale() const
+    {
+        return has_viewport ? 1.0f / spacing.x : 1.0f;
+    }
+
     void Canvas::allocatePixels()
     {
         // Update spacing
         spacing.x = (bounds.max_x - bounds.min_x) / (float)width;
         spacing.y = (bounds.max_y - bounds.min_y) / (float)height;
 
-        // Allocate pixels
+        if (pixel_format == PixelFormat::Density32)
+        {
+            hit_counts.assign(static_cast<size_t>(width) * height, 0);
+            return;
+        }
+
+        // Allocate pixels, padding the rows of the compact formats to whole words
+        if (pixel_format != PixelFormat::Rgb24)
+        {
+            size_t row_bytes = pixel_format == PixelFormat::Mono1 ? (width + 7) / 8 : width;
+            row_stride = (row_bytes + 7) / 8 * 8;
+            pixel_data.assign(row_stride * height, 0);
+            return;
+        }
+
+        // A canvas drawn on again keeps its rows, cleared
+        if (pixels != nullptr)
+        {
+            clearPixels();
+            return;
+        }
+
         pixels = new RgbColor*[height];
         for (unsigned short i = 0; i < height; ++i)
         {
@@ -144,13 +835,50 @@ namespace lsys::graphics
         }
     }
 
+    std::vector<uint8_t> Canvas::toneMap(ToneMapping mapping, float gamma) const
+    {
+        if (pixel_format != PixelFormat::Density32 || hit_counts.empty()) return {};
+
+        size_t stride = (static_cast<size_t>(width) + 7) / 8 * 8;
+        std::vector<uint8_t> levels(stride * height, 0);
+
+        uint32_t max_count = *std::max_element(hit_counts.begin(), hit_counts.end());
+        if (max_count == 0) return levels;
+
+        // Counts repeat a lot, so the curve is tabulated for the small ones
+        std::vector<uint8_t> table(std::min<uint32_t>(max_count, 1 << 16) + 1);
+        auto curve = [mapping, gamma, max_count](uint32_t count)
+        {
+            double level = mapping == ToneMapping::Log
+                ? std::log1p((double)count) / std::log1p((double)max_count)
+                : std::pow((double)count / max_count, 1.0 / gamma);
+            return static_cast<uint8_t>(std::lround(255.0 * level));
+        };
+        for (uint32_t count = 0; count < table.size(); ++count)
+        {
+            table[count] = curve(count);
+        }
+
+        for (unsigned short y = 0; y < height; ++y)
+        {
+            const uint32_t* counts = hit_counts.data() + static_cast<size_t>(y) * width;
+            uint8_t* row = levels.data() + y * stride;
+            for (unsigned short x = 0; x < width; ++x)
+            {
+                row[x] = counts[x] < table.size() ? table[counts[x]] : curve(counts[x]);
+            }
+        }
+
+        return levels;
+    }
+
     void Canvas::printCanvasAscii(std::ostream& out) const
     {
         for (unsigned short y = 0; y < height; ++y)
         {
             for (unsigned short x = 0; x < width; ++x)
             {
-                out << ((pixels[y][x].r == 255) ? '*' : '.') << " ";
+                out << (isPixelSet(x, y) ? '*' : '.') << " ";
             }
             out << '\n';
         }
@@ -189,6 +917,26 @@ namespace lsys::graphics
         Canvas::pixels = pixels;
     }
 
+    PixelFormat Canvas::getPixelFormat() const
+    {
+        return pixel_format;
+    }
+
+    const uint8_t* Canvas::getPixelData() const
+    {
+        return pixel_data.empty() ? nullptr : pixel_data.data();
+    }
+
+    size_t Canvas::getRowStride() const
+    {
+        return row_stride;
+    }
+
+    const uint32_t* Canvas::getHitCounts() const
+    {
+        return hit_counts.empty() ? nullptr : hit_counts.data();
+    }
+
     bool Canvas::getAllowDrawing() const
     {
         return allow_drawing;
@@ -0,0 +1,203 @@
+#include "CommandOptimizer.hpp"
+
+namespace lsys
+{
+    float OptimizationStats::getReductionRatio() const
+    {
+        if (input_commands == 0) return 0;
+
+        return 1.0f - static_cast<float>(output_commands) / static_cast<float>(input_commands);
+    }
+
+    CommandOptimizer::CommandOptimizer(bool merge_moves)
+        : merge_moves(merge_moves)
+    {
+    }
+
+    OptimizationStats CommandOptimizer::optimize(std::vector<std::shared_ptr<TurtleCommand>>& commands)
+    {
+        output.clear();
+        output.reserve(commands.size());
+        open_brackets.clear();
+        pending_move = nullptr;
+        pending_move_count = 0;
+        pending_turn = nullptr;
+        pending_turn_count = 0;
+        stats = OptimizationStats();
+        stats.input_commands = commands.size();
+
+        size_t input_turns = 0;
+        size_t input_moves = 0;
+
+        for (const auto& command : commands)
+        {
+            if (command == nullptr)
+            {
+                ++stats.removed_noops;
+                continue;
+            }
+
+            switch (command->getType())
+            {
+                case TurtleCommandType::Turn:
+                {
+                    int degrees = static_cast<const TurnCommand&>(*command).degrees % 360;
+                    if (degrees == 0)
+                    {
+                        ++stats.removed_noops;
+                        break;
+                    }
+
+                    ++input_turns;
+                    pending_turn = command;
+                    pending_degrees = (pending_degrees + degrees) % 360;
+                    ++pending_turn_count;
+                    break;
+                }
+                case TurtleCommandType::MoveForward:
+                {
+                    float distance = static_cast<const MoveForwardCommand&>(*command).distance;
+                    ++input_moves;
+
+                    // The move is collinear with the pending one if the turns in between cancel out
+                    bool collinear = merge_moves && pending_move_count > 0 && pending_degrees == 0
+                                     && ((distance > 0 && pending_distance > 0) || (distance < 0 && pending_distance < 0));
+                    if (collinear)
+                    {
+                        pending_turn = nullptr;
+                        pending_turn_count = 0;
+
+                        pending_distance += distance;
+                        ++pending_move_count;
+                        break;
+                    }
+
+                    flushPending();
+                    pending_move = command;
+                    pending_distance = distance;
+                    pending_move_count = 1;
+                    break;
+                }
+                case TurtleCommandType::PushState:
+                    flushPending();
+                    output.push_back(command);
+                    open_brackets.push_back({output.size() - 1, false});
+                    break;
+                case TurtleCommandType::PopState:
+                {
+                    // Popping from an empty stack does nothing, so the pop is only understood if it is matched
+                    if (open_brackets.empty())
+                    {
+                        flushPending();
+                        emit(command);
+                        break;
+                    }
+
+                    // The heading is restored by the pop, so a turn right before it is dead
+                    pending_turn = nullptr;
+                    pending_turn_count = 0;
+                    pending_degrees = 0;
+                    flushPending();
+
+                    OpenBracket bracket = open_brackets.back();
+                    open_brackets.pop_back();
+
+                    if (!bracket.has_effect)
+                    {
+                        // Only turns and empty brackets can be inside, drop everything from the push on
+                        output.resize(bracket.output_index);
+                        ++stats.removed_brackets;
+                        reopenPending();
+                        break;
+                    }
+
+                    emit(command);
+                    break;
+                }
+                default:
+                    flushPending();
+                    emit(command);
+                    break;
+            }
+        }
+
+        flushPending();
+
+        commands.swap(output);
+        output.clear();
+        stats.output_commands = commands.size();
+
+        // Whatever turns and moves are missing from the output were folded or merged
+        for (const auto& command : commands)
+        {
+            TurtleCommandType type = command->getType();
+            if (type == TurtleCommandType::Turn) --input_turns;
+            else if (type == TurtleCommandType::MoveForward) --input_moves;
+        }
+        stats.folded_turns = input_turns;
+        stats.merged_moves = input_moves;
+
+        return stats;
+    }
+
+    void CommandOptimizer::flushPending()
+    {
+        if (pending_move_count > 0)
+        {
+            // Keep the original command unless moves were merged into it
+            if (pending_move_count > 1)
+            {
+                pending_move = std::make_shared<MoveForwardCommand>(pending_distance);
+            }
+            emit(pending_move);
+
+            pending_move = nullptr;
+            pending_move_count = 0;
+        }
+
+        if (pending_turn_count > 0)
+        {
+            if (pending_degrees != 0)
+            {
+                if (pending_turn_count > 1)
+                {
+                    pending_turn = std::make_shared<TurnCommand>(pending_degrees);
+                }
+                output.push_back(pending_turn);
+            }
+
+            pending_turn = nullptr;
+            pending_turn_count = 0;
+        }
+        pending_degrees = 0;
+    }
+
+    void CommandOptimizer::emit(const std::shared_ptr<TurtleCommand>& command)
+    {
+        output.push_back(command);
+
+        for (auto i = open_brackets.rbegin(); i != open_brackets.rend() && !i->has_effect; ++i)
+        {
+            i->has_effect = true;
+        }
+    }
+
+    void CommandOptimizer::reopenPending()
+    {
+        if (!output.empty() && output.back()->getType() == TurtleCommandType::Turn)
+        {
+            pending_turn = output.back();
+            pending_degrees = static_cast<const TurnCommand&>(*pending_turn).degrees % 360;
+            pending_turn_count = 1;
+            output.pop_back();
+        }
+
+        if (!output.empty() && output.back()->getType() == TurtleCommandType::MoveForward)
+        {
+            pending_move = output.back();
+            pending_distance = static_cast<const MoveForwardCommand&>(*pending_move).distance;
+            pending_move_count = 1;
+            output.pop_back();
+        }
+    }
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Derivation.hpp"
+
+namespace lsys
+{
+    constexpr size_t derivation_alphabet_size = 256;
+
+    static uint64_t saturatingAdd(uint64_t a, uint64_t b)
+    {
+        return (a > std::numeric_limits<uint64_t>::max() - b) ? std::numeric_limits<uint64_t>::max() : a + b;
+    }
+
+    bool SubtreeInfo::isSelfContained() const
+    {
+        return stack_net == 0 && stack_min >= 0 && !has_barrier;
+    }
+
+    Derivation::Derivation(const Lsystem& lsystem, unsigned int depth)
+        : axiom(lsystem.getAxiom())
+        , depth(depth)
+        , productions(derivation_alphabet_size)
+        , terminal(derivation_alphabet_size, true)
+        , commands(derivation_alphabet_size)
+        , infos(depth + 1, std::vector<SubtreeInfo>(derivation_alphabet_size))
+    {
+        for (size_t i = 0; i < derivation_alphabet_size; ++i)
+        {
+            productions[i] = std::string(1, static_cast<char>(i));
+        }
+
+        for (const auto& production : lsystem.getProductions())
+        {
+            productions[index(production.first)] = production.second;
+            terminal[index(production.first)] = (production.second.size() == 1 && production.second[0] == production.first);
+        }
+
+        for (const auto& symbol : lsystem.getSymbols())
+        {
+            commands[index(symbol.first)] = symbol.second;
+        }
+
+        // Leaves
+        for (size_t i = 0; i < derivation_alphabet_size; ++i)
+        {
+            SubtreeInfo& info = infos[0][i];
+            info.length = 1;
+
+            if (commands[i] == nullptr) continue;
+
+            switch (commands[i]->getType())
+            {
+                case TurtleCommandType::MoveForward:
+                {
+                    auto distance = static_cast<double>(static_cast<const MoveForwardCommand&>(*commands[i]).distance);
+                    info.moves = 1;
+                    info.displacement = {distance, 0};
+                    info.radius = std::fabs(distance);
+                    break;
+                }
+                case TurtleCommandType::Turn:
+                    info.rotation = (static_cast<const TurnCommand&>(*commands[i]).degrees % 360 + 360) % 360;
+                    break;
+                case TurtleCommandType::PushState:
+                    info.stack_net = 1;
+                    break;
+                case TurtleCommandType::PopState:
+                    info.stack_net = -1;
+                    info.stack_min = -1;
+                    break;
+                case TurtleCommandType::PenUp:
+                case TurtleCommandType::PenDown:
+                    info.has_barrier = true;
+                    break;
+                default:
+                    // A custom command can do anything
+                    info.has_barrier = true;
+                    info.radius = -1;
+                    break;
+            }
+        }
+
+        // Every other level is the concatenation of the level below
+        for (unsigned int d = 1; d <= depth; ++d)
+        {
+            for (size_t i = 0; i < derivation_alphabet_size; ++i)
+            {
+                if (terminal[i])
+                {
+                    infos[d][i] = infos[0][i];
+                    continue;
+                }
+
+                SubtreeInfo info;
+                for (char child : productions[i])
+                {
+                    const SubtreeInfo& child_info = infos[d - 1][index(child)];
+                    info.length = saturatingAdd(info.length, child_info.length);
+                    info.moves = saturatingAdd(info.moves, child_info.moves);
+                    info.stack_min = std::min(info.stack_min, info.stack_net + child_info.stack_min);
+                    info.stack_net += child_info.stack_net;
+                    info.has_barrier = info.has_barrier || child_info.has_barrier;
+                }
+                infos[d][i] = info;
+                computeGeometry(static_cast<char>(i), d);
+            }
+        }
+
+        axiom_offsets.push_back(0);
+        for (char symbol : axiom)
+        {
+            axiom_offsets.push_back(saturatingAdd(axiom_offsets.back(), infos[depth][index(symbol)].length));
+        }
+    }
+
+    void Derivation::computeGeometry(char symbol, unsigned int depth)
+    {
+        struct State
+        {
+            graphics::Vec2<double> position;
+            int rotation;
+        };
+
+        SubtreeInfo& info = infos[depth][index(symbol)];
+        State state = {{0, 0}, 0};
+        std::vector<State> stack;
+        double radius = 0;
+
+        for (char child : productions[index(symbol)])
+        {
+            const SubtreeInfo& child_info = infos[depth - 1][index(child)];
+            if (child_info.radius < 0)
+            {
+                info.radius = -1;
+                return;
+            }
+
+            // A push or pop is only understood when it is a single command
+            TurtleCommand* command = commands[index(child)].get();
+            bool is_leaf = (depth == 1 || terminal[index(child)]) && command != nullptr;
+
+            if (is_leaf && command->getType() == TurtleCommandType::PushState)
+            {
+                stack.push_back(state);
+                continue;
+            }
+            if (is_leaf && command->getType() == TurtleCommandType::PopState)
+            {
+                if (stack.empty())
+                {
+                    info.radius = -1;
+                    return;
+                }
+                state = stack.back();
+                stack.pop_back();
+                continue;
+            }
+            if (child_info.stack_net != 0 || child_info.stack_min < 0)
+            {
+                info.radius = -1;
+                return;
+            }
+
+            double radians = state.rotation * M_PI / 180.0;
+            double cos = std::cos(radians);
+            double sin = std::sin(radians);
+            const graphics::Vec2<double>& offset = child_info.displacement;
+
+            radius = std::max(radius, std::hypot(state.position.x, state.position.y) + child_info.radius);
+            state.position.x += cos * offset.x - sin * offset.y;
+            state.position.y += sin * offset.x + cos * offset.y;
+            state.rotation = (state.rotation + child_info.rotation) % 360;
+        }
+
+        if (!stack.empty())
+        {
+            info.radius = -1;
+            return;
+        }
+
+        info.displacement = state.position;
+        info.rotation = state.rotation;
+        info.radius = radius;
+    }
+
+    size_t Derivation::index(char symbol)
+    {
+        return static_cast<unsigned char>(symbol);
+    }
+
+    const std::string& Derivation::getAxiom() const
+    {
+        return axiom;
+    }
+
+    unsigned int Derivation::getDepth() const
+    {
+        return depth;
+    }
+
+    const std::string& Derivation::getProduction(char symbol) const
+    {
+        return productions[index(symbol)];
+    }
+
+    bool Derivation::isTerminal(char symbol) const
+    {
+        return terminal[index(symbol)];
+    }
+
+    TurtleCommand* Derivation::getCommand(char symbol) const
+    {
+        return commands[index(symbol)].get();
+    }
+
+    const SubtreeInfo& Derivation::getInfo(char symbol, unsigned int depth) const
+    {
+        return infos[depth][index(symbol)];
+    }
+
+    uint64_t Derivation::getLength() const
+    {
+        return axiom_offsets.back();
+    }
+
+    bool Derivation::seek(uint64_t offset, DerivationPath& path) const
+    {
+        path.clear();
+        if (offset >= getLength()) return false;
+
+        // Ancestor in the axiom
+        auto it = std::upper_bound(axiom_offsets.begin(), axiom_offsets.end(), offset) - 1;
+        auto position = static_cast<uint32_t>(it - axiom_offsets.begin());
+        path.push_back(position);
+        offset -= *it;
+
+        // Descend one production per level, skipping the expansions that end before the offset
+        char symbol = axiom[position];
+        for (unsigned int level = depth; level > 0 && !terminal[index(symbol)]; --level)
+        {
+            const std::string& production = productions[index(symbol)];
+
+            position = 0;
+            while (true)
+            {
+                uint64_t length = infos[level - 1][index(production[position])].length;
+                if (offset < length) break;
+
+                offset -= length;
+                ++position;
+            }
+
+            path.push_back(position);
+            symbol = production[position];
+        }
+
+        return true;
+    }
+
+    DerivationCursor::DerivationCursor(const Derivation& derivation, const DerivationPath& path)
+        : derivation(derivation)
+    {
+        start(path);
+    }
+
+    DerivationCursor::DerivationCursor(const Derivation& derivation, uint64_t offset)
+        : derivation(derivation)
+    {
+        DerivationPath path;
+        if (derivation.seek(offset, path)) start(path);
+    }
+
+    void DerivationCursor::start(const DerivationPath& path)
+    {
+        const std::string* text = &derivation.getAxiom();
+        for (unsigned int level = 0; level < path.size(); ++level)
+        {
+            frames.push_back({text, path[level], level});
+            if (path[level] >= text->size()) break;
+
+            text = &derivation.getProduction((*text)[path[level]]);
+        }
+    }
+
+    bool DerivationCursor::next(char& symbol)
+    {
+        while (!frames.empty())
+        {
+            Frame& frame = frames.back();
+            if (frame.index >= frame.text->size())
+            {
+                // Done with this production, move past the symbol it expands
+                frames.pop_back();
+                if (!frames.empty()) ++frames.back().index;
+                continue;
+            }
+
+            char current = (*frame.text)[frame.index];
+            if (frame.level < derivation.getDepth() && !derivation.isTerminal(current))
+            {
+                frames.push_back({&derivation.getProduction(current), 0, frame.level + 1});
+                continue;
+            }
+
+            symbol = current;
+            ++frame.index;
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,374 @@
+#include <cmath>
+#include "DerivationRenderer.hpp"
+
+namespace lsys
+{
+    DerivationRenderer::DerivationRenderer(const Derivation& derivation)
+        : derivation(derivation)
+        , stamp_cache(nullptr)
+        , min_subtree_size(0)
+        , lattice(false)
+        , lattice_origin(0, 0)
+        , lattice_state({{0, 0, 0, 0}, 0})
+    {
+    }
+
+    void DerivationRenderer::draw(Turtle& turtle)
+    {
+        Canvas& canvas = turtle.getCanvas();
+        unsigned int depth = derivation.getDepth();
+
+        lattice = isLatticeDerivation(turtle);
+        if (lattice && lattice_subtrees.empty())
+        {
+            lattice_subtrees.assign(depth + 1, std::vector<LatticeSubtree>(256));
+        }
+
+        // Every run starts on the lattice at the initial transform of the turtle
+        auto resetLattice = [&]()
+        {
+            const Transform2d& start = turtle.getInitialTransform();
+            lattice_origin = start.position;
+            lattice_state = {{0, 0, 0, 0}, ((start.rotation / 45) % 8 + 8) % 8};
+            lattice_stack.clear();
+        };
+
+        // Do a dry run to estimate canvas bounds, unless they are fixed
+        if (!canvas.hasViewport())
+        {
+            turtle.resetTransform();
+            resetLattice();
+            canvas.setAllowDrawing(false);
+            for (char symbol : derivation.getAxiom())
+            {
+                walk(turtle, symbol, depth, false);
+            }
+            canvas.setAllowDrawing(true);
+        }
+
+        // Now run and rasterize
+        stats = DerivationRenderStats();
+        turtle.resetTransform();
+        resetLattice();
+        canvas.allocatePixels();
+
+        if (stamp_cache != nullptr)
+        {
+            stamp_cache->clear();
+        }
+
+        for (char symbol : derivation.getAxiom())
+        {
+            walk(turtle, symbol, depth, stamp_cache != nullptr);
+        }
+    }
+
+    void DerivationRenderer::walk(Turtle& turtle, char symbol, unsigned int depth, bool use_stamps)
+    {
+        if (depth == 0 || derivation.isTerminal(symbol))
+        {
+            TurtleCommand* command = derivation.getCommand(symbol);
+            if (command == nullptr) return;
+
+            if (lattice)
+            {
+                executeOnLattice(turtle, *command);
+            }
+            else
+            {
+                command->execute(turtle);
+            }
+            return;
+        }
+
+        if (turtle.getCanvas().hasViewport() && cull(turtle, symbol, depth)) return;
+        if (min_subtree_size > 0 && drawSimplified(turtle, symbol, depth)) return;
+        if (use_stamps && drawStamped(turtle, symbol, depth)) return;
+
+        for (char child : derivation.getProduction(symbol))
+        {
+            walk(turtle, child, depth - 1, use_stamps);
+        }
+    }
+
+    bool DerivationRenderer::drawStamped(Turtle& turtle, char symbol, unsigned int depth)
+    {
+        const SubtreeInfo& info = derivation.getInfo(symbol, depth);
+        if (!info.isSelfContained() || !stamp_cache->isCacheable(depth, info.moves)) return false;
+
+        Canvas& canvas = turtle.getCanvas();
+        if (!canvas.isPenDown()) return false;
+
+        Transform2d start = turtle.getTransform();
+        Point2d position = canvas.getPixelPosition(start.position);
+        Vec2<double> subpixel(position.x - std::floor(position.x), position.y - std::floor(position.y));
+
+        StampCacheStats& stats = stamp_cache->getStats();
+        const RasterStamp* stamp = stamp_cache->find(symbol, depth, start.rotation, subpixel);
+
+        if (stamp != nullptr)
+        {
+            // Near the edge of the canvas lines are clipped, which the stamp does not reproduce
+            bool start_inside = position.x >= 0 && position.y >= 0 && position.x < canvas.getWidth()
+                                && position.y < canvas.getHeight();
+            Pixelxy start_pixel = canvas.getPixelFromPoint(start.position);
+            if (!stamp->isExactAt(subpixel.x, subpixel.y) || !start_inside
+                || !stamp->fitsAt(start_pixel, canvas.getWidth(), canvas.getHeight()))
+            {
+                ++stats.fallbacks;
+                return false;
+            }
+
+            canvas.plotPixels(start_pixel, stamp->offsets);
+
+            if (lattice)
+            {
+                turtle.setTransform(skipSubtree(start, symbol, depth));
+            }
+            else
+            {
+                Point2d end(start.position.x + stamp->end_offset.x, start.position.y + stamp->end_offset.y);
+                turtle.setTransform({end, stamp->end_rotation});
+            }
+            ++stats.hits;
+            return true;
+        }
+
+        if (!stamp_cache->shouldRecord(symbol, depth, start.rotation, subpixel))
+        {
+            ++stats.misses;
+            return false;
+        }
+
+        // Draw the subtree normally while recording its lines. Nested subtrees are not stamped while recording.
+        recorded_lines.clear();
+        canvas.setLineRecorder(&recorded_lines);
+        for (char child : derivation.getProduction(symbol))
+        {
+            walk(turtle, child, depth - 1, false);
+        }
+        canvas.setLineRecorder(nullptr);
+
+        const Transform2d& end = turtle.getTransform();
+        stamp_cache->record(symbol, depth, start.position, start.rotation, end.position, end.rotation, recorded_lines, canvas);
+        ++stats.misses;
+        return true;
+    }
+
+    bool DerivationRenderer::cull(Turtle& turtle, char symbol, unsigned int depth)
+    {
+        const SubtreeInfo& info = derivation.getInfo(symbol, depth);
+        if (info.radius < 0 || !info.isSelfContained()) return false;
+
+        // Test the bounding box of the circle containing the subtree against the viewport
+        Transform2d start = turtle.getTransform();
+        const Bounds2d& viewport = turtle.getCanvas().getBounds();
+        auto radius = static_cast<float>(info.radius);
+
+        bool outside = start.position.x + radius < viewport.min_x || start.position.x - radius > viewport.max_x
+                       || start.position.y + radius < viewport.min_y || start.position.y - radius > viewport.max_y;
+        if (!outside) return false;
+
+        turtle.setTransform(skipSubtree(start, symbol, depth));
+        ++stats.culled_subtrees;
+        return true;
+    }
+
+    Point2d DerivationRenderer::getEndPosition(const Transform2d& start, const SubtreeInfo& info)
+    {
+        double radians = start.rotation * M_PI / 180.0;
+        double cos = std::cos(radians);
+        double sin = std::sin(radians);
+
+        return Point2d(start.position.x + static_cast<float>(cos * info.displacement.x - sin * info.displacement.y),
+                       start.position.y + static_cast<float>(sin * info.displacement.x + cos * info.displacement.y));
+    }
+
+    bool DerivationRenderer::drawSimplified(Turtle& turtle, char symbol, unsigned int depth)
+    {
+        const SubtreeInfo& info = derivation.getInfo(symbol, depth);
+        if (info.radius < 0 || !info.isSelfContained()) return false;
+        if (2 * info.radius * turtle.getCanvas().getScale() >= min_subtree_size) return false;
+
+        Transform2d start = turtle.getTransform();
+        Transform2d end = skipSubtree(start, symbol, depth);
+
+        if (info.moves > 0)
+        {
+            turtle.getCanvas().drawLine(start.position, end.position);
+        }
+
+        turtle.setTransform(end);
+        ++stats.simplified_subtrees;
+        return true;
+    }
+
+    Transform2d DerivationRenderer::skipSubtree(const Transform2d& start, char symbol, unsigned int depth)
+    {
+        const SubtreeInfo& info = derivation.getInfo(symbol, depth);
+        if (!lattice) return {getEndPosition(start, info), ((start.rotation + info.rotation) % 360 + 360) % 360};
+
+        LatticePosition displacement = Turtle::rotateOnLattice(getLatticeDisplacement(symbol, depth),
+                                                               lattice_state.direction);
+        lattice_state.position.x_axis += displacement.x_axis;
+        lattice_state.position.x_diagonal += displacement.x_diagonal;
+        lattice_state.position.y_axis += displacement.y_axis;
+        lattice_state.position.y_diagonal += displacement.y_diagonal;
+        lattice_state.direction = (lattice_state.direction + info.rotation / 45) % 8;
+
+        return {Turtle::getLatticePoint(lattice_origin, lattice_state.position), lattice_state.direction * 45};
+    }
+
+    bool DerivationRenderer::isLatticeDerivation(const Turtle& turtle) const
+    {
+        if (!turtle.getLatticeEnabled() || turtle.getInitialTransform().rotation % 45 != 0) return false;
+
+        // Find the symbols of the evaluated axiom, level by level, until they stop changing
+        std::vector<bool> symbols(256, false);
+        for (char symbol : derivation.getAxiom())
+        {
+            symbols[static_cast<unsigned char>(symbol)] = true;
+        }
+
+        for (unsigned int level = 0; level < derivation.getDepth(); ++level)
+        {
+            std::vector<bool> next(256, false);
+            for (size_t symbol = 0; symbol < symbols.size(); ++symbol)
+            {
+                if (!symbols[symbol]) continue;
+
+                for (char child : derivation.getProduction(static_cast<char>(symbol)))
+                {
+                    next[static_cast<unsigned char>(child)] = true;
+                }
+            }
+
+            if (next == symbols) break;
+            symbols.swap(next);
+        }
+
+        for (size_t symbol = 0; symbol < symbols.size(); ++symbol)
+        {
+            TurtleCommand* command = derivation.getCommand(static_cast<char>(symbol));
+            if (symbols[symbol] && command != nullptr && !Turtle::isLatticeCommand(*command)) return false;
+        }
+
+        return true;
+    }
+
+    void DerivationRenderer::executeOnLattice(Turtle& turtle, TurtleCommand& command)
+    {
+        switch (command.getType())
+        {
+            case TurtleCommandType::MoveForward:
+            {
+                Point2d start = turtle.getTransform().position;
+                stepOnLattice(lattice_state, lattice_stack, command);
+                turtle.getCanvas().drawLine(start, Turtle::getLatticePoint(lattice_origin, lattice_state.position));
+                break;
+            }
+            case TurtleCommandType::Turn:
+            case TurtleCommandType::PushState:
+            case TurtleCommandType::PopState:
+                stepOnLattice(lattice_state, lattice_stack, command);
+                break;
+            default:
+                command.execute(turtle);
+                return;
+        }
+
+        Point2d position = Turtle::getLatticePoint(lattice_origin, lattice_state.position);
+        turtle.setTransform({position, lattice_state.direction * 45});
+    }
+
+    void DerivationRenderer::stepOnLattice(LatticeState& state, std::vector<LatticeState>& stack,
+                                           const TurtleCommand& command)
+    {
+        switch (command.getType())
+        {
+            case TurtleCommandType::MoveForward:
+            {
+                auto distance = static_cast<const MoveForwardCommand&>(command).distance;
+                Turtle::moveOnLattice(state, static_cast<int64_t>(distance));
+                break;
+            }
+            case TurtleCommandType::Turn:
+            {
+                int steps = static_cast<const TurnCommand&>(command).degrees / 45;
+                state.direction = ((state.direction + steps) % 8 + 8) % 8;
+                break;
+            }
+            case TurtleCommandType::PushState:
+                stack.push_back(state);
+                break;
+            case TurtleCommandType::PopState:
+                if (stack.empty()) break;
+
+                state = stack.back();
+                stack.pop_back();
+                break;
+            default:
+                break;
+        }
+    }
+
+    void DerivationRenderer::applyOnLattice(LatticeState& state, std::vector<LatticeState>& stack, char symbol,
+                                            unsigned int depth)
+    {
+        if (depth == 0 || derivation.isTerminal(symbol))
+        {
+            TurtleCommand* command = derivation.getCommand(symbol);
+            if (command != nullptr) stepOnLattice(state, stack, *command);
+            return;
+        }
+
+        const SubtreeInfo& info = derivation.getInfo(symbol, depth);
+        if (!info.isSelfContained())
+        {
+            for (char child : derivation.getProduction(symbol))
+            {
+                applyOnLattice(state, stack, child, depth - 1);
+            }
+            return;
+        }
+
+        LatticePosition displacement = Turtle::rotateOnLattice(getLatticeDisplacement(symbol, depth), state.direction);
+        state.position.x_axis += displacement.x_axis;
+        state.position.x_diagonal += displacement.x_diagonal;
+        state.position.y_axis += displacement.y_axis;
+        state.position.y_diagonal += displacement.y_diagonal;
+        state.direction = (state.direction + info.rotation / 45) % 8;
+    }
+
+    const LatticePosition& DerivationRenderer::getLatticeDisplacement(char symbol, unsigned int depth)
+    {
+        LatticeSubtree& subtree = lattice_subtrees[depth][static_cast<unsigned char>(symbol)];
+        if (subtree.known) return subtree.displacement;
+
+        LatticeState state = {{0, 0, 0, 0}, 0};
+        std::vector<LatticeState> stack;
+        for (char child : derivation.getProduction(symbol))
+        {
+            applyOnLattice(state, stack, child, depth - 1);
+        }
+
+        subtree.known = true;
+        subtree.displacement = state.position;
+        return subtree.displacement;
+    }
+
+    void DerivationRenderer::setStampCache(StampCache* stamp_cache)
+    {
+        this->stamp_cache = stamp_cache;
+    }
+
+    void DerivationRenderer::setLevelOfDetail(float min_subtree_size)
+    {
+        this->min_subtree_size = min_subtree_size;
+    }
+
+    const DerivationRenderStats& DerivationRenderer::getStats() const
+    {
+        return stats;
+    }
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include "InstancedDrawing.hpp"
+#include "Trace.hpp"
+
+namespace lsys
+{
+    InstancedDrawing::InstancedDrawing(size_t chunk_size)
+        : chunk_size(std::max<size_t>(chunk_size, 1))
+        , local_bounds({0, 0, 0, 0})
+    {
+    }
+
+    void InstancedDrawing::interpret(Lsystem& lsystem, Turtle& turtle)
+    {
+        LSYS_TRACE_SCOPE("InstancedDrawing::interpret");
+
+        segments.clear();
+        lsystem.draw(turtle, segments);
+        local_bounds = segments.getBounds();
+    }
+
+    void InstancedDrawing::addInstance(const Instance& instance)
+    {
+        instances.push_back(instance);
+    }
+
+    void InstancedDrawing::clearInstances()
+    {
+        instances.clear();
+    }
+
+    void InstancedDrawing::draw(Canvas& canvas, unsigned int threads)
+    {
+        LSYS_TRACE_SCOPE("InstancedDrawing::draw");
+
+        SegmentBuffer output(chunk_size, [&canvas, threads](const SegmentBuffer& chunk)
+        {
+            canvas.drawSegments(chunk, threads);
+        });
+
+        // Do a dry run to estimate canvas bounds, unless they are fixed
+        if (!canvas.hasViewport())
+        {
+            canvas.setAllowDrawing(false);
+            transformInstances(output, nullptr);
+            canvas.setAllowDrawing(true);
+        }
+
+        canvas.allocatePixels();
+        transformInstances(output, canvas.hasViewport() ? &canvas.getBounds() : nullptr);
+    }
+
+    void InstancedDrawing::transformInstances(SegmentBuffer& output, const Bounds2d* viewport)
+    {
+        stats = InstancedDrawingStats();
+
+        for (const auto& instance : instances)
+        {
+            if (viewport != nullptr)
+            {
+                Bounds2d bounds = getInstanceBounds(instance);
+                if (bounds.max_x < viewport->min_x || bounds.min_x > viewport->max_x ||
+                    bounds.max_y < viewport->min_y || bounds.min_y > viewport->max_y)
+                {
+                    ++stats.instances_culled;
+                    continue;
+                }
+            }
+
+            output.appendTransformed(segments, instance.rotation, instance.scale, instance.position);
+            ++stats.instances_drawn;
+            stats.segments += segments.size();
+        }
+
+        output.flush();
+    }
+
+    Bounds2d InstancedDrawing::getInstanceBounds(const Instance& instance) const
+    {
+        float radians = instance.rotation * M_PI / 180.0;
+        float cos_scaled = std::cos(radians) * instance.scale;
+        float sin_scaled = std::sin(radians) * instance.scale;
+
+        Bounds2d bounds = {0, 0, 0, 0};
+        bool first = true;
+        for (float x : {local_bounds.min_x, local_bounds.max_x})
+        {
+            for (float y : {local_bounds.min_y, local_bounds.max_y})
+            {
+                float world_x = x * cos_scaled - y * sin_scaled + instance.position.x;
+                float world_y = x * sin_scaled + y * cos_scaled + instance.position.y;
+                if (first)
+                {
+                    bounds = {world_x, world_y, world_x, world_y};
+                    first = false;
+                    continue;
+                }
+                bounds.min_x = std::min(bounds.min_x, world_x);
+                bounds.min_y = std::min(bounds.min_y, world_y);
+                bounds.max_x = std::max(bounds.max_x, world_x);
+                bounds.max_y = std::max(bounds.max_y, world_y);
+            }
+        }
+
+        return bounds;
+    }
+
+    const SegmentBuffer& InstancedDrawing::getSegments() const
+    {
+        return segments;
+    }
+
+    const std::vector<Instance>& InstancedDrawing::getInstances() const
+    {
+        return instances;
+    }
+
+    const InstancedDrawingStats& InstancedDrawing::getStats() const
+    {
+        return stats;
+    }
+}
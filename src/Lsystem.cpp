@@ -1,10 +1,22 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unistd.h>
 #include "Lsystem.hpp"
 #include "Turtle.hpp"
+#include "Trace.hpp"
 
 namespace lsys
 {
     Lsystem::Lsystem()
-        : is_evaluated(false)
+        : evaluated_iterations(0)
+        , is_program_loaded(false)
+        , is_evaluated(false)
+        , optimize_commands(false)
+        , merge_moves(false)
+        , packed_storage(false)
     {
     }
 
@@ -18,10 +30,138 @@ namespace lsys
         }
     }
 
+    /**
+     * Write the next generation of an axiom to a new temporary file, replacing every symbol with its production.
+     *
+     * @param directory Directory to create the file in
+     * @param data Symbols of the current generation
+     * @param size Number of symbols
+     * @param productions Production of every symbol
+     *
+     * @return Path to the file, or an empty string if it could not be written
+     */
+    std::string spillGeneration(const std::string& directory, const char* data, uint64_t size,
+                                const std::string* productions)
+    {
+        std::string filename = directory + "/lsys-XXXXXX";
+        int fd = mkstemp(&filename[0]);
+        if (fd < 0) return "";
+
+        const size_t buffer_size = 1 << 20;
+        std::string buffer;
+        buffer.reserve(buffer_size + 256);
+
+        auto flush = [&]()
+        {
+            size_t written = 0;
+            while (written < buffer.size())
+            {
+                ssize_t result = write(fd, buffer.data() + written, buffer.size() - written);
+                if (result <= 0) return false;
+
+                written += static_cast<size_t>(result);
+            }
+
+            buffer.clear();
+            return true;
+        };
+
+        bool ok = true;
+        for (uint64_t i = 0; i < size && ok; ++i)
+        {
+            buffer += productions[static_cast<unsigned char>(data[i])];
+            if (buffer.size() >= buffer_size) ok = flush();
+        }
+        ok = ok && flush();
+
+        if (close(fd) != 0) ok = false;
+        if (!ok)
+        {
+            unlink(filename.c_str());
+            return "";
+        }
+
+        return filename;
+    }
+
+    /**
+     * Make the symbol table entry of a symbol.
+     *
+     * @param symbol The symbol
+     * @param command The command the symbol maps to (or nullptr)
+     *
+     * @return The entry
+     */
+    io::ProgramFileSymbol makeProgramSymbol(char symbol, const std::shared_ptr<TurtleCommand>& command)
+    {
+        io::ProgramFileSymbol entry;
+        entry.symbol = static_cast<uint8_t>(symbol);
+        entry.command_type = 0xFF;
+
+        if (command != nullptr)
+        {
+            TurtleCommandType type = command->getType();
+            entry.command_type = static_cast<uint8_t>(type);
+
+            if (type == TurtleCommandType::MoveForward)
+            {
+                entry.value = static_cast<const MoveForwardCommand&>(*command).distance;
+            }
+            else if (type == TurtleCommandType::Turn)
+            {
+                entry.value = static_cast<float>(static_cast<const TurnCommand&>(*command).degrees);
+            }
+        }
+
+        return entry;
+    }
+
     void Lsystem::draw(Turtle& turtle)
     {
+        LSYS_TRACE_SCOPE("Lsystem::draw");
+
         if (!this->is_evaluated) return;
 
+        if (mapped_axiom.isOpen())
+        {
+            drawMapped(turtle, nullptr);
+            return;
+        }
+
+        if (packed_storage)
+        {
+            drawPacked(turtle, nullptr);
+            return;
+        }
+
+        loadCommands(turtle);
+        turtle.run();
+    }
+
+    void Lsystem::draw(Turtle& turtle, graphics::SegmentSink& sink)
+    {
+        LSYS_TRACE_SCOPE("Lsystem::draw");
+
+        if (!this->is_evaluated) return;
+
+        if (mapped_axiom.isOpen())
+        {
+            drawMapped(turtle, &sink);
+            return;
+        }
+
+        if (packed_storage)
+        {
+            drawPacked(turtle, &sink);
+            return;
+        }
+
+        loadCommands(turtle);
+        turtle.run(sink);
+    }
+
+    void Lsystem::loadCommands(Turtle& turtle)
+    {
         turtle.clearCommands();
         turtle.resetTransform();
 
@@ -33,12 +173,226 @@ namespace lsys
             turtle.addCommand(command);
         }
 
-        turtle.run();
+        if (optimize_commands)
+        {
+            optimization_stats = turtle.optimizeCommands(merge_moves);
+        }
+    }
+
+    void Lsystem::drawPacked(Turtle& turtle, graphics::SegmentSink* sink)
+    {
+        // Look the commands up by code instead of hashing every symbol
+        std::vector<std::shared_ptr<TurtleCommand>> commands(packed_axiom.getAlphabet().size());
+        for (size_t code = 0; code < commands.size(); ++code)
+        {
+            auto symbol = symbols.find(packed_axiom.getSymbol(static_cast<uint8_t>(code)));
+            if (symbol != symbols.end()) commands[code] = symbol->second;
+        }
+
+        // The whole program runs on the lattice if every command occurring in it can, like a queued program would
+        std::vector<bool> occurs(commands.size(), false);
+        packed_axiom.forEachCode([&](uint8_t code)
+        {
+            occurs[code] = true;
+        });
+
+        bool lattice = turtle.getLatticeEnabled() && turtle.getInitialTransform().rotation % 45 == 0;
+        for (size_t code = 0; code < commands.size(); ++code)
+        {
+            if (occurs[code] && commands[code] != nullptr && !Turtle::isLatticeCommand(*commands[code])) lattice = false;
+        }
+
+        if (sink != nullptr)
+        {
+            runPacked(turtle, sink, commands, lattice);
+        }
+        else
+        {
+            Canvas& canvas = turtle.getCanvas();
+
+            // Do a dry run to estimate canvas bounds, unless they are fixed
+            if (!canvas.hasViewport())
+            {
+                canvas.setAllowDrawing(false);
+                runPacked(turtle, nullptr, commands, lattice);
+                canvas.setAllowDrawing(true);
+            }
+
+            canvas.allocatePixels();
+            runPacked(turtle, nullptr, commands, lattice);
+        }
+
+        turtle.clearCommands();
     }
 
-    void Lsystem::evaluate(unsigned int iterations)
+    void Lsystem::runPacked(Turtle& turtle, graphics::SegmentSink* sink,
+                            const std::vector<std::shared_ptr<TurtleCommand>>& commands, bool lattice)
     {
-        if (this->is_evaluated) return;
+        const size_t chunk_size = 1 << 20;
+
+        turtle.clearCommands();
+        turtle.resetTransform();
+        optimization_stats = OptimizationStats();
+
+        bool first = true;
+        packed_axiom.forEachCode([&](uint8_t code)
+        {
+            if (commands[code] == nullptr) return;
+
+            turtle.addCommand(commands[code]);
+            if (turtle.getTotalCommands() == chunk_size)
+            {
+                runChunk(turtle, sink, first, lattice);
+                first = false;
+            }
+        });
+
+        if (first || turtle.getTotalCommands() > 0) runChunk(turtle, sink, first, lattice);
+    }
+
+    void Lsystem::runChunk(Turtle& turtle, graphics::SegmentSink* sink, bool first, bool lattice)
+    {
+        if (optimize_commands)
+        {
+            OptimizationStats stats = turtle.optimizeCommands(merge_moves);
+            optimization_stats.input_commands += stats.input_commands;
+            optimization_stats.output_commands += stats.output_commands;
+            optimization_stats.folded_turns += stats.folded_turns;
+            optimization_stats.merged_moves += stats.merged_moves;
+            optimization_stats.removed_brackets += stats.removed_brackets;
+            optimization_stats.removed_noops += stats.removed_noops;
+        }
+
+        turtle.executeChunk(first, lattice, sink);
+        turtle.clearCommands();
+    }
+
+    bool Lsystem::hasLatticeSymbols(const char* data, uint64_t size) const
+    {
+        bool occurs[256] = {};
+        for (uint64_t i = 0; i < size; ++i)
+        {
+            occurs[static_cast<unsigned char>(data[i])] = true;
+        }
+
+        for (const auto& symbol : symbols)
+        {
+            if (!occurs[static_cast<unsigned char>(symbol.first)] || symbol.second == nullptr) continue;
+            if (!Turtle::isLatticeCommand(*symbol.second)) return false;
+        }
+
+        return true;
+    }
+
+    void Lsystem::drawMapped(Turtle& turtle, graphics::SegmentSink* sink)
+    {
+        // The whole axiom runs on the lattice if every command occurring in it can, like a queued program would.
+        // A loaded program records whether its symbols can, so it needs no scan.
+        const char* data = mapped_axiom.getData();
+        uint64_t size = mapped_axiom.getSize();
+        const Transform2d& start = turtle.getInitialTransform();
+
+        bool lattice_symbols = is_program_loaded ? program_header.lattice_symbols != 0 : hasLatticeSymbols(data, size);
+        bool lattice_start = start.rotation % 45 == 0;
+        bool lattice = turtle.getLatticeEnabled() && lattice_start && lattice_symbols;
+
+        if (sink != nullptr)
+        {
+            runChunks(turtle, sink, data, size, lattice);
+        }
+        else
+        {
+            Canvas& canvas = turtle.getCanvas();
+
+            // The saved bounds only hold if the dry run took the same path as this draw
+            bool has_bounds = is_program_loaded
+                              && program_header.start_x == start.position.x
+                              && program_header.start_y == start.position.y
+                              && program_header.start_rotation == start.rotation
+                              && lattice == (lattice_start && lattice_symbols);
+
+            if (canvas.hasViewport())
+            {
+                // The bounds are fixed
+            }
+            else if (has_bounds)
+            {
+                // Grow the bounds the same way a dry run would
+                Bounds2d bounds = canvas.getBounds();
+                bounds.min_x = std::min(bounds.min_x, program_header.bounds.min_x);
+                bounds.min_y = std::min(bounds.min_y, program_header.bounds.min_y);
+                bounds.max_x = std::max(bounds.max_x, program_header.bounds.max_x);
+                bounds.max_y = std::max(bounds.max_y, program_header.bounds.max_y);
+                canvas.setBounds(bounds);
+            }
+            else
+            {
+                // Do a dry run to estimate canvas bounds
+                canvas.setAllowDrawing(false);
+                runChunks(turtle, nullptr, data, size, lattice);
+                canvas.setAllowDrawing(true);
+            }
+
+            canvas.allocatePixels();
+            runChunks(turtle, nullptr, data, size, lattice);
+        }
+
+        turtle.clearCommands();
+    }
+
+    void Lsystem::runChunks(Turtle& turtle, graphics::SegmentSink* sink, const char* data, uint64_t size, bool lattice)
+    {
+        const uint64_t chunk_size = 1 << 20;
+
+        std::shared_ptr<TurtleCommand> commands[256];
+        for (const auto& symbol : symbols)
+        {
+            commands[static_cast<unsigned char>(symbol.first)] = symbol.second;
+        }
+
+        turtle.clearCommands();
+        turtle.resetTransform();
+        optimization_stats = OptimizationStats();
+
+        // The turtle keeps its transform, stack and lattice state between chunks
+        bool first = true;
+        for (uint64_t start = 0; start < size; start += chunk_size)
+        {
+            uint64_t end = start + chunk_size < size ? start + chunk_size : size;
+
+            for (uint64_t i = start; i < end; ++i)
+            {
+                const auto& command = commands[static_cast<unsigned char>(data[i])];
+                if (command != nullptr) turtle.addCommand(command);
+            }
+
+            runChunk(turtle, sink, first, lattice);
+            first = false;
+        }
+
+        if (first) runChunk(turtle, sink, first, lattice);
+    }
+
+    bool Lsystem::evaluate(unsigned int iterations)
+    {
+        LSYS_TRACE_SCOPE("Lsystem::evaluate");
+
+        if (this->is_evaluated) return true;
+
+        mapped_axiom.close();
+        is_program_loaded = false;
+        evaluated_iterations = iterations;
+
+        if (!spill_directory.empty())
+        {
+            return evaluateSpilled(iterations);
+        }
+
+        if (packed_storage)
+        {
+            evaluatePacked(iterations);
+            return true;
+        }
 
         evaluated_axiom = axiom;
 
@@ -51,6 +405,98 @@ namespace lsys
         }
 
         this->is_evaluated = true;
+        return true;
+    }
+
+    void Lsystem::evaluatePacked(unsigned int iterations)
+    {
+        evaluated_axiom.clear();
+
+        auto productions = getProductions();
+
+        // The alphabet covers every symbol that can appear in the evaluated axiom
+        std::string used_symbols = axiom;
+        for (const auto& production : productions)
+        {
+            used_symbols.push_back(production.first);
+            used_symbols += production.second;
+        }
+
+        packed_axiom = PackedSequence(PackedSequence::makeAlphabet(used_symbols));
+        packed_axiom.append(axiom);
+
+        // Symbols without a production rewrite to themselves
+        std::vector<PackedSequence> packed_productions;
+        for (char symbol : packed_axiom.getAlphabet())
+        {
+            PackedSequence production(packed_axiom.getAlphabet());
+            auto found = productions.find(symbol);
+            production.append(found != productions.end() ? found->second : std::string(1, symbol));
+
+            packed_productions.push_back(production);
+        }
+
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            packed_axiom = packed_axiom.rewrite(packed_productions);
+        }
+
+        this->is_evaluated = true;
+    }
+
+    bool Lsystem::evaluateSpilled(unsigned int iterations)
+    {
+        evaluated_axiom.clear();
+        packed_axiom.clear();
+        mapped_axiom.close();
+
+        // Symbols without a production rewrite to themselves
+        std::string identity[256];
+        for (int i = 0; i < 256; ++i)
+        {
+            identity[i] = std::string(1, static_cast<char>(i));
+        }
+
+        std::string productions[256];
+        std::copy(identity, identity + 256, productions);
+        for (const auto& production : getProductions())
+        {
+            productions[static_cast<unsigned char>(production.first)] = production.second;
+        }
+
+        // Start from a spilled copy of the axiom, so every generation is read the same way
+        const std::string* table = identity;
+        const char* data = axiom.data();
+        uint64_t size = axiom.size();
+
+        for (unsigned int i = 0; i <= iterations; ++i)
+        {
+            // A failed generation leaves nothing behind, not even the previous one
+            std::string filename = spillGeneration(spill_directory, data, size, table);
+            if (filename.empty())
+            {
+                mapped_axiom.close();
+                return false;
+            }
+
+            // The mapping outlives the file, so nothing is left behind if the process dies
+            io::MappedFile generation;
+            bool mapped = generation.open(filename);
+            unlink(filename.c_str());
+            if (!mapped)
+            {
+                mapped_axiom.close();
+                return false;
+            }
+
+            mapped_axiom = std::move(generation);
+            table = productions;
+            data = mapped_axiom.getData();
+            size = mapped_axiom.getSize();
+        }
+
+        this->is_evaluated = true;
+        return true;
     }
 
     const std::string& Lsystem::getAxiom() const
@@ -69,6 +515,24 @@ namespace lsys
         return evaluated_axiom;
     }
 
+    const PackedSequence& Lsystem::getPackedAxiom() const
+    {
+        return packed_axiom;
+    }
+
+    const io::MappedFile& Lsystem::getMappedAxiom() const
+    {
+        return mapped_axiom;
+    }
+
+    uint64_t Lsystem::getEvaluatedLength() const
+    {
+        if (mapped_axiom.isOpen()) return mapped_axiom.getSize();
+        if (packed_storage) return packed_axiom.size();
+
+        return evaluated_axiom.size();
+    }
+
     const std::unordered_map<char, std::shared_ptr<TurtleCommand>>& Lsystem::getSymbols() const
     {
         return symbols;
@@ -100,6 +564,59 @@ namespace lsys
         this->is_evaluated = false;
     }
 
+    std::unordered_map<char, std::string> Lsystem::getProductions() const
+    {
+        std::unordered_map<char, std::string> productions;
+
+        for (const auto& symbol_rule : rules)
+        {
+            // Apply the rules in the same order evaluate does
+            std::string production(1, symbol_rule.first);
+            for (const auto& rule : rules)
+            {
+                replaceStrChar(production, rule.first, rule.second);
+            }
+
+            productions.insert({symbol_rule.first, production});
+        }
+
+        return productions;
+    }
+
+    uint64_t Lsystem::countEvaluated(unsigned int iterations, const std::vector<uint64_t>& weights) const
+    {
+        auto add = [](uint64_t a, uint64_t b) { return a > UINT64_MAX - b ? UINT64_MAX : a + b; };
+
+        // Counts of every symbol after the remaining iterations, starting with none remaining
+        std::vector<uint64_t> counts(weights);
+        auto productions = getProductions();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            std::vector<uint64_t> next_counts(counts);
+            for (const auto& production : productions)
+            {
+                uint64_t count = 0;
+                for (char symbol : production.second)
+                {
+                    count = add(count, counts[static_cast<unsigned char>(symbol)]);
+                }
+                next_counts[static_cast<unsigned char>(production.first)] = count;
+            }
+
+            // Every further iteration would give the same counts again
+            if (next_counts == counts) break;
+            counts.swap(next_counts);
+        }
+
+        uint64_t count = 0;
+        for (char symbol : axiom)
+        {
+            count = add(count, counts[static_cast<unsigned char>(symbol)]);
+        }
+
+        return count;
+    }
+
     void Lsystem::addRule(char character, const std::string& replacement)
     {
         // Ensure rule has not been already added
@@ -108,4 +625,203 @@ namespace lsys
         rules.insert({character, replacement});
         this->is_evaluated = false;
     }
+
+    bool Lsystem::getOptimizeCommands() const
+    {
+        return optimize_commands;
+    }
+
+    void Lsystem::setOptimizeCommands(bool optimize_commands)
+    {
+        this->optimize_commands = optimize_commands;
+    }
+
+    bool Lsystem::getMergeMoves() const
+    {
+        return merge_moves;
+    }
+
+    void Lsystem::setMergeMoves(bool merge_moves)
+    {
+        this->merge_moves = merge_moves;
+    }
+
+    const OptimizationStats& Lsystem::getOptimizationStats() const
+    {
+        return optimization_stats;
+    }
+
+    bool Lsystem::getPackedStorage() const
+    {
+        return packed_storage;
+    }
+
+    void Lsystem::setPackedStorage(bool packed_storage)
+    {
+        this->packed_storage = packed_storage;
+        this->is_evaluated = false;
+    }
+
+    const std::string& Lsystem::getSpillDirectory() const
+    {
+        return spill_directory;
+    }
+
+    void Lsystem::setSpillDirectory(const std::string& spill_directory)
+    {
+        this->spill_directory = spill_directory;
+        this->is_evaluated = false;
+    }
+
+    uint64_t Lsystem::getGrammarHash() const
+    {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325;
+        auto add = [&hash](const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash = (hash ^ bytes[i]) * 0x100000001b3;
+            }
+        };
+
+        add(axiom.c_str(), axiom.size() + 1);
+
+        // Hash in a fixed order, whatever the order of the maps
+        std::map<char, std::string> sorted_rules(rules.begin(), rules.end());
+        for (const auto& rule : sorted_rules)
+        {
+            add(&rule.first, 1);
+            add(rule.second.c_str(), rule.second.size() + 1);
+        }
+
+        std::map<char, std::shared_ptr<TurtleCommand>> sorted_symbols(symbols.begin(), symbols.end());
+        for (const auto& symbol : sorted_symbols)
+        {
+            io::ProgramFileSymbol entry = makeProgramSymbol(symbol.first, symbol.second);
+            add(&entry, sizeof(entry));
+        }
+
+        return hash;
+    }
+
+    bool Lsystem::saveProgram(const std::string& filename, const Turtle& turtle)
+    {
+        if (!this->is_evaluated) return false;
+
+        std::map<char, std::shared_ptr<TurtleCommand>> sorted_symbols(symbols.begin(), symbols.end());
+        std::vector<io::ProgramFileSymbol> symbol_table;
+        for (const auto& symbol : sorted_symbols)
+        {
+            symbol_table.push_back(makeProgramSymbol(symbol.first, symbol.second));
+        }
+
+        const Transform2d& start = turtle.getInitialTransform();
+
+        io::ProgramFileHeader header;
+        header.depth = evaluated_iterations;
+        header.grammar_hash = getGrammarHash();
+        header.length = getEvaluatedLength();
+        header.symbol_count = static_cast<uint32_t>(symbol_table.size());
+        header.start_x = start.position.x;
+        header.start_y = start.position.y;
+        header.start_rotation = start.rotation;
+
+        uint64_t table_end = sizeof(header) + symbol_table.size() * sizeof(io::ProgramFileSymbol);
+        header.data_offset = (table_end + io::program_file_alignment - 1) / io::program_file_alignment
+                             * io::program_file_alignment;
+
+        std::ofstream file;
+        file.open(filename, std::ios::trunc | std::ios::binary);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(symbol_table.data()),
+                   symbol_table.size() * sizeof(io::ProgramFileSymbol));
+
+        std::string padding(header.data_offset - table_end, '\0');
+        file.write(padding.data(), padding.size());
+
+        // Write the symbols
+        if (mapped_axiom.isOpen())
+        {
+            file.write(mapped_axiom.getData(), mapped_axiom.getSize());
+        }
+        else if (packed_storage)
+        {
+            std::string buffer;
+            packed_axiom.forEachCode([&](uint8_t code)
+            {
+                buffer.push_back(packed_axiom.getSymbol(code));
+                if (buffer.size() == (1 << 20))
+                {
+                    file.write(buffer.data(), buffer.size());
+                    buffer.clear();
+                }
+            });
+            file.write(buffer.data(), buffer.size());
+        }
+        else
+        {
+            file.write(evaluated_axiom.data(), evaluated_axiom.size());
+        }
+
+        file.close();
+        if (!file) return false;
+
+        // Find the bounds with a dry run of the written symbols, the same way a loaded program is drawn
+        io::MappedFile written;
+        if (!written.open(filename, header.data_offset)) return false;
+
+        Canvas scratch({start.position.x, start.position.y, start.position.x, start.position.y}, 1, 1);
+        scratch.setAllowDrawing(false);
+
+        header.lattice_symbols = hasLatticeSymbols(written.getData(), written.getSize());
+
+        Turtle dry_turtle(start, scratch);
+        runChunks(dry_turtle, nullptr, written.getData(), written.getSize(),
+                  header.lattice_symbols && start.rotation % 45 == 0);
+
+        header.bounds = scratch.getBounds();
+
+        // Patch the bounds into the header
+        std::fstream patch;
+        patch.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+        patch.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        patch.close();
+
+        return static_cast<bool>(patch);
+    }
+
+    bool Lsystem::loadProgram(const std::string& filename, unsigned int iterations)
+    {
+        this->is_evaluated = false;
+        evaluated_axiom.clear();
+        packed_axiom.clear();
+        mapped_axiom.close();
+        is_program_loaded = false;
+
+        io::MappedFile file;
+        if (!file.open(filename)) return false;
+        if (file.getSize() < sizeof(io::ProgramFileHeader)) return false;
+
+        io::ProgramFileHeader header;
+        std::memcpy(&header, file.getData(), sizeof(header));
+
+        // Reject files of another format, grammar, or depth
+        if (std::memcmp(header.magic, io::ProgramFileHeader().magic, sizeof(header.magic)) != 0) return false;
+        if (header.version != io::program_file_version) return false;
+        if (header.grammar_hash != getGrammarHash() || header.depth != iterations) return false;
+        if (header.data_offset > file.getSize() || file.getSize() - header.data_offset != header.length) return false;
+
+        file.close();
+        if (!mapped_axiom.open(filename, header.data_offset)) return false;
+
+        program_header = header;
+        is_program_loaded = true;
+        evaluated_iterations = iterations;
+        this->is_evaluated = true;
+
+        return true;
+    }
 }
@@ -0,0 +1,127 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MappedFile.hpp"
+
+namespace lsys::io
+{
+    MappedFile::MappedFile()
+        : data(nullptr)
+        , size(0)
+        , offset(0)
+        , is_open(false)
+    {
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept
+        : data(other.data)
+        , size(other.size)
+        , offset(other.offset)
+        , is_open(other.is_open)
+    {
+        other.data = nullptr;
+        other.size = 0;
+        other.offset = 0;
+        other.is_open = false;
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this == &other) return *this;
+
+        close();
+        data = other.data;
+        size = other.size;
+        offset = other.offset;
+        is_open = other.is_open;
+
+        other.data = nullptr;
+        other.size = 0;
+        other.offset = 0;
+        other.is_open = false;
+
+        return *this;
+    }
+
+    bool MappedFile::open(const std::string& filename, uint64_t offset)
+    {
+        close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size = static_cast<uint64_t>(file_stat.st_size);
+        if (offset > size)
+        {
+            size = 0;
+            ::close(fd);
+            return false;
+        }
+
+        // Empty files cannot be mapped
+        if (size > 0)
+        {
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                data = nullptr;
+                size = 0;
+                ::close(fd);
+                return false;
+            }
+
+            // The file is read front to back
+            madvise(data, size, MADV_SEQUENTIAL);
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        ::close(fd);
+        this->offset = offset;
+        is_open = true;
+
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (data != nullptr)
+        {
+            munmap(data, size);
+        }
+
+        data = nullptr;
+        size = 0;
+        offset = 0;
+        is_open = false;
+    }
+
+    bool MappedFile::isOpen() const
+    {
+        return is_open;
+    }
+
+    const char* MappedFile::getData() const
+    {
+        if (data == nullptr || offset == size) return nullptr;
+
+        return static_cast<const char*>(data) + offset;
+    }
+
+    uint64_t MappedFile::getSize() const
+    {
+        return size - offset;
+    }
+}
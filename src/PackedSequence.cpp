@@ -0,0 +1,199 @@
+#include <algorithm>
+#include "PackedSequence.hpp"
+
+namespace lsys
+{
+    PackedSequence::PackedSequence(const std::string& alphabet)
+        : alphabet(alphabet)
+        , codes()
+        , length(0)
+    {
+        if (alphabet.size() <= 4) bits_per_symbol = 2;
+        else if (alphabet.size() <= 16) bits_per_symbol = 4;
+        else bits_per_symbol = 8;
+
+        symbols_per_word = 64 / bits_per_symbol;
+
+        for (size_t i = 0; i < alphabet.size(); ++i)
+        {
+            codes[static_cast<unsigned char>(alphabet[i])] = static_cast<uint8_t>(i);
+        }
+    }
+
+    void PackedSequence::push_back(char symbol)
+    {
+        appendBits(getCode(symbol), 1);
+    }
+
+    void PackedSequence::append(const std::string& symbols)
+    {
+        for (char symbol : symbols)
+        {
+            push_back(symbol);
+        }
+    }
+
+    void PackedSequence::append(const PackedSequence& other)
+    {
+        uint64_t remaining = other.length;
+        for (uint64_t word : other.words)
+        {
+            unsigned int count = remaining < symbols_per_word ? static_cast<unsigned int>(remaining) : symbols_per_word;
+            appendBits(word, count);
+            remaining -= count;
+        }
+    }
+
+    void PackedSequence::appendBits(uint64_t bits, unsigned int count)
+    {
+        if (count == 0) return;
+
+        unsigned int used = static_cast<unsigned int>(length % symbols_per_word) * bits_per_symbol;
+        unsigned int size = count * bits_per_symbol;
+
+        if (size < 64)
+        {
+            bits &= (uint64_t(1) << size) - 1;
+        }
+
+        if (used == 0)
+        {
+            words.push_back(bits);
+        }
+        else
+        {
+            words.back() |= bits << used;
+
+            // Spill the codes that do not fit into a new word
+            if (used + size > 64)
+            {
+                words.push_back(bits >> (64 - used));
+            }
+        }
+
+        length += count;
+    }
+
+    char PackedSequence::at(uint64_t index) const
+    {
+        uint64_t word = words[index / symbols_per_word];
+        unsigned int shift = static_cast<unsigned int>(index % symbols_per_word) * bits_per_symbol;
+        uint64_t mask = (uint64_t(1) << bits_per_symbol) - 1;
+
+        return getSymbol(static_cast<uint8_t>((word >> shift) & mask));
+    }
+
+    PackedSequence PackedSequence::rewrite(const std::vector<PackedSequence>& productions) const
+    {
+        // Productions that fit in a single word are appended with a single shift
+        struct ShortProduction
+        {
+            uint64_t bits;
+            unsigned int count;
+            bool is_short;
+        };
+
+        std::vector<ShortProduction> short_productions(productions.size());
+        uint64_t expanded_length = 0;
+        std::vector<uint64_t> histogram(productions.size(), 0);
+
+        for (size_t i = 0; i < productions.size(); ++i)
+        {
+            const PackedSequence& production = productions[i];
+            bool is_short = production.length <= symbols_per_word;
+            short_productions[i] = {is_short && production.length > 0 ? production.words[0] : 0,
+                                    static_cast<unsigned int>(production.length), is_short};
+        }
+
+        // Size the output up front
+        forEachCode([&](uint8_t code)
+        {
+            ++histogram[code];
+        });
+        for (size_t i = 0; i < productions.size(); ++i)
+        {
+            expanded_length += histogram[i] * productions[i].length;
+        }
+
+        PackedSequence result(alphabet);
+        result.words.reserve((expanded_length + symbols_per_word - 1) / symbols_per_word);
+
+        forEachCode([&](uint8_t code)
+        {
+            const ShortProduction& production = short_productions[code];
+            if (production.is_short)
+            {
+                result.appendBits(production.bits, production.count);
+            }
+            else
+            {
+                result.append(productions[code]);
+            }
+        });
+
+        return result;
+    }
+
+    std::string PackedSequence::toString() const
+    {
+        std::string result;
+        result.reserve(length);
+
+        forEachCode([&](uint8_t code)
+        {
+            result.push_back(getSymbol(code));
+        });
+
+        return result;
+    }
+
+    void PackedSequence::clear()
+    {
+        words.clear();
+        length = 0;
+    }
+
+    std::string PackedSequence::makeAlphabet(const std::string& symbols)
+    {
+        std::string alphabet = symbols;
+        std::sort(alphabet.begin(), alphabet.end());
+        alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+        return alphabet;
+    }
+
+    const std::string& PackedSequence::getAlphabet() const
+    {
+        return alphabet;
+    }
+
+    uint8_t PackedSequence::getCode(char symbol) const
+    {
+        return codes[static_cast<unsigned char>(symbol)];
+    }
+
+    char PackedSequence::getSymbol(uint8_t code) const
+    {
+        return alphabet[code];
+    }
+
+    unsigned int PackedSequence::getBitsPerSymbol() const
+    {
+        return bits_per_symbol;
+    }
+
+    uint64_t PackedSequence::size() const
+    {
+        return length;
+    }
+
+    size_t PackedSequence::getPackedSize() const
+    {
+        return words.size() * sizeof(uint64_t);
+    }
+
+    const std::vector<uint64_t>& PackedSequence::getWords() const
+    {
+        return words;
+    }
+}
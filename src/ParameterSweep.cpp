@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "ParameterSweep.hpp"
+#include "Trace.hpp"
+
+namespace lsys
+{
+    SweepVariant::SweepVariant()
+    {
+        distances.fill(0);
+        degrees.fill(0);
+    }
+
+    void SweepVariant::setDistance(char symbol, float distance)
+    {
+        distances[static_cast<unsigned char>(symbol)] = distance;
+    }
+
+    void SweepVariant::setDegrees(char symbol, int degrees)
+    {
+        this->degrees[static_cast<unsigned char>(symbol)] = degrees;
+    }
+
+    float SweepVariant::getDistance(char symbol) const
+    {
+        return distances[static_cast<unsigned char>(symbol)];
+    }
+
+    int SweepVariant::getDegrees(char symbol) const
+    {
+        return degrees[static_cast<unsigned char>(symbol)];
+    }
+
+    ParameterSweep::ParameterSweep(const Lsystem& lsystem)
+        : lsystem(lsystem)
+    {
+        types.fill(TurtleCommandType::Custom);
+
+        for (const auto& symbol : lsystem.getSymbols())
+        {
+            if (symbol.second == nullptr) continue;
+
+            TurtleCommandType type = symbol.second->getType();
+            types[static_cast<unsigned char>(symbol.first)] = type;
+
+            if (type == TurtleCommandType::MoveForward)
+            {
+                default_variant.setDistance(symbol.first,
+                                            static_cast<const MoveForwardCommand&>(*symbol.second).distance);
+            }
+            else if (type == TurtleCommandType::Turn)
+            {
+                default_variant.setDegrees(symbol.first, static_cast<const TurnCommand&>(*symbol.second).degrees);
+            }
+        }
+    }
+
+    SweepVariant ParameterSweep::getDefaultVariant() const
+    {
+        return default_variant;
+    }
+
+    void ParameterSweep::addVariant(const SweepVariant& variant)
+    {
+        variants.push_back(variant);
+    }
+
+    void ParameterSweep::clearVariants()
+    {
+        variants.clear();
+    }
+
+    bool ParameterSweep::draw(const Transform2d& start, const std::vector<Canvas*>& canvases,
+                              unsigned int threads) const
+    {
+        LSYS_TRACE_SCOPE("ParameterSweep::draw");
+
+        if (canvases.size() != variants.size()) return false;
+        if (std::find(canvases.begin(), canvases.end(), nullptr) != canvases.end()) return false;
+
+        // Every variant reads the same evaluated axiom
+        const char* symbols;
+        uint64_t count;
+        if (lsystem.getMappedAxiom().isOpen())
+        {
+            symbols = lsystem.getMappedAxiom().getData();
+            count = lsystem.getMappedAxiom().getSize();
+        }
+        else
+        {
+            symbols = lsystem.getEvaluatedAxiom().data();
+            count = lsystem.getEvaluatedAxiom().size();
+        }
+        if (count == 0) return false;
+
+        // The threads take the next variant until every variant is drawn
+        std::atomic<size_t> next_variant(0);
+        std::atomic<bool> all_fit(true);
+        auto drawVariants = [&]()
+        {
+            for (size_t i = next_variant++; i < variants.size(); i = next_variant++)
+            {
+                LSYS_TRACE_SCOPE("ParameterSweep::drawVariant");
+
+                Canvas& canvas = *canvases[i];
+
+                // Do a dry run to estimate canvas bounds, unless they are fixed
+                if (!canvas.hasViewport())
+                {
+                    canvas.setAllowDrawing(false);
+                    interpret(symbols, count, variants[i], start, canvas);
+                    canvas.setAllowDrawing(true);
+                }
+
+                canvas.allocatePixels();
+
+                // Without a viewport pixels are not clipped, so a drawing larger than its canvas is not drawn
+                if (!canvas.hasViewport())
+                {
+                    const Bounds2d& bounds = canvas.getBounds();
+                    Point2d low = canvas.getPixelPosition({bounds.min_x, bounds.min_y});
+                    Point2d high = canvas.getPixelPosition({bounds.max_x, bounds.max_y});
+                    if (low.x < 0 || low.y < 0 || high.x >= canvas.getWidth() || high.y >= canvas.getHeight())
+                    {
+                        all_fit = false;
+                        continue;
+                    }
+                }
+
+                interpret(symbols, count, variants[i], start, canvas);
+            }
+        };
+
+        threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(variants.size())));
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < threads; ++i)
+        {
+            workers.emplace_back(drawVariants);
+        }
+        drawVariants();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        return all_fit;
+    }
+
+    void ParameterSweep::interpret(const char* symbols, uint64_t count, const SweepVariant& variant,
+                                   const Transform2d& start, Canvas& canvas) const
+    {
+        Transform2d transform = start;
+        std::vector<Transform2d> stack;
+
+        // Executes the commands the same way their execute functions do
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            char symbol = symbols[i];
+            switch (types[static_cast<unsigned char>(symbol)])
+            {
+                case TurtleCommandType::MoveForward:
+                    transform.position = canvas.drawLine(transform.position, variant.getDistance(symbol),
+                                                         transform.rotation);
+                    break;
+                case TurtleCommandType::Turn:
+                    transform.rotation = ((transform.rotation + variant.getDegrees(symbol)) % 360 + 360) % 360;
+                    break;
+                case TurtleCommandType::PushState:
+                    stack.push_back(transform);
+                    break;
+                case TurtleCommandType::PopState:
+                    if (stack.empty()) break;
+                    transform = stack.back();
+                    stack.pop_back();
+                    break;
+                case TurtleCommandType::PenUp:
+                    canvas.penUp();
+                    break;
+                case TurtleCommandType::PenDown:
+                    canvas.penDown();
+                    break;
+                case TurtleCommandType::Custom:
+                    break;
+            }
+        }
+    }
+
+    const std::vector<SweepVariant>& ParameterSweep::getVariants() const
+    {
+        return variants;
+    }
+}
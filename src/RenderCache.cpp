@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include "RenderCache.hpp"
+
+namespace lsys::io
+{
+    /**
+     * Suffix of the files holding cached outputs.
+     */
+    const std::string entry_suffix = ".render";
+
+    /**
+     * Suffix of the files holding the specification of a cached output.
+     */
+    const std::string spec_suffix = ".spec";
+
+    /**
+     * A cached output in the cache directory.
+     */
+    struct CacheEntry
+    {
+        std::string path;
+        uint64_t size;
+        int64_t last_use; // Nanoseconds
+    };
+
+    /**
+     * List the cached outputs of a directory.
+     *
+     * @param directory Path to the directory
+     *
+     * @return The cached outputs
+     */
+    std::vector<CacheEntry> listEntries(const std::string& directory)
+    {
+        std::vector<CacheEntry> entries;
+
+        DIR* dir = opendir(directory.c_str());
+        if (dir == nullptr) return entries;
+
+        while (dirent* item = readdir(dir))
+        {
+            std::string name = item->d_name;
+            if (name.size() <= entry_suffix.size()
+                || name.compare(name.size() - entry_suffix.size(), entry_suffix.size(), entry_suffix) != 0) continue;
+
+            std::string path = directory + "/" + name;
+            struct stat entry_stat;
+            if (stat(path.c_str(), &entry_stat) != 0) continue;
+
+            int64_t last_use = static_cast<int64_t>(entry_stat.st_mtim.tv_sec) * 1000000000 + entry_stat.st_mtim.tv_nsec;
+            entries.push_back({path, static_cast<uint64_t>(entry_stat.st_size), last_use});
+        }
+
+        closedir(dir);
+        return entries;
+    }
+
+    RenderSpec RenderSpec::describe(const Lsystem& lsystem, unsigned int depth, const Turtle& turtle,
+                                    uint32_t output_format)
+    {
+        const Canvas& canvas = turtle.getCanvas();
+        const Transform2d& start = turtle.getInitialTransform();
+
+        RenderSpec spec;
+        spec.grammar_hash = lsystem.getGrammarHash();
+        spec.depth = depth;
+        spec.output_format = output_format;
+        spec.width = canvas.getWidth();
+        spec.height = canvas.getHeight();
+        spec.pixel_format = static_cast<uint8_t>(canvas.getPixelFormat());
+        spec.start_x = start.position.x;
+        spec.start_y = start.position.y;
+        spec.start_rotation = start.rotation;
+        spec.has_viewport = canvas.hasViewport();
+        spec.optimize_commands = lsystem.getOptimizeCommands();
+        spec.merge_moves = lsystem.getOptimizeCommands() && lsystem.getMergeMoves();
+        spec.lattice_enabled = turtle.getLatticeEnabled();
+        spec.pen_down = canvas.isPenDown();
+        spec.bounds = canvas.getBounds();
+
+        for (const auto& symbol : lsystem.getSymbols())
+        {
+            if (symbol.second != nullptr && symbol.second->getType() == TurtleCommandType::Custom)
+            {
+                spec.has_custom_commands = 1;
+            }
+        }
+
+        return spec;
+    }
+
+    bool RenderSpec::isCacheable() const
+    {
+        return !has_custom_commands || custom_key != 0;
+    }
+
+    uint64_t RenderSpec::getHash() const
+    {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(this);
+        for (size_t i = 0; i < sizeof(RenderSpec); ++i)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001b3;
+        }
+
+        return hash;
+    }
+
+    RenderCache::RenderCache(const std::string& directory, uint64_t max_bytes)
+        : directory(directory)
+        , max_bytes(max_bytes)
+        , total_bytes(0)
+    {
+        mkdir(directory.c_str(), 0755);
+
+        for (const auto& entry : listEntries(directory))
+        {
+            total_bytes += entry.size;
+        }
+    }
+
+    std::string RenderCache::find(const RenderSpec& spec)
+    {
+        std::string path = getEntryPath(spec);
+
+        // Only serve the output if it was stored for the same specification, not just one with the same hash
+        RenderSpec stored;
+        std::ifstream spec_file;
+        spec_file.open(getSpecPath(path), std::ios::binary);
+        spec_file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+
+        bool matches = spec.isCacheable() && spec_file.gcount() == sizeof(stored)
+                       && std::memcmp(&stored, &spec, sizeof(stored)) == 0;
+
+        // Mark the output as used now
+        if (!matches || utime(path.c_str(), nullptr) != 0)
+        {
+            ++stats.misses;
+            return "";
+        }
+
+        ++stats.hits;
+        return path;
+    }
+
+    bool RenderCache::store(const RenderSpec& spec, const std::string& filename)
+    {
+        if (!spec.isCacheable()) return false;
+
+        struct stat source_stat;
+        if (stat(filename.c_str(), &source_stat) != 0) return false;
+
+        uint64_t size = static_cast<uint64_t>(source_stat.st_size);
+        if (size > max_bytes) return false;
+
+        std::string path = getEntryPath(spec);
+
+        // Write the specification first, so an output is never found with the specification of another one
+        std::string spec_path = getSpecPath(path);
+        std::string spec_temporary = spec_path + ".tmp";
+        std::ofstream spec_file;
+        spec_file.open(spec_temporary, std::ios::trunc | std::ios::binary);
+        spec_file.write(reinterpret_cast<const char*>(&spec), sizeof(spec));
+        spec_file.close();
+
+        if (!spec_file || std::rename(spec_temporary.c_str(), spec_path.c_str()) != 0)
+        {
+            std::remove(spec_temporary.c_str());
+            return false;
+        }
+
+        // Copy under a temporary name and rename, so readers never see a partial output
+        std::string temporary = path + ".tmp";
+        if (!copyFile(filename, temporary))
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+        struct stat old_stat;
+        if (stat(path.c_str(), &old_stat) == 0)
+        {
+            total_bytes -= std::min(total_bytes, static_cast<uint64_t>(old_stat.st_size));
+        }
+
+        if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+        total_bytes += size;
+        ++stats.stores;
+
+        if (total_bytes > max_bytes) evict();
+
+        return true;
+    }
+
+    void RenderCache::evict()
+    {
+        std::vector<CacheEntry> entries = listEntries(directory);
+        std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b)
+        {
+            return a.last_use < b.last_use;
+        });
+
+        // Other processes may share the directory, so recount
+        total_bytes = 0;
+        for (const auto& entry : entries)
+        {
+            total_bytes += entry.size;
+        }
+
+        for (const auto& entry : entries)
+        {
+            if (total_bytes <= max_bytes) break;
+            if (std::remove(entry.path.c_str()) != 0) continue;
+            std::remove(getSpecPath(entry.path).c_str());
+
+            total_bytes -= entry.size;
+            ++stats.evictions;
+        }
+    }
+
+    void RenderCache::clear()
+    {
+        for (const auto& entry : listEntries(directory))
+        {
+            std::remove(entry.path.c_str());
+            std::remove(getSpecPath(entry.path).c_str());
+        }
+
+        total_bytes = 0;
+    }
+
+    bool RenderCache::copyFile(const std::string& source, const std::string& destination)
+    {
+        std::ifstream in;
+        in.open(source, std::ios::binary);
+        if (!in) return false;
+
+        std::ofstream out;
+        out.open(destination, std::ios::trunc | std::ios::binary);
+        out << in.rdbuf();
+        out.close();
+
+        return static_cast<bool>(out);
+    }
+
+    std::string RenderCache::getEntryPath(const RenderSpec& spec) const
+    {
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(spec.getHash()));
+
+        return directory + "/" + name + entry_suffix;
+    }
+
+    std::string RenderCache::getSpecPath(const std::string& entry_path)
+    {
+        return entry_path.substr(0, entry_path.size() - entry_suffix.size()) + spec_suffix;
+    }
+
+    const std::string& RenderCache::getDirectory() const
+    {
+        return directory;
+    }
+
+    uint64_t RenderCache::getMaxBytes() const
+    {
+        return max_bytes;
+    }
+
+    uint64_t RenderCache::getTotalBytes() const
+    {
+        return total_bytes;
+    }
+
+    const RenderCacheStats& RenderCache::getStats() const
+    {
+        return stats;
+    }
+}
@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include "RenderJob.hpp"
+#include "Trace.hpp"
+
+namespace lsys
+{
+    RenderJob::RenderJob(const Lsystem& lsystem, const RenderRequest& request, size_t batch_size)
+        : request(request)
+        , pipeline(batch_size)
+        , status(RenderStatus::Running)
+    {
+        this->lsystem.setAxiom(lsystem.getAxiom());
+        this->lsystem.setSymbols(lsystem.getSymbols());
+        this->lsystem.setRules(lsystem.getRules());
+
+        control.setDeadline(request.deadline);
+        pipeline.setControl(&control);
+
+        worker = std::thread(&RenderJob::run, this);
+    }
+
+    RenderJob::~RenderJob()
+    {
+        cancel();
+        worker.join();
+    }
+
+    void RenderJob::cancel()
+    {
+        control.cancel();
+    }
+
+    RenderStatus RenderJob::wait()
+    {
+        std::unique_lock<std::mutex> lock(status_mutex);
+        status_changed.wait(lock, [this]() { return status != RenderStatus::Running; });
+
+        return status;
+    }
+
+    RenderStatus RenderJob::waitFor(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(status_mutex);
+        status_changed.wait_for(lock, timeout, [this]() { return status != RenderStatus::Running; });
+
+        return status;
+    }
+
+    void RenderJob::run()
+    {
+        LSYS_TRACE_SCOPE("RenderJob::run");
+
+        std::unique_ptr<Canvas> drawn;
+        std::string failure;
+        try
+        {
+            drawn.reset(new Canvas({0, 0, 0, 0}, request.width, request.height, request.pixel_format));
+            if (request.has_viewport) drawn->setViewport(request.viewport);
+
+            Turtle turtle(request.start, *drawn);
+            if (request.filename.empty())
+            {
+                pipeline.draw(lsystem, request.depth, turtle);
+            }
+            else if (!pipeline.render(lsystem, request.depth, turtle, request.filename) && !control.isStopped())
+            {
+                failure = "cannot write " + request.filename;
+            }
+        }
+        catch (const std::exception& exception)
+        {
+            failure = exception.what();
+        }
+
+        // Only a completed render keeps its canvas, so a stopped or failed one frees its pixels before reporting
+        bool stopped = control.isStopped();
+        bool failed = !failure.empty();
+        if (stopped || failed)
+        {
+            drawn.reset();
+            if (!request.filename.empty()) std::remove(request.filename.c_str());
+        }
+
+        std::lock_guard<std::mutex> lock(status_mutex);
+        if (failed)
+        {
+            status = RenderStatus::Failed;
+            error = failure;
+        }
+        else if (!stopped)
+        {
+            status = RenderStatus::Completed;
+            canvas = std::move(drawn);
+        }
+        else
+        {
+            status = control.isCancelled() ? RenderStatus::Cancelled : RenderStatus::DeadlineExceeded;
+        }
+        status_changed.notify_all();
+    }
+
+    RenderStatus RenderJob::getStatus() const
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        return status;
+    }
+
+    RenderProgress RenderJob::getProgress() const
+    {
+        return control.getProgress();
+    }
+
+    std::string RenderJob::getError() const
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        return error;
+    }
+
+    const Canvas* RenderJob::getCanvas() const
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        return canvas.get();
+    }
+}
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "BmpImage.hpp"
+#include "RenderPipeline.hpp"
+#include "SpscQueue.hpp"
+#include "Trace.hpp"
+
+namespace lsys
+{
+    /**
+     * Sink gathering the segments of the interpret stage into batches.
+     */
+    class SegmentBatcher : public graphics::SegmentSink
+    {
+    public:
+        SegmentBatcher(SpscQueue<std::vector<Point2d>>& queue, size_t batch_size, RenderPipelineStats& stats)
+            : queue(queue)
+            , batch_size(batch_size)
+            , stats(stats)
+        {
+            batch.reserve(2 * batch_size);
+        }
+
+        void addSegment(Point2d start, Point2d end) override
+        {
+            batch.push_back(start);
+            batch.push_back(end);
+            ++stats.segments;
+
+            if (batch.size() >= 2 * batch_size) flush();
+        }
+
+        /**
+         * Pass the current batch on, if it is not empty.
+         */
+        void flush()
+        {
+            if (batch.empty()) return;
+
+            ++stats.segment_batches;
+            queue.push(std::move(batch));
+
+            batch = std::vector<Point2d>();
+            batch.reserve(2 * batch_size);
+        }
+
+    private:
+        SpscQueue<std::vector<Point2d>>& queue;
+        size_t batch_size;
+        RenderPipelineStats& stats;
+        std::vector<Point2d> batch;
+    };
+
+    RenderControl::RenderControl()
+        : cancelled(false)
+        , stopped(false)
+        , deadline(std::chrono::steady_clock::time_point::max())
+        , symbols_done(0)
+        , symbols_total(0)
+        , segments_done(0)
+        , segments_total(0)
+        , rows_done(0)
+        , rows_total(0)
+    {
+    }
+
+    void RenderControl::cancel()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    void RenderControl::setDeadline(std::chrono::steady_clock::time_point deadline)
+    {
+        this->deadline = deadline;
+    }
+
+    bool RenderControl::shouldStop()
+    {
+        if (stopped.load(std::memory_order_relaxed)) return true;
+
+        if (cancelled.load(std::memory_order_relaxed) ||
+            (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline))
+        {
+            stopped.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+    void RenderControl::start(uint64_t symbols_total, uint64_t segments_total, uint64_t rows_total)
+    {
+        this->symbols_total.store(symbols_total, std::memory_order_relaxed);
+        this->segments_total.store(segments_total, std::memory_order_relaxed);
+        this->rows_total.store(rows_total, std::memory_order_relaxed);
+        symbols_done.store(0, std::memory_order_relaxed);
+        segments_done.store(0, std::memory_order_relaxed);
+        rows_done.store(0, std::memory_order_relaxed);
+    }
+
+    void RenderControl::addSymbols(uint64_t count)
+    {
+        symbols_done.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void RenderControl::addSegments(uint64_t count)
+    {
+        segments_done.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void RenderControl::addRows(uint64_t count)
+    {
+        rows_done.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    RenderProgress RenderControl::getProgress() const
+    {
+        RenderProgress progress;
+        progress.symbols_done = symbols_done.load(std::memory_order_relaxed);
+        progress.symbols_total = symbols_total.load(std::memory_order_relaxed);
+        progress.segments_done = segments_done.load(std::memory_order_relaxed);
+        progress.segments_total = segments_total.load(std::memory_order_relaxed);
+        progress.rows_done = rows_done.load(std::memory_order_relaxed);
+        progress.rows_total = rows_total.load(std::memory_order_relaxed);
+
+        return progress;
+    }
+
+    bool RenderControl::isStopped() const
+    {
+        return stopped.load(std::memory_order_relaxed);
+    }
+
+    bool RenderControl::isCancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+    RenderPipeline::RenderPipeline(size_t batch_size, size_t queue_capacity)
+        : batch_size(batch_size > 0 ? batch_size : 1)
+        , queue_capacity(queue_capacity > 0 ? queue_capacity : 1)
+        , control(nullptr)
+    {
+    }
+
+    bool RenderPipeline::render(const Lsystem& lsystem, unsigned int depth, Turtle& turtle, const std::string& filename)
+    {
+        drawPasses(lsystem, depth, turtle, turtle.getCanvas().getHeight());
+        if (control != nullptr && control->shouldStop()) return false;
+
+        io::BmpImage image(turtle.getCanvas());
+        if (control != nullptr)
+        {
+            image.setRowCallback([this](uint32_t)
+            {
+                control->addRows(1);
+                return !control->shouldStop();
+            });
+        }
+        return image.writeToFile(filename);
+    }
+
+    void RenderPipeline::draw(const Lsystem& lsystem, unsigned int depth, Turtle& turtle)
+    {
+        drawPasses(lsystem, depth, turtle, 0);
+    }
+
+    void RenderPipeline::drawPasses(const Lsystem& lsystem, unsigned int depth, Turtle& turtle, uint64_t rows_total)
+    {
+        stats = RenderPipelineStats();
+        Canvas& canvas = turtle.getCanvas();
+
+        if (control != nullptr)
+        {
+            uint64_t symbols;
+            uint64_t moves;
+            countCommands(lsystem, depth, symbols, moves);
+
+            uint64_t passes = canvas.hasViewport() ? 1 : 2;
+            control->start(symbols * passes, moves * passes, rows_total);
+        }
+
+        // Do a dry run to estimate canvas bounds, unless they are fixed
+        if (!canvas.hasViewport())
+        {
+            canvas.setAllowDrawing(false);
+            runStages(lsystem, depth, turtle);
+            canvas.setAllowDrawing(true);
+
+            stats = RenderPipelineStats();
+            if (control != nullptr && control->shouldStop()) return;
+        }
+
+        canvas.allocatePixels();
+        runStages(lsystem, depth, turtle);
+    }
+
+    void RenderPipeline::countCommands(const Lsystem& lsystem, unsigned int depth, uint64_t& symbols, uint64_t& moves)
+    {
+        std::vector<uint64_t> command_weights(256, 0);
+        std::vector<uint64_t> move_weights(256, 0);
+        for (const auto& symbol : lsystem.getSymbols())
+        {
+            if (symbol.second == nullptr) continue;
+
+            command_weights[static_cast<unsigned char>(symbol.first)] = 1;
+            move_weights[static_cast<unsigned char>(symbol.first)] =
+                symbol.second->getType() == TurtleCommandType::MoveForward ? 1 : 0;
+        }
+
+        symbols = lsystem.countEvaluated(depth, command_weights);
+        moves = lsystem.countEvaluated(depth, move_weights);
+    }
+
+    void RenderPipeline::runStages(const Lsystem& lsystem, unsigned int depth, Turtle& turtle)
+    {
+        SpscQueue<std::vector<char>> symbol_queue(queue_capacity);
+        SpscQueue<std::vector<Point2d>> segment_queue(queue_capacity);
+
+        std::shared_ptr<TurtleCommand> commands[256];
+        for (const auto& symbol : lsystem.getSymbols())
+        {
+            commands[static_cast<unsigned char>(symbol.first)] = symbol.second;
+        }
+
+        // An exception on any stage stops all of them. Each stage drains its input queue and closes its output
+        // queue, so no stage is left waiting, and the exception is rethrown once the threads are joined.
+        std::atomic<bool> failed(false);
+        std::exception_ptr evaluate_exception;
+        std::exception_ptr interpret_exception;
+        std::exception_ptr rasterize_exception;
+        auto shouldStop = [&]()
+        {
+            return failed.load() || (control != nullptr && control->shouldStop());
+        };
+
+        // Evaluate: expand the axiom depth first, only emitting the symbols that have a command
+        std::thread evaluator([&]()
+        {
+            LSYS_TRACE_SCOPE("RenderPipeline::evaluate");
+
+            try
+            {
+                auto productions = lsystem.getProductions();
+                const std::string* production_table[256] = {};
+                for (const auto& production : productions)
+                {
+                    production_table[static_cast<unsigned char>(production.first)] = &production.second;
+                }
+
+                struct Frame
+                {
+                    const std::string* text;
+                    size_t index;
+                    unsigned int level;
+                };
+
+                std::vector<Frame> frames = {{&lsystem.getAxiom(), 0, 0}};
+                std::vector<char> batch;
+                batch.reserve(batch_size);
+
+                // Symbols without a command are not batched, so the control is also checked every batch_size steps
+                size_t steps = 0;
+                while (!frames.empty())
+                {
+                    if (++steps == batch_size)
+                    {
+                        steps = 0;
+                        if (shouldStop()) break;
+                    }
+
+                    Frame& frame = frames.back();
+                    if (frame.index == frame.text->size())
+                    {
+                        frames.pop_back();
+                        continue;
+                    }
+
+                    auto symbol = static_cast<unsigned char>((*frame.text)[frame.index++]);
+                    if (frame.level < depth && production_table[symbol] != nullptr)
+                    {
+                        frames.push_back({production_table[symbol], 0, frame.level + 1});
+                        continue;
+                    }
+                    if (commands[symbol] == nullptr) continue;
+
+                    batch.push_back(static_cast<char>(symbol));
+                    if (batch.size() == batch_size)
+                    {
+                        if (shouldStop()) break;
+
+                        stats.symbols += batch.size();
+                        ++stats.symbol_batches;
+                        symbol_queue.push(std::move(batch));
+
+                        batch = std::vector<char>();
+                        batch.reserve(batch_size);
+                    }
+                }
+
+                if (!batch.empty() && !shouldStop())
+                {
+                    stats.symbols += batch.size();
+                    ++stats.symbol_batches;
+                    symbol_queue.push(std::move(batch));
+                }
+            }
+            catch (...)
+            {
+                evaluate_exception = std::current_exception();
+                failed = true;
+            }
+
+            symbol_queue.close();
+        });
+
+        // Interpret: run the symbols through a turtle of its own, so the pen it moves is not the pen of the canvas
+        // the rasterize stage draws on. Lattice runs keep their state stack to themselves, so a push and its pop
+        // could not be in different batches; the floating-point path is used instead
+        std::thread interpreter([&]()
+        {
+            LSYS_TRACE_SCOPE("RenderPipeline::interpret");
+
+            std::vector<char> batch;
+            try
+            {
+                Canvas pen_canvas({0, 0, 0, 0}, 1, 1);
+                Turtle interpreter_turtle(turtle.getInitialTransform(), pen_canvas);
+                interpreter_turtle.setLatticeEnabled(false);
+
+                SegmentBatcher batcher(segment_queue, batch_size, stats);
+                while (symbol_queue.pop(batch))
+                {
+                    // Once stopped, the remaining batches are only drained, so the evaluate stage never waits on a full
+                    // queue
+                    if (shouldStop()) continue;
+
+                    interpreter_turtle.clearCommands();
+                    for (char symbol : batch)
+                    {
+                        interpreter_turtle.addCommand(commands[static_cast<unsigned char>(symbol)]);
+                    }
+                    interpreter_turtle.run(batcher);
+
+                    if (control != nullptr) control->addSymbols(batch.size());
+                }
+
+                if (!shouldStop()) batcher.flush();
+            }
+            catch (...)
+            {
+                interpret_exception = std::current_exception();
+                failed = true;
+
+                while (symbol_queue.pop(batch))
+                {
+                }
+            }
+
+            segment_queue.close();
+        });
+
+        // Rasterize on the calling thread
+        LSYS_TRACE_SCOPE("RenderPipeline::rasterize");
+        Canvas& canvas = turtle.getCanvas();
+        bool was_pen_down = canvas.isPenDown();
+        canvas.penDown();
+
+        std::vector<Point2d> segments;
+        try
+        {
+            while (segment_queue.pop(segments))
+            {
+                if (shouldStop()) continue;
+
+                for (size_t i = 0; i + 1 < segments.size(); i += 2)
+                {
+                    canvas.drawLine(segments[i], segments[i + 1]);
+                }
+
+                if (control != nullptr) control->addSegments(segments.size() / 2);
+            }
+        }
+        catch (...)
+        {
+            rasterize_exception = std::current_exception();
+            failed = true;
+
+            while (segment_queue.pop(segments))
+            {
+            }
+        }
+
+        if (!was_pen_down) canvas.penUp();
+
+        evaluator.join();
+        interpreter.join();
+
+        for (const auto& exception : {evaluate_exception, interpret_exception, rasterize_exception})
+        {
+            if (exception) std::rethrow_exception(exception);
+        }
+    }
+
+    const RenderPipelineStats& RenderPipeline::getStats() const
+    {
+        return stats;
+    }
+
+    RenderControl* RenderPipeline::getControl() const
+    {
+        return control;
+    }
+
+    void RenderPipeline::setControl(RenderControl* control)
+    {
+        this->control = control;
+    }
+}
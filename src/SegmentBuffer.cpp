@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+#include "SegmentBuffer.hpp"
+
+namespace lsys::graphics
+{
+    SegmentBuffer::SegmentBuffer(size_t capacity, Consumer consumer)
+        : capacity(std::max<size_t>(capacity, 1))
+        , consumer(std::move(consumer))
+        , depth(0)
+    {
+        start_x.reserve(this->capacity);
+        start_y.reserve(this->capacity);
+        end_x.reserve(this->capacity);
+        end_y.reserve(this->capacity);
+        depths.reserve(this->capacity);
+    }
+
+    void SegmentBuffer::addSegment(Point2d start, Point2d end)
+    {
+        start_x.push_back(start.x);
+        start_y.push_back(start.y);
+        end_x.push_back(end.x);
+        end_y.push_back(end.y);
+        depths.push_back(depth);
+
+        if (consumer && start_x.size() >= capacity) flush();
+    }
+
+    void SegmentBuffer::pushState()
+    {
+        ++depth;
+    }
+
+    void SegmentBuffer::popState()
+    {
+        if (depth > 0) --depth;
+    }
+
+    void SegmentBuffer::flush()
+    {
+        if (!consumer || empty()) return;
+
+        consumer(*this);
+        clear();
+    }
+
+    void SegmentBuffer::clear()
+    {
+        start_x.clear();
+        start_y.clear();
+        end_x.clear();
+        end_y.clear();
+        depths.clear();
+    }
+
+    Bounds2d SegmentBuffer::getBounds() const
+    {
+        if (empty()) return {0, 0, 0, 0};
+
+        // Separate loops per array, so each one is a simple min/max reduction
+        Bounds2d bounds = {start_x[0], start_y[0], start_x[0], start_y[0]};
+        for (const auto* xs : {&start_x, &end_x})
+        {
+            for (float x : *xs)
+            {
+                bounds.min_x = std::min(bounds.min_x, x);
+                bounds.max_x = std::max(bounds.max_x, x);
+            }
+        }
+        for (const auto* ys : {&start_y, &end_y})
+        {
+            for (float y : *ys)
+            {
+                bounds.min_y = std::min(bounds.min_y, y);
+                bounds.max_y = std::max(bounds.max_y, y);
+            }
+        }
+
+        return bounds;
+    }
+
+    double SegmentBuffer::getTotalLength() const
+    {
+        double total = 0;
+        for (size_t i = 0; i < size(); ++i)
+        {
+            float dx = end_x[i] - start_x[i];
+            float dy = end_y[i] - start_y[i];
+            total += std::sqrt(dx * dx + dy * dy);
+        }
+
+        return total;
+    }
+
+    void SegmentBuffer::transform(float scale_x, float scale_y, float offset_x, float offset_y)
+    {
+        for (auto* xs : {&start_x, &end_x})
+        {
+            for (float& x : *xs)
+            {
+                x = x * scale_x + offset_x;
+            }
+        }
+        for (auto* ys : {&start_y, &end_y})
+        {
+            for (float& y : *ys)
+            {
+                y = y * scale_y + offset_y;
+            }
+        }
+    }
+
+    void SegmentBuffer::appendTransformed(const SegmentBuffer& source, float rotation, float scale, Point2d offset)
+    {
+        if (&source == this) return;
+
+        float radians = rotation * M_PI / 180.0;
+        float cos_scaled = std::cos(radians) * scale;
+        float sin_scaled = std::sin(radians) * scale;
+
+        size_t copied = 0;
+        while (copied < source.size())
+        {
+            size_t first = size();
+            size_t count = source.size() - copied;
+            if (consumer) count = std::min(count, capacity > first ? capacity - first : 1);
+
+            start_x.resize(first + count);
+            start_y.resize(first + count);
+            end_x.resize(first + count);
+            end_y.resize(first + count);
+            depths.insert(depths.end(), source.depths.begin() + copied, source.depths.begin() + copied + count);
+
+            // One plain loop per output array, over the arrays of the source
+            const float* x[2] = {source.start_x.data() + copied, source.end_x.data() + copied};
+            const float* y[2] = {source.start_y.data() + copied, source.end_y.data() + copied};
+            float* out_x[2] = {start_x.data() + first, end_x.data() + first};
+            float* out_y[2] = {start_y.data() + first, end_y.data() + first};
+            for (int point = 0; point < 2; ++point)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    out_x[point][i] = x[point][i] * cos_scaled - y[point][i] * sin_scaled + offset.x;
+                }
+                for (size_t i = 0; i < count; ++i)
+                {
+                    out_y[point][i] = x[point][i] * sin_scaled + y[point][i] * cos_scaled + offset.y;
+                }
+            }
+
+            copied += count;
+            if (consumer && size() >= capacity) flush();
+        }
+    }
+
+    void SegmentBuffer::forwardTo(SegmentSink& sink) const
+    {
+        for (size_t i = 0; i < size(); ++i)
+        {
+            sink.addSegment(Point2d(start_x[i], start_y[i]), Point2d(end_x[i], end_y[i]));
+        }
+    }
+
+    size_t SegmentBuffer::size() const
+    {
+        return start_x.size();
+    }
+
+    bool SegmentBuffer::empty() const
+    {
+        return start_x.empty();
+    }
+
+    size_t SegmentBuffer::getCapacity() const
+    {
+        return capacity;
+    }
+
+    const float* SegmentBuffer::getStartX() const
+    {
+        return start_x.data();
+    }
+
+    const float* SegmentBuffer::getStartY() const
+    {
+        return start_y.data();
+    }
+
+    const float* SegmentBuffer::getEndX() const
+    {
+        return end_x.data();
+    }
+
+    const float* SegmentBuffer::getEndY() const
+    {
+        return end_y.data();
+    }
+
+    const uint32_t* SegmentBuffer::getDepths() const
+    {
+        return depths.data();
+    }
+}
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cmath>
+#include "StampCache.hpp"
+
+namespace lsys
+{
+    bool RasterStamp::isExactAt(double x, double y) const
+    {
+        return x >= min_x && x < max_x && y >= min_y && y < max_y;
+    }
+
+    bool RasterStamp::fitsAt(Pixelxy start_pixel, unsigned short width, unsigned short height) const
+    {
+        return start_pixel.x + min_offset.x >= 0 && start_pixel.y + min_offset.y >= 0
+               && start_pixel.x + max_offset.x < width && start_pixel.y + max_offset.y < height;
+    }
+
+    StampCache::StampCache(unsigned int subpixel_buckets, uint64_t min_moves, uint64_t max_moves, size_t max_pixels)
+        : subpixel_buckets(std::max(1u, std::min(subpixel_buckets, 256u)))
+        , min_moves(min_moves)
+        , max_moves(max_moves)
+        , max_pixels(max_pixels)
+    {
+    }
+
+    bool StampCache::isCacheable(unsigned int depth, uint64_t moves) const
+    {
+        return depth <= max_depth && moves >= min_moves && moves <= max_moves;
+    }
+
+    bool StampCache::isFull() const
+    {
+        return stats.stored_pixels >= max_pixels;
+    }
+
+    const RasterStamp* StampCache::find(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel) const
+    {
+        auto stamp = stamps.find(makeKey(symbol, depth, rotation, subpixel));
+        if (stamp == stamps.end()) return nullptr;
+
+        return &stamp->second;
+    }
+
+    bool StampCache::shouldRecord(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel)
+    {
+        if (isFull()) return false;
+
+        // Insertion fails if the key was seen before
+        return !seen.insert(makeKey(symbol, depth, rotation, subpixel)).second;
+    }
+
+    void StampCache::record(char symbol, unsigned int depth, Point2d start_position, int start_rotation,
+                            Point2d end_position, int end_rotation, const std::vector<Point2d>& lines, const Canvas& canvas)
+    {
+        Point2d start = canvas.getPixelPosition(start_position);
+        Pixelxy start_pixel = canvas.getPixelFromPoint(start_position);
+        Vec2<double> subpixel(start.x - std::floor(start.x), start.y - std::floor(start.y));
+
+        RasterStamp stamp;
+        stamp.end_offset = Point2d(end_position.x - start_position.x, end_position.y - start_position.y);
+        stamp.end_rotation = end_rotation;
+
+        // Restrict the validity range so that every vertex stays on the same pixel relative to the start pixel
+        bool inside = start.x >= 0 && start.y >= 0 && start.x < canvas.getWidth() && start.y < canvas.getHeight();
+        for (const auto& point : lines)
+        {
+            Point2d vertex = canvas.getPixelPosition(point);
+            inside = inside && vertex.x >= 0 && vertex.y >= 0 && vertex.x < canvas.getWidth()
+                     && vertex.y < canvas.getHeight();
+
+            double relative_x = static_cast<double>(vertex.x) - start.x;
+            double pixel_x = std::floor(vertex.x) - std::floor(start.x);
+            stamp.min_x = std::max(stamp.min_x, pixel_x - relative_x);
+            stamp.max_x = std::min(stamp.max_x, pixel_x + 1 - relative_x);
+
+            double relative_y = static_cast<double>(vertex.y) - start.y;
+            double pixel_y = std::floor(vertex.y) - std::floor(start.y);
+            stamp.min_y = std::max(stamp.min_y, pixel_y - relative_y);
+            stamp.max_y = std::min(stamp.max_y, pixel_y + 1 - relative_y);
+        }
+
+        // Lines crossing the edge of the canvas were clipped, so the stamp would not match them anywhere
+        if (!inside)
+        {
+            stamp.min_x = 1;
+            stamp.max_x = 0;
+        }
+
+        // Only keep the pixels if the stamp can ever be used
+        if (stamp.isExactAt(subpixel.x, subpixel.y))
+        {
+            std::vector<int64_t> packed;
+            for (size_t i = 0; i + 1 < lines.size(); i += 2)
+            {
+                Canvas::traceLine(canvas.getPixelFromPoint(lines[i]), canvas.getPixelFromPoint(lines[i + 1]), [&](int x, int y)
+                {
+                    packed.push_back((static_cast<int64_t>(y - start_pixel.y) << 32)
+                                     | static_cast<uint32_t>(x - start_pixel.x));
+                });
+            }
+
+            // Overlapping pixels are only stored once, in row order
+            std::sort(packed.begin(), packed.end());
+            packed.erase(std::unique(packed.begin(), packed.end()), packed.end());
+
+            stamp.offsets.reserve(packed.size());
+            for (int64_t offset : packed)
+            {
+                stamp.offsets.emplace_back(static_cast<int32_t>(offset & 0xFFFFFFFF), static_cast<int>(offset >> 32));
+
+                const Vec2<int>& added = stamp.offsets.back();
+                if (stamp.offsets.size() == 1)
+                {
+                    stamp.min_offset = added;
+                    stamp.max_offset = added;
+                    continue;
+                }
+                stamp.min_offset.x = std::min(stamp.min_offset.x, added.x);
+                stamp.min_offset.y = std::min(stamp.min_offset.y, added.y);
+                stamp.max_offset.x = std::max(stamp.max_offset.x, added.x);
+                stamp.max_offset.y = std::max(stamp.max_offset.y, added.y);
+            }
+        }
+
+        stats.stored_pixels += stamp.offsets.size();
+        ++stats.stamps;
+        stamps[makeKey(symbol, depth, start_rotation, subpixel)] = std::move(stamp);
+    }
+
+    void StampCache::clear()
+    {
+        stamps.clear();
+        seen.clear();
+        stats.stamps = 0;
+        stats.stored_pixels = 0;
+    }
+
+    uint64_t StampCache::makeKey(char symbol, unsigned int depth, int rotation, Vec2<double> subpixel) const
+    {
+        auto bucket_x = std::min(static_cast<unsigned int>(subpixel.x * subpixel_buckets), subpixel_buckets - 1);
+        auto bucket_y = std::min(static_cast<unsigned int>(subpixel.y * subpixel_buckets), subpixel_buckets - 1);
+        auto heading = static_cast<uint64_t>((rotation % 360 + 360) % 360);
+
+        // 8 bits of symbol, 9 of heading, 8 per bucket and the remaining 31 of depth
+        return static_cast<uint64_t>(static_cast<unsigned char>(symbol))
+               | (heading << 8)
+               | (static_cast<uint64_t>(bucket_x) << 17)
+               | (static_cast<uint64_t>(bucket_y) << 25)
+               | (static_cast<uint64_t>(depth & max_depth) << 33);
+    }
+
+    const StampCacheStats& StampCache::getStats() const
+    {
+        return stats;
+    }
+
+    StampCacheStats& StampCache::getStats()
+    {
+        return stats;
+    }
+}
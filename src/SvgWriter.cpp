@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "SvgWriter.hpp"
+
+namespace lsys::io
+{
+    using graphics::Point2d;
+
+    // Size of the write buffer
+    constexpr size_t svg_buffer_size = 1 << 16;
+
+    // Largest number of decimals written for a coordinate; floats do not have more significant digits
+    constexpr unsigned int svg_max_precision = 12;
+
+    /**
+     * Get the longest text of a float written with "%.*f": a sign, 39 integer digits, a point and the decimals.
+     */
+    constexpr size_t getNumberSize(unsigned int precision)
+    {
+        return 41 + precision;
+    }
+
+    // Tolerance when testing if two directions are parallel (sine of the angle between them)
+    constexpr float svg_collinear_tolerance = 1e-5f;
+
+    SvgWriter::SvgWriter(const std::string& filename, float stroke_width, unsigned int precision)
+        : buffer(svg_buffer_size)
+        , buffer_used(0)
+        , view_box_offset(0)
+        , view_box_size(0)
+        , precision(std::min(precision, svg_max_precision))
+        , path_open(false)
+        , path_end(0, 0)
+        , path_direction(0, 0)
+        , bounds({0, 0, 0, 0})
+        , has_bounds(false)
+        , written(false)
+        , total_segments(0)
+        , total_polylines(0)
+        , total_points(0)
+    {
+        file.open(filename, std::ios::trunc | std::ios::binary);
+
+        write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" ");
+
+        // Reserve space for the view box, which is only known after all segments are written: the attribute with
+        // four numbers of the largest size
+        view_box_offset = static_cast<std::streamoff>(buffer_used);
+        view_box_size = std::strlen("viewBox=\"   \"") + 4 * getNumberSize(this->precision);
+        write(std::string(view_box_size, ' '));
+
+        char style[128];
+        std::snprintf(style, sizeof(style),
+                      ">\n<g fill=\"none\" stroke=\"black\" stroke-width=\"%g\" stroke-linecap=\"round\" stroke-linejoin=\"round\">\n",
+                      stroke_width);
+        write(style);
+    }
+
+    SvgWriter::~SvgWriter()
+    {
+        close();
+    }
+
+    void SvgWriter::addSegment(Point2d start, Point2d end)
+    {
+        ++total_segments;
+
+        Point2d direction(end.x - start.x, end.y - start.y);
+
+        // Continue the current path if the segment starts where it ended
+        if (path_open && start.x == path_end.x && start.y == path_end.y)
+        {
+            float cross = path_direction.x * direction.y - path_direction.y * direction.x;
+            float dot = path_direction.x * direction.x + path_direction.y * direction.y;
+            float norms = std::hypot(path_direction.x, path_direction.y) * std::hypot(direction.x, direction.y);
+
+            // Collinear with the last run, so just move its end
+            if (dot > 0 && std::fabs(cross) <= svg_collinear_tolerance * norms)
+            {
+                path_end = end;
+                updateBounds(end);
+                return;
+            }
+
+            writePoint(path_end);
+        }
+        else
+        {
+            endPath();
+
+            write("<polyline points=\"");
+            path_open = true;
+            ++total_polylines;
+
+            writePoint(start);
+            updateBounds(start);
+        }
+
+        path_end = end;
+        path_direction = direction;
+        updateBounds(end);
+    }
+
+    void SvgWriter::pushState()
+    {
+        endPath();
+    }
+
+    void SvgWriter::popState()
+    {
+        endPath();
+    }
+
+    void SvgWriter::penUp()
+    {
+        endPath();
+    }
+
+    void SvgWriter::penDown()
+    {
+        endPath();
+    }
+
+    bool SvgWriter::close()
+    {
+        if (!file.is_open()) return written;
+
+        endPath();
+        write("</g>\n</svg>\n");
+        flushBuffer();
+
+        // Patch the view box in the reserved space. The y axis of SVG points down, so it is flipped.
+        int digits = static_cast<int>(precision);
+        std::vector<char> view_box(view_box_size + 1);
+        std::snprintf(view_box.data(), view_box.size(), "viewBox=\"%.*f %.*f %.*f %.*f\"",
+                      digits, bounds.min_x, digits, -bounds.max_y,
+                      digits, bounds.max_x - bounds.min_x, digits, bounds.max_y - bounds.min_y);
+
+        file.seekp(view_box_offset);
+        file.write(view_box.data(), static_cast<std::streamsize>(std::strlen(view_box.data())));
+        file.close();
+
+        written = !file.fail();
+        return written;
+    }
+
+    void SvgWriter::endPath()
+    {
+        if (!path_open) return;
+
+        writePoint(path_end);
+        write("\"/>\n");
+        path_open = false;
+    }
+
+    void SvgWriter::writePoint(Point2d point)
+    {
+        int digits = static_cast<int>(precision);
+        char text[2 * getNumberSize(svg_max_precision) + 3];
+        int size = std::snprintf(text, sizeof(text), "%.*f,%.*f ", digits, point.x, digits, -point.y);
+        write(text, static_cast<size_t>(size));
+        ++total_points;
+    }
+
+    void SvgWriter::write(const char* data, size_t size)
+    {
+        if (buffer_used + size > buffer.size())
+        {
+            flushBuffer();
+        }
+        if (size > buffer.size())
+        {
+            file.write(data, static_cast<std::streamsize>(size));
+            return;
+        }
+
+        std::memcpy(buffer.data() + buffer_used, data, size);
+        buffer_used += size;
+    }
+
+    void SvgWriter::write(const std::string& data)
+    {
+        write(data.data(), data.size());
+    }
+
+    void SvgWriter::flushBuffer()
+    {
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer_used));
+        buffer_used = 0;
+    }
+
+    void SvgWriter::updateBounds(Point2d point)
+    {
+        if (!has_bounds)
+        {
+            bounds = {point.x, point.y, point.x, point.y};
+            has_bounds = true;
+            return;
+        }
+
+        bounds.min_x = std::min(bounds.min_x, point.x);
+        bounds.min_y = std::min(bounds.min_y, point.y);
+        bounds.max_x = std::max(bounds.max_x, point.x);
+        bounds.max_y = std::max(bounds.max_y, point.y);
+    }
+
+    //////////////////////////////////////////////////////////////
+
+    size_t SvgWriter::getTotalSegments() const
+    {
+        return total_segments;
+    }
+
+    size_t SvgWriter::getTotalPolylines() const
+    {
+        return total_polylines;
+    }
+
+    size_t SvgWriter::getTotalPoints() const
+    {
+        return total_points;
+    }
+}
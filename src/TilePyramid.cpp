@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <sys/stat.h>
+#include "BmpImage.hpp"
+#include "Canvas.hpp"
+#include "TilePyramid.hpp"
+#include "Trace.hpp"
+
+namespace lsys::io
+{
+    using graphics::Point2d;
+
+    TilePyramid::TilePyramid(const std::string& directory, const graphics::Bounds2d& viewport, unsigned int levels,
+                             unsigned short tile_size, size_t max_buffered_segments)
+        : directory(directory)
+        , viewport(viewport)
+        , levels(std::max(levels, 1u))
+        , base_tiles(1u << (this->levels - 1))
+        , tile_size(static_cast<unsigned short>(std::max(tile_size + (tile_size & 1), 2)))
+        , tile_stride((this->tile_size + 7) / 8 * 8)
+        , bins(base_tiles)
+        , buffered_segments(0)
+        , max_buffered_segments(std::max<size_t>(max_buffered_segments, 1))
+        , spilled(base_tiles, false)
+        , pending_bands(this->levels)
+        , thread_count(std::max(std::thread::hardware_concurrency(), 1u))
+        , closed(false)
+        , total_segments(0)
+        , tiles_written(0)
+    {
+        mkdir(directory.c_str(), 0755);
+        for (unsigned int level = 0; level < this->levels; ++level)
+        {
+            mkdir((directory + "/" + std::to_string(level)).c_str(), 0755);
+        }
+    }
+
+    TilePyramid::~TilePyramid()
+    {
+        close();
+    }
+
+    template<typename Function>
+    void TilePyramid::parallelFor(unsigned int count, Function function) const
+    {
+        unsigned int threads = std::min(thread_count, count);
+        if (threads <= 1)
+        {
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                function(i);
+            }
+            return;
+        }
+
+        // Interleave the indices, since neighbouring tiles tend to have similar costs
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&function, count, threads, t]()
+            {
+                for (unsigned int i = t; i < count; i += threads)
+                {
+                    function(i);
+                }
+            });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void TilePyramid::addSegment(Point2d start, Point2d end)
+    {
+        ++total_segments;
+
+        float min_x = std::min(start.x, end.x);
+        float max_x = std::max(start.x, end.x);
+        float min_y = std::min(start.y, end.y);
+        float max_y = std::max(start.y, end.y);
+        if (max_x < viewport.min_x || min_x > viewport.max_x || max_y < viewport.min_y || min_y > viewport.max_y)
+            return;
+
+        // Rows are counted from the top of the viewport
+        float band_height = (viewport.max_y - viewport.min_y) / (float)base_tiles;
+        auto toRow = [this, band_height](float y)
+        {
+            auto row = static_cast<long>(std::floor((viewport.max_y - y) / band_height));
+            return static_cast<unsigned int>(std::max(0L, std::min(row, (long)base_tiles - 1)));
+        };
+
+        unsigned int last_row = toRow(min_y);
+        for (unsigned int row = toRow(max_y); row <= last_row; ++row)
+        {
+            bins[row].push_back(start);
+            bins[row].push_back(end);
+            ++buffered_segments;
+        }
+
+        if (buffered_segments >= max_buffered_segments) spillBins();
+    }
+
+    void TilePyramid::close()
+    {
+        LSYS_TRACE_SCOPE("TilePyramid::close");
+
+        if (closed) return;
+        closed = true;
+
+        for (unsigned int row = 0; row < base_tiles; ++row)
+        {
+            std::vector<Point2d> segments;
+            segments.swap(bins[row]);
+
+            // Read back the spilled part of the bin
+            if (spilled[row])
+            {
+                std::string path = getSpillPath(row);
+                std::ifstream file(path, std::ios::binary | std::ios::ate);
+                auto size = static_cast<size_t>(file.tellg());
+                file.seekg(0);
+
+                size_t buffered = segments.size();
+                segments.resize(buffered + size / sizeof(Point2d));
+                file.read(reinterpret_cast<char*>(segments.data() + buffered), size / sizeof(Point2d) * sizeof(Point2d));
+
+                file.close();
+                std::remove(path.c_str());
+            }
+
+            finishBand(levels - 1, row, rasterizeBand(row, segments));
+        }
+    }
+
+    void TilePyramid::spillBins()
+    {
+        for (unsigned int row = 0; row < base_tiles; ++row)
+        {
+            if (bins[row].empty()) continue;
+
+            std::ofstream file(getSpillPath(row), std::ios::binary | std::ios::app);
+            file.write(reinterpret_cast<const char*>(bins[row].data()), bins[row].size() * sizeof(Point2d));
+            spilled[row] = true;
+
+            // Release the memory of the bin
+            std::vector<Point2d>().swap(bins[row]);
+        }
+
+        buffered_segments = 0;
+    }
+
+    std::vector<TilePyramid::Tile> TilePyramid::rasterizeBand(unsigned int row,
+                                                              const std::vector<Point2d>& segments) const
+    {
+        std::vector<Tile> tiles(base_tiles);
+        if (segments.empty()) return tiles;
+
+        float tile_width = (viewport.max_x - viewport.min_x) / (float)base_tiles;
+        float tile_height = (viewport.max_y - viewport.min_y) / (float)base_tiles;
+
+        // Bin the segments of the band by column
+        std::vector<std::vector<size_t>> columns(base_tiles);
+        auto toColumn = [this, tile_width](float x)
+        {
+            auto column = static_cast<long>(std::floor((x - viewport.min_x) / tile_width));
+            return static_cast<unsigned int>(std::max(0L, std::min(column, (long)base_tiles - 1)));
+        };
+        for (size_t i = 0; i + 1 < segments.size(); i += 2)
+        {
+            unsigned int first_column = toColumn(std::min(segments[i].x, segments[i + 1].x));
+            unsigned int last_column = toColumn(std::max(segments[i].x, segments[i + 1].x));
+            for (unsigned int column = first_column; column <= last_column; ++column)
+            {
+                columns[column].push_back(i);
+            }
+        }
+
+        parallelFor(base_tiles, [&](unsigned int column)
+        {
+            if (columns[column].empty()) return;
+
+            graphics::Canvas canvas({0, 0, 0, 0}, tile_size, tile_size, graphics::PixelFormat::Gray8);
+            canvas.setViewport({viewport.min_x + (float)column * tile_width,
+                                viewport.max_y - (float)(row + 1) * tile_height,
+                                column + 1 == base_tiles ? viewport.max_x : viewport.min_x + (float)(column + 1) * tile_width,
+                                viewport.max_y - (float)row * tile_height});
+            canvas.allocatePixels();
+
+            for (size_t i : columns[column])
+            {
+                canvas.drawLine(segments[i], segments[i + 1]);
+            }
+
+            const uint8_t* data = canvas.getPixelData();
+            if (std::any_of(data, data + tile_stride * tile_size, [](uint8_t pixel) { return pixel != 0; }))
+            {
+                tiles[column].assign(data, data + tile_stride * tile_size);
+            }
+        });
+
+        return tiles;
+    }
+
+    void TilePyramid::finishBand(unsigned int level, unsigned int row, std::vector<Tile> tiles)
+    {
+        for (unsigned int column = 0; column < tiles.size(); ++column)
+        {
+            if (!tiles[column].empty()) writeTile(level, column, row, tiles[column]);
+        }
+
+        if (level == 0) return;
+
+        if (row % 2 == 0)
+        {
+            pending_bands[level] = std::move(tiles);
+            return;
+        }
+
+        std::vector<Tile> parent = downsample(pending_bands[level], tiles);
+        pending_bands[level].clear();
+
+        finishBand(level - 1, row / 2, std::move(parent));
+    }
+
+    std::vector<TilePyramid::Tile> TilePyramid::downsample(const std::vector<Tile>& top,
+                                                           const std::vector<Tile>& bottom) const
+    {
+        std::vector<Tile> parents(top.size() / 2);
+        unsigned int half = tile_size / 2;
+
+        parallelFor(static_cast<unsigned int>(parents.size()), [&](unsigned int column)
+        {
+            const Tile* children[4] = {&top[2 * column], &top[2 * column + 1],
+                                       &bottom[2 * column], &bottom[2 * column + 1]};
+            if (std::all_of(children, children + 4, [](const Tile* child) { return child->empty(); })) return;
+
+            Tile tile(tile_stride * tile_size, 0);
+            for (unsigned int quadrant = 0; quadrant < 4; ++quadrant)
+            {
+                const Tile& child = *children[quadrant];
+                if (child.empty()) continue;
+
+                uint8_t* out = tile.data() + (quadrant / 2) * half * tile_stride + (quadrant % 2) * half;
+                for (unsigned int y = 0; y < half; ++y)
+                {
+                    const uint8_t* upper = child.data() + 2 * y * tile_stride;
+                    const uint8_t* lower = upper + tile_stride;
+                    for (unsigned int x = 0; x < half; ++x)
+                    {
+                        // Round up, so a drawn pixel never fades out entirely and the tile stays non-empty
+                        unsigned int sum = upper[2 * x] + upper[2 * x + 1] + lower[2 * x] + lower[2 * x + 1];
+                        out[y * tile_stride + x] = static_cast<uint8_t>((sum + 3) / 4);
+                    }
+                }
+            }
+
+            parents[column] = std::move(tile);
+        });
+
+        return parents;
+    }
+
+    void TilePyramid::writeTile(unsigned int level, unsigned int column, unsigned int row, const Tile& tile)
+    {
+        static const std::vector<graphics::RgbColor> grayscale = []()
+        {
+            std::vector<graphics::RgbColor> colors;
+            for (unsigned int i = 0; i < 256; ++i)
+            {
+                colors.emplace_back(i, i, i);
+            }
+            return colors;
+        }();
+
+        BmpImage image;
+        image.setPixelData(tile.data(), tile_stride, tile_size, tile_size, BmpBitsPerPixel::INDEXED8);
+        image.setPalette(grayscale);
+        image.writeToFile(directory + "/" + std::to_string(level) + "/" + std::to_string(column) + "_" +
+                          std::to_string(row) + ".bmp");
+
+        ++tiles_written;
+    }
+
+    std::string TilePyramid::getSpillPath(unsigned int row) const
+    {
+        return directory + "/.band_" + std::to_string(row) + ".segments";
+    }
+
+    unsigned int TilePyramid::getThreadCount() const
+    {
+        return thread_count;
+    }
+
+    void TilePyramid::setThreadCount(unsigned int thread_count)
+    {
+        TilePyramid::thread_count = std::max(thread_count, 1u);
+    }
+
+    unsigned int TilePyramid::getLevels() const
+    {
+        return levels;
+    }
+
+    unsigned short TilePyramid::getTileSize() const
+    {
+        return tile_size;
+    }
+
+    size_t TilePyramid::getTotalSegments() const
+    {
+        return total_segments;
+    }
+
+    size_t TilePyramid::getTilesWritten() const
+    {
+        return tiles_written;
+    }
+}
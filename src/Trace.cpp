@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Trace.hpp"
+
+namespace lsys::trace
+{
+    namespace detail
+    {
+        std::atomic<bool> trace_enabled(false);
+    }
+
+    /**
+     * Ring buffer of the events of one thread. Only the owning thread writes to it.
+     */
+    struct ThreadBuffer
+    {
+        explicit ThreadBuffer(unsigned int thread_index)
+            : events(trace_buffer_size)
+            , count(0)
+            , thread_index(thread_index)
+        {
+        }
+
+        std::vector<TraceEvent> events;
+
+        /**
+         * Number of events ever recorded; the next one goes to count % trace_buffer_size.
+         */
+        std::atomic<uint64_t> count;
+
+        unsigned int thread_index;
+    };
+
+    /**
+     * Buffers of every thread that recorded an event. They are kept after their thread exits, so its events
+     * can still be written, and handed to the next thread that records: memory is bounded by the number of threads
+     * recording at once rather than by the number of threads ever started. Events of threads that shared a buffer
+     * are written as one thread, one after the other.
+     */
+    static std::mutex registry_mutex;
+    static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+    static std::vector<ThreadBuffer*> free_buffers;
+
+    /**
+     * Holds the buffer of a thread, and returns it to the free buffers when the thread exits.
+     */
+    class BufferOwner
+    {
+    public:
+        BufferOwner()
+            : buffer(nullptr)
+        {
+        }
+
+        ~BufferOwner()
+        {
+            if (buffer == nullptr) return;
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            free_buffers.push_back(buffer);
+        }
+
+        BufferOwner(const BufferOwner&) = delete;
+        BufferOwner& operator=(const BufferOwner&) = delete;
+
+        ThreadBuffer* buffer;
+    };
+
+    static ThreadBuffer& getThreadBuffer()
+    {
+        thread_local BufferOwner owner;
+        if (owner.buffer == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            if (!free_buffers.empty())
+            {
+                owner.buffer = free_buffers.back();
+                free_buffers.pop_back();
+            }
+            else
+            {
+                registry.push_back(std::make_shared<ThreadBuffer>(static_cast<unsigned int>(registry.size())));
+                owner.buffer = registry.back().get();
+            }
+        }
+
+        return *owner.buffer;
+    }
+
+    void setEnabled(bool enabled)
+    {
+        detail::trace_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    uint64_t now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end)
+    {
+        ThreadBuffer& buffer = getThreadBuffer();
+
+        uint64_t count = buffer.count.load(std::memory_order_relaxed);
+        buffer.events[count % trace_buffer_size] = {name, start, end};
+        buffer.count.store(count + 1, std::memory_order_release);
+    }
+
+    bool writeChromeTrace(const std::string& filename)
+    {
+        std::ofstream file(filename, std::ios::trunc);
+        if (!file) return false;
+
+        std::lock_guard<std::mutex> lock(registry_mutex);
+
+        // Times are relative to the earliest event, in microseconds
+        uint64_t origin = UINT64_MAX;
+        for (const auto& buffer : registry)
+        {
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            for (uint64_t i = count > trace_buffer_size ? count - trace_buffer_size : 0; i < count; ++i)
+            {
+                origin = std::min(origin, buffer->events[i % trace_buffer_size].start);
+            }
+        }
+
+        file << "{\"traceEvents\":[";
+        bool first = true;
+        char line[256];
+        for (const auto& buffer : registry)
+        {
+            std::snprintf(line, sizeof(line),
+                          "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                          first ? "" : ",", buffer->thread_index, buffer->thread_index);
+            file << line;
+            first = false;
+
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            for (uint64_t i = count > trace_buffer_size ? count - trace_buffer_size : 0; i < count; ++i)
+            {
+                const TraceEvent& event = buffer->events[i % trace_buffer_size];
+                std::snprintf(line, sizeof(line),
+                              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                              event.name, buffer->thread_index, (event.start - origin) / 1000.0,
+                              (event.end - event.start) / 1000.0);
+                file << line;
+            }
+        }
+        file << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+        return static_cast<bool>(file);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto& buffer : registry)
+        {
+            buffer->count.store(0, std::memory_order_release);
+        }
+    }
+}
@@ -1,32 +1,99 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iostream>
+#include <thread>
 #include "Turtle.hpp"
+#include "Trace.hpp"
 
 namespace lsys
 {
+    /**
+     * Smallest number of commands in a chunk of a parallel program.
+     */
+    const size_t parallel_chunk_size = 1 << 12;
+
     Turtle::Turtle(const Transform2d& transform, Canvas& canvas)
         : transform(transform)
         , initial_transform(transform)
         , canvas(canvas)
+        , segment_sink(nullptr)
+        , lattice_enabled(true)
+        , lattice_checked(false)
+        , lattice_program(false)
+        , lattice_origin(transform.position)
+        , lattice_state({{0, 0, 0, 0}, 0})
+        , thread_count(1)
     {
     }
 
     void Turtle::run()
     {
-        // Do a dry run to estimate canvas bounds
-        canvas.setAllowDrawing(false);
-        executeCommands();
-        canvas.setAllowDrawing(true);
+        LSYS_TRACE_SCOPE("Turtle::run");
 
-        // Restore the transform of the turtle
-        transform = initial_transform;
+        // Do a dry run to estimate canvas bounds, unless they are fixed
+        if (!canvas.hasViewport())
+        {
+            canvas.setAllowDrawing(false);
+            executeCommands();
+            canvas.setAllowDrawing(true);
+
+            // Restore the transform of the turtle
+            transform = initial_transform;
+        }
 
         // Now run and rasterize
         canvas.allocatePixels();
         executeCommands();
     }
 
+    void Turtle::run(SegmentSink& sink)
+    {
+        LSYS_TRACE_SCOPE("Turtle::run");
+
+        // No bounds are needed, so a single pass is enough
+        segment_sink = &sink;
+        executeCommands();
+        segment_sink = nullptr;
+    }
+
+    void Turtle::runBuffered(size_t chunk_size)
+    {
+        LSYS_TRACE_SCOPE("Turtle::runBuffered");
+
+        SegmentBuffer buffer(chunk_size, [this](const SegmentBuffer& chunk)
+        {
+            canvas.drawSegments(chunk);
+        });
+
+        // Do a dry run to estimate canvas bounds, unless they are fixed
+        if (!canvas.hasViewport())
+        {
+            canvas.setAllowDrawing(false);
+            run(buffer);
+            buffer.flush();
+            canvas.setAllowDrawing(true);
+
+            // Restore the transform of the turtle
+            transform = initial_transform;
+        }
+
+        // Now run and rasterize
+        canvas.allocatePixels();
+        run(buffer);
+        buffer.flush();
+    }
+
     void Turtle::executeCommands()
     {
+        if (thread_count > 1 && segment_sink == nullptr && executeCommandsParallel()) return;
+
+        if (lattice_enabled && isLatticeProgram())
+        {
+            executeCommandsLattice();
+            return;
+        }
+
         // Execute all commands
         for (const auto& i : command_queue)
         {
@@ -34,6 +101,497 @@ namespace lsys
         }
     }
 
+    void Turtle::executeChunk(bool first, bool lattice, SegmentSink* sink)
+    {
+        segment_sink = sink;
+
+        if (lattice && isLatticeProgram())
+        {
+            executeCommandsLattice(!first);
+        }
+        else
+        {
+            for (const auto& i : command_queue)
+            {
+                i->execute(*this);
+            }
+        }
+
+        segment_sink = nullptr;
+    }
+
+    bool Turtle::isLatticeProgram() const
+    {
+        if (transform.rotation % 45 != 0) return false;
+        if (lattice_checked) return lattice_program;
+
+        lattice_checked = true;
+        lattice_program = false;
+        lattice_commands.clear();
+        lattice_commands.reserve(command_queue.size());
+
+        for (const auto& command : command_queue)
+        {
+            if (!isLatticeCommand(*command)) return false;
+
+            TurtleCommandType type = command->getType();
+            int32_t value = 0;
+
+            if (type == TurtleCommandType::MoveForward)
+            {
+                value = static_cast<int32_t>(static_cast<const MoveForwardCommand&>(*command).distance);
+            }
+            else if (type == TurtleCommandType::Turn)
+            {
+                value = static_cast<const TurnCommand&>(*command).degrees / 45;
+            }
+
+            lattice_commands.push_back({type, value});
+        }
+
+        lattice_program = true;
+        return true;
+    }
+
+    bool Turtle::isLatticeCommand(const TurtleCommand& command)
+    {
+        switch (command.getType())
+        {
+            case TurtleCommandType::MoveForward:
+            {
+                float distance = static_cast<const MoveForwardCommand&>(command).distance;
+                return distance == std::floor(distance) && std::fabs(distance) <= (1 << 24);
+            }
+            case TurtleCommandType::Turn:
+                return static_cast<const TurnCommand&>(command).degrees % 45 == 0;
+            case TurtleCommandType::Custom:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    void Turtle::invalidateCompiledCommands()
+    {
+        lattice_checked = false;
+        lattice_commands.clear();
+        lattice_commands.shrink_to_fit();
+    }
+
+    bool Turtle::executeCommandsParallel()
+    {
+        LSYS_TRACE_SCOPE("Turtle::executeCommandsParallel");
+
+        // Only lattice programs have chunk effects that compose exactly, so floating-point programs run sequentially
+        if (command_queue.size() < 2 * parallel_chunk_size) return false;
+        if (!lattice_enabled || !isLatticeProgram()) return false;
+
+        /**
+         * A lattice state relative to a base: the state a chunk starts in (base -1), or an element of the stack the
+         * chunk starts with (base k for the k-th element from the top).
+         */
+        struct RelativeState
+        {
+            int64_t base;
+            LatticeState state;
+        };
+
+        /**
+         * What a chunk does to the state, stack and pen it starts with.
+         */
+        struct ChunkEffect
+        {
+            size_t pops = 0; // Elements of the starting stack the chunk pops
+            std::vector<RelativeState> pushed; // Elements the chunk leaves on top of the rest of the starting stack
+            RelativeState end = {-1, {{0, 0, 0, 0}, 0}};
+            int pen = -1; // Pen the chunk leaves: -1 if unchanged, 0 if up, 1 if down
+        };
+
+        /**
+         * What a chunk needs to run, and what it draws.
+         */
+        struct ChunkRun
+        {
+            LatticeState entry;
+            std::vector<LatticeState> entry_stack;
+            bool entry_pen_down;
+            bool has_moves = false;
+            Bounds2d bounds;
+            std::vector<Point2d> lines;
+        };
+
+        size_t total_chunks = std::min<size_t>(thread_count * 4, lattice_commands.size() / parallel_chunk_size);
+        auto chunkBegin = [&](size_t chunk)
+        {
+            return lattice_commands.size() * chunk / total_chunks;
+        };
+
+        auto forEachChunk = [&](auto work)
+        {
+            std::atomic<size_t> next_chunk(0);
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < thread_count; ++i)
+            {
+                workers.emplace_back([&]()
+                {
+                    for (size_t chunk = next_chunk++; chunk < total_chunks; chunk = next_chunk++)
+                    {
+                        work(chunk);
+                    }
+                });
+            }
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        };
+
+        // Step a command the way executeCommandsLattice does, returning whether it moved
+        auto step = [](const LatticeCommand& command, LatticeState& state, std::vector<LatticeState>& stack,
+                       bool& pen_down)
+        {
+            switch (command.type)
+            {
+                case TurtleCommandType::MoveForward:
+                    moveOnLattice(state, command.value);
+                    return true;
+                case TurtleCommandType::Turn:
+                    state.direction = ((state.direction + command.value) % 8 + 8) % 8;
+                    break;
+                case TurtleCommandType::PushState:
+                    stack.push_back(state);
+                    break;
+                case TurtleCommandType::PopState:
+                    if (stack.empty()) break;
+
+                    state = stack.back();
+                    stack.pop_back();
+                    break;
+                case TurtleCommandType::PenUp:
+                    pen_down = false;
+                    break;
+                case TurtleCommandType::PenDown:
+                    pen_down = true;
+                    break;
+                default:
+                    break;
+            }
+
+            return false;
+        };
+
+        // Find the effect of every chunk in parallel, relative to the state and stack it starts with
+        std::vector<ChunkEffect> effects(total_chunks);
+        forEachChunk([&](size_t chunk)
+        {
+            ChunkEffect& effect = effects[chunk];
+            RelativeState& current = effect.end;
+
+            for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+            {
+                const LatticeCommand& command = lattice_commands[i];
+                switch (command.type)
+                {
+                    case TurtleCommandType::MoveForward:
+                        moveOnLattice(current.state, command.value);
+                        break;
+                    case TurtleCommandType::Turn:
+                        current.state.direction = ((current.state.direction + command.value) % 8 + 8) % 8;
+                        break;
+                    case TurtleCommandType::PushState:
+                        effect.pushed.push_back(current);
+                        break;
+                    case TurtleCommandType::PopState:
+                        if (!effect.pushed.empty())
+                        {
+                            current = effect.pushed.back();
+                            effect.pushed.pop_back();
+                        }
+                        else
+                        {
+                            current = {static_cast<int64_t>(effect.pops++), {{0, 0, 0, 0}, 0}};
+                        }
+                        break;
+                    case TurtleCommandType::PenUp:
+                        effect.pen = 0;
+                        break;
+                    case TurtleCommandType::PenDown:
+                        effect.pen = 1;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        });
+
+        // Combine the effects in order, so every chunk starts in exactly the state a sequential run reaches there.
+        // The lattice arithmetic is exact, so combining the effects is too.
+        std::vector<ChunkRun> runs(total_chunks);
+        LatticeState state = {{0, 0, 0, 0}, ((transform.rotation / 45) % 8 + 8) % 8};
+        std::vector<LatticeState> stack;
+        bool pen_down = canvas.isPenDown();
+
+        for (size_t chunk = 0; chunk < total_chunks; ++chunk)
+        {
+            runs[chunk].entry = state;
+            runs[chunk].entry_stack = stack;
+            runs[chunk].entry_pen_down = pen_down;
+
+            const ChunkEffect& effect = effects[chunk];
+            if (effect.pops > stack.size())
+            {
+                // Pops of an empty stack do nothing, which the effect cannot know, so step the chunk instead
+                for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+                {
+                    step(lattice_commands[i], state, stack, pen_down);
+                }
+                continue;
+            }
+
+            auto resolve = [&](const RelativeState& relative)
+            {
+                const LatticeState& base = relative.base < 0 ? state : stack[stack.size() - 1 - relative.base];
+                LatticePosition offset = rotateOnLattice(relative.state.position, base.direction);
+
+                LatticeState resolved = base;
+                resolved.position.x_axis += offset.x_axis;
+                resolved.position.x_diagonal += offset.x_diagonal;
+                resolved.position.y_axis += offset.y_axis;
+                resolved.position.y_diagonal += offset.y_diagonal;
+                resolved.direction = (base.direction + relative.state.direction) % 8;
+                return resolved;
+            };
+
+            LatticeState end = resolve(effect.end);
+            std::vector<LatticeState> pushed;
+            for (const auto& relative : effect.pushed)
+            {
+                pushed.push_back(resolve(relative));
+            }
+
+            stack.resize(stack.size() - effect.pops);
+            stack.insert(stack.end(), pushed.begin(), pushed.end());
+            state = end;
+            if (effect.pen >= 0) pen_down = effect.pen == 1;
+        }
+
+        // Interpret the chunks from their entry states on all threads, keeping the lines drawn with the pen down
+        bool is_drawing = canvas.getAllowDrawing();
+        Point2d origin = transform.position;
+        forEachChunk([&](size_t chunk)
+        {
+            ChunkRun& run = runs[chunk];
+            LatticeState current = run.entry;
+            std::vector<LatticeState> local_stack = std::move(run.entry_stack);
+            bool is_pen_down = run.entry_pen_down;
+
+            Point2d position = getLatticePoint(origin, current.position);
+            for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+            {
+                if (!step(lattice_commands[i], current, local_stack, is_pen_down))
+                {
+                    if (lattice_commands[i].type == TurtleCommandType::PopState)
+                    {
+                        position = getLatticePoint(origin, current.position);
+                    }
+                    continue;
+                }
+
+                Point2d start = position;
+                Point2d end = getLatticePoint(origin, current.position);
+                position = end;
+                if (!run.has_moves)
+                {
+                    run.bounds = {start.x, start.y, start.x, start.y};
+                    run.has_moves = true;
+                }
+                run.bounds.min_x = std::min(run.bounds.min_x, std::min(start.x, end.x));
+                run.bounds.min_y = std::min(run.bounds.min_y, std::min(start.y, end.y));
+                run.bounds.max_x = std::max(run.bounds.max_x, std::max(start.x, end.x));
+                run.bounds.max_y = std::max(run.bounds.max_y, std::max(start.y, end.y));
+
+                if (is_drawing && is_pen_down)
+                {
+                    run.lines.push_back(start);
+                    run.lines.push_back(end);
+                }
+            }
+        });
+
+        if (!canvas.hasViewport())
+        {
+            Bounds2d bounds = canvas.getBounds();
+            for (const auto& run : runs)
+            {
+                if (!run.has_moves) continue;
+
+                bounds.min_x = std::min(bounds.min_x, run.bounds.min_x);
+                bounds.min_y = std::min(bounds.min_y, run.bounds.min_y);
+                bounds.max_x = std::max(bounds.max_x, run.bounds.max_x);
+                bounds.max_y = std::max(bounds.max_y, run.bounds.max_y);
+            }
+
+            const Bounds2d& current = canvas.getBounds();
+            bool grows = bounds.min_x < current.min_x || bounds.min_y < current.min_y
+                         || bounds.max_x > current.max_x || bounds.max_y > current.max_y;
+
+            // Lines drawn while the bounds grow are mapped with the bounds of their time, which only a sequential
+            // run reproduces. After a dry run the bounds no longer grow.
+            if (grows && is_drawing) return false;
+
+            canvas.updateBounds(Point2d(bounds.min_x, bounds.min_y));
+            canvas.updateBounds(Point2d(bounds.max_x, bounds.max_y));
+        }
+
+        if (is_drawing)
+        {
+            std::vector<Point2d> lines;
+            for (auto& run : runs)
+            {
+                lines.insert(lines.end(), run.lines.begin(), run.lines.end());
+                std::vector<Point2d>().swap(run.lines);
+            }
+
+            // The lines were already filtered by the pen of their time
+            canvas.penDown();
+            canvas.drawLines(lines, thread_count);
+        }
+
+        if (pen_down)
+        {
+            canvas.penDown();
+        }
+        else
+        {
+            canvas.penUp();
+        }
+
+        // Leave the same lattice state executeCommandsLattice would
+        lattice_origin = origin;
+        lattice_state = state;
+        lattice_stack = stack;
+
+        transform.position = getLatticePoint(origin, state.position);
+        transform.rotation = state.direction * 45;
+        return true;
+    }
+
+    void Turtle::executeCommandsLattice(bool resume)
+    {
+        if (!resume)
+        {
+            lattice_origin = transform.position;
+            lattice_state = {{0, 0, 0, 0}, ((transform.rotation / 45) % 8 + 8) % 8};
+            lattice_stack.clear();
+        }
+
+        // The position is always the point of the lattice state, so a resumed run continues from the transform
+        Point2d origin = lattice_origin;
+        LatticeState state = lattice_state;
+        std::vector<LatticeState>& stack = lattice_stack;
+
+        Point2d position = transform.position;
+        for (const auto& command : lattice_commands)
+        {
+            switch (command.type)
+            {
+                case TurtleCommandType::MoveForward:
+                {
+                    moveOnLattice(state, command.value);
+
+                    Point2d end = getLatticePoint(origin, state.position);
+                    if (segment_sink != nullptr)
+                    {
+                        if (canvas.isPenDown())
+                        {
+                            segment_sink->addSegment(position, end);
+                        }
+                    }
+                    else
+                    {
+                        canvas.drawLine(position, end);
+                    }
+                    position = end;
+                    break;
+                }
+                case TurtleCommandType::Turn:
+                {
+                    state.direction = ((state.direction + command.value) % 8 + 8) % 8;
+                    break;
+                }
+                case TurtleCommandType::PushState:
+                    stack.push_back(state);
+                    if (segment_sink != nullptr) segment_sink->pushState();
+                    break;
+                case TurtleCommandType::PopState:
+                    if (stack.empty()) break;
+
+                    state = stack.back();
+                    stack.pop_back();
+                    position = getLatticePoint(origin, state.position);
+                    if (segment_sink != nullptr) segment_sink->popState();
+                    break;
+                case TurtleCommandType::PenUp:
+                    canvas.penUp();
+                    if (segment_sink != nullptr) segment_sink->penUp();
+                    break;
+                case TurtleCommandType::PenDown:
+                    canvas.penDown();
+                    if (segment_sink != nullptr) segment_sink->penDown();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        lattice_state = state;
+        transform.position = position;
+        transform.rotation = state.direction * 45;
+    }
+
+    void Turtle::moveOnLattice(LatticeState& state, int64_t distance)
+    {
+        // Unit steps for each direction, which are axis-aligned for even directions and diagonal for odd ones
+        static const int step_x[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+        static const int step_y[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+        if (state.direction % 2 == 0)
+        {
+            state.position.x_axis += distance * step_x[state.direction];
+            state.position.y_axis += distance * step_y[state.direction];
+        }
+        else
+        {
+            state.position.x_diagonal += distance * step_x[state.direction];
+            state.position.y_diagonal += distance * step_y[state.direction];
+        }
+    }
+
+    LatticePosition Turtle::rotateOnLattice(const LatticePosition& position, int direction)
+    {
+        // Diagonal steps change both coordinates by the same amount, so their sum and difference are even
+        LatticePosition rotated = position;
+        for (int i = 0; i < (direction % 8 + 8) % 8; ++i)
+        {
+            LatticePosition next;
+            next.x_axis = (rotated.x_diagonal - rotated.y_diagonal) / 2;
+            next.y_axis = (rotated.x_diagonal + rotated.y_diagonal) / 2;
+            next.x_diagonal = rotated.x_axis - rotated.y_axis;
+            next.y_diagonal = rotated.x_axis + rotated.y_axis;
+            rotated = next;
+        }
+
+        return rotated;
+    }
+
+    Point2d Turtle::getLatticePoint(const Point2d& origin, const LatticePosition& position)
+    {
+        const double half_sqrt2 = std::sqrt(2.0) / 2.0;
+
+        return Point2d(static_cast<float>(origin.x + (position.x_axis + position.x_diagonal * half_sqrt2)),
+                       static_cast<float>(origin.y + (position.y_axis + position.y_diagonal * half_sqrt2)));
+    }
+
     #if 0
     void Turtle::executeCommandsDebug()
     {
@@ -48,9 +606,18 @@ namespace lsys
     }
     #endif
 
+    OptimizationStats Turtle::optimizeCommands(bool merge_moves)
+    {
+        invalidateCompiledCommands();
+
+        CommandOptimizer optimizer(merge_moves);
+        return optimizer.optimize(command_queue);
+    }
+
     void Turtle::clearCommands()
     {
         command_queue.clear();
+        invalidateCompiledCommands();
     }
 
     void Turtle::resetTransform()
@@ -61,36 +628,43 @@ namespace lsys
     void Turtle::moveForward(float distance)
     {
         command_queue.push_back(std::make_shared<MoveForwardCommand>(distance));
+        invalidateCompiledCommands();
     }
 
     void Turtle::turn(int degrees)
     {
         command_queue.push_back(std::make_shared<TurnCommand>(degrees));
+        invalidateCompiledCommands();
     }
 
     void Turtle::pushState()
     {
         command_queue.push_back(std::make_shared<PushStateCommand>());
+        invalidateCompiledCommands();
     }
 
     void Turtle::popState()
     {
         command_queue.push_back(std::make_shared<PopStateCommand>());
+        invalidateCompiledCommands();
     }
 
     void Turtle::penUp()
     {
         command_queue.push_back(std::make_shared<PenUpCommand>());
+        invalidateCompiledCommands();
     }
 
     void Turtle::penDown()
     {
         command_queue.push_back(std::make_shared<PenDownCommand>());
+        invalidateCompiledCommands();
     }
 
     void Turtle::addCommand(const std::shared_ptr<TurtleCommand>& command)
     {
         command_queue.push_back(command);
+        invalidateCompiledCommands();
     }
 
     //////////////////////////////////////////////////////////////
@@ -105,6 +679,11 @@ namespace lsys
         this->transform = transform;
     }
 
+    const Transform2d& Turtle::getInitialTransform() const
+    {
+        return initial_transform;
+    }
+
     Canvas& Turtle::getCanvas() const
     {
         return canvas;
@@ -120,6 +699,26 @@ namespace lsys
         return command_queue.size();
     }
 
+    bool Turtle::getLatticeEnabled() const
+    {
+        return lattice_enabled;
+    }
+
+    void Turtle::setLatticeEnabled(bool lattice_enabled)
+    {
+        this->lattice_enabled = lattice_enabled;
+    }
+
+    unsigned int Turtle::getThreadCount() const
+    {
+        return thread_count;
+    }
+
+    void Turtle::setThreadCount(unsigned int thread_count)
+    {
+        this->thread_count = thread_count > 0 ? thread_count : 1;
+    }
+
     void Turtle::printTurtleTransform() const
     {
         std::cout << "Turtle Position: {" << transform.position.x << ", " << transform.position.y << "}" << '\n';
@@ -15,18 +15,34 @@ namespace lsys
 
     void MoveForwardCommand::execute(Turtle& turtle)
     {
+        if (turtle.segment_sink != nullptr)
+        {
+            Point2d end = Canvas::moveFromPoint(turtle.transform.position, distance, turtle.transform.rotation);
+            if (turtle.canvas.isPenDown())
+            {
+                turtle.segment_sink->addSegment(turtle.transform.position, end);
+            }
+            turtle.transform.position = end;
+            return;
+        }
+
         Point2d end = turtle.canvas.drawLine(turtle.transform.position, distance, turtle.transform.rotation);
         turtle.transform.position = end;
     }
 
     void TurnCommand::execute(Turtle& turtle)
     {
-        turtle.transform.rotation = (turtle.transform.rotation + degrees) % 360;
+        turtle.transform.rotation = ((turtle.transform.rotation + degrees) % 360 + 360) % 360;
     }
 
     void PushStateCommand::execute(Turtle& turtle)
     {
         turtle.transformStack.push(turtle.transform);
+
+        if (turtle.segment_sink != nullptr)
+        {
+            turtle.segment_sink->pushState();
+        }
     }
 
     void PopStateCommand::execute(Turtle& turtle)
@@ -35,16 +51,65 @@ namespace lsys
 
         turtle.transform = turtle.transformStack.top();
         turtle.transformStack.pop();
+
+        if (turtle.segment_sink != nullptr)
+        {
+            turtle.segment_sink->popState();
+        }
     }
 
     void PenUpCommand::execute(Turtle& turtle)
     {
         turtle.getCanvas().penUp();
+
+        if (turtle.segment_sink != nullptr)
+        {
+            turtle.segment_sink->penUp();
+        }
     }
 
     void PenDownCommand::execute(Turtle& turtle)
     {
         turtle.getCanvas().penDown();
+
+        if (turtle.segment_sink != nullptr)
+        {
+            turtle.segment_sink->penDown();
+        }
+    }
+
+    TurtleCommandType TurtleCommand::getType() const
+    {
+        return TurtleCommandType::Custom;
     }
-}
 
+    TurtleCommandType MoveForwardCommand::getType() const
+    {
+        return TurtleCommandType::MoveForward;
+    }
+
+    TurtleCommandType TurnCommand::getType() const
+    {
+        return TurtleCommandType::Turn;
+    }
+
+    TurtleCommandType PushStateCommand::getType() const
+    {
+        return TurtleCommandType::PushState;
+    }
+
+    TurtleCommandType PopStateCommand::getType() const
+    {
+        return TurtleCommandType::PopState;
+    }
+
+    TurtleCommandType PenUpCommand::getType() const
+    {
+        return TurtleCommandType::PenUp;
+    }
+
+    TurtleCommandType PenDownCommand::getType() const
+    {
+        return TurtleCommandType::PenDown;
+    }
+}
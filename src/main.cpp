@@ -3,6 +3,7 @@
 #include "Canvas.hpp"
 #include "Turtle.hpp"
 #include "BmpImage.hpp"
+#include "SvgWriter.hpp"
 
 void drawTurtleTriangle()
 {
@@ -39,7 +40,7 @@ void drawBinaryFractal()
     lsystem.addRule('0', "1[+0]-0");
     lsystem.addRule('1', "11");
 
-    lsystem.evaluate(10);
+    if (!lsystem.evaluate(10)) return;
     lsystem.draw(turtle);
 
     // Write turtle canvas as a BMP image
@@ -59,7 +60,7 @@ void drawKochCurve()
     lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-90));
     lsystem.addRule('F', "F+F-F-F+F");
 
-    lsystem.evaluate(6);
+    if (!lsystem.evaluate(6)) return;
     lsystem.draw(turtle);
 
     // Write turtle canvas as a BMP image
@@ -81,7 +82,7 @@ void drawSierpinskiTriangle()
     lsystem.addRule('F', "F-G+F+G-F");
     lsystem.addRule('G', "GG");
 
-    lsystem.evaluate(7);
+    if (!lsystem.evaluate(7)) return;
     lsystem.draw(turtle);
 
     // Write turtle canvas as a BMP image
@@ -105,7 +106,7 @@ void drawFractalPlant()
     lsystem.addRule('X', "F+[[X]-X]-F[-FX]+X");
     lsystem.addRule('F', "FF");
 
-    lsystem.evaluate(6);
+    if (!lsystem.evaluate(6)) return;
     lsystem.draw(turtle);
 
     // Write turtle canvas as a BMP image
@@ -113,6 +114,30 @@ void drawFractalPlant()
     output_image.writeToFile("fractal_plant.bmp");
 }
 
+void drawFractalPlantSvg()
+{
+    lsys::Canvas canvas({0, 0, 0, 0}, 3000, 3000);
+    lsys::Turtle turtle({{400, 50}, 60}, canvas);
+
+    lsys::Lsystem lsystem;
+    lsystem.setAxiom("X");
+    lsystem.addSymbol('X', nullptr);
+    lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(15));
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(25));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-25));
+    lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+    lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+    lsystem.addRule('X', "F+[[X]-X]-F[-FX]+X");
+    lsystem.addRule('F', "FF");
+
+    if (!lsystem.evaluate(6)) return;
+
+    // Stream the segments as an SVG image, the canvas pixels are never allocated
+    lsys::io::SvgWriter output_image("fractal_plant.svg");
+    lsystem.draw(turtle, output_image);
+    output_image.close();
+}
+
 int main()
 {
     std::cout << "Lsys" << std::endl;
@@ -123,6 +148,7 @@ int main()
     drawKochCurve();
     drawSierpinskiTriangle();
     drawFractalPlant();
+    drawFractalPlantSvg();
 
     std::cout << "\nDone." << std::endl;
 
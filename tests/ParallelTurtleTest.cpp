@@ -0,0 +1,139 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "Turtle.hpp"
+
+/*
+ * Regression test of the parallel turtle: every program must draw the same pixels whatever the thread count.
+ */
+
+/**
+ * Draw an L-system with a number of threads.
+ *
+ * @param lsystem The evaluated L-system
+ * @param start Initial transform of the turtle
+ * @param canvas The canvas to draw on
+ * @param threads Number of threads
+ *
+ * @return The transform the turtle ends in
+ */
+lsys::Transform2d draw(lsys::Lsystem& lsystem, const lsys::Transform2d& start, lsys::Canvas& canvas,
+                       unsigned int threads)
+{
+    lsys::Turtle turtle(start, canvas);
+    turtle.setThreadCount(threads);
+    lsystem.draw(turtle);
+
+    return turtle.getTransform();
+}
+
+/**
+ * Check that an L-system draws the same pixels with 2 and 4 threads as with 1, and leaves the turtle in exactly the
+ * same transform.
+ *
+ * @param name Name of the case, for the report
+ * @param lsystem The evaluated L-system
+ * @param start Initial transform of the turtle
+ * @param make_canvas Function creating a fresh canvas
+ *
+ * @return Whether the pixels and the transforms are identical
+ */
+template<typename MakeCanvas>
+bool checkThreadCounts(const std::string& name, lsys::Lsystem& lsystem, const lsys::Transform2d& start,
+                       MakeCanvas make_canvas)
+{
+    std::unique_ptr<lsys::Canvas> expected = make_canvas();
+    lsys::Transform2d expected_end = draw(lsystem, start, *expected, 1);
+
+    for (unsigned int threads : {2u, 4u})
+    {
+        std::unique_ptr<lsys::Canvas> canvas = make_canvas();
+        lsys::Transform2d end = draw(lsystem, start, *canvas, threads);
+
+        if (end.position.x != expected_end.position.x || end.position.y != expected_end.position.y
+            || end.rotation != expected_end.rotation)
+        {
+            std::cerr << name << ": the turtle ends elsewhere with " << threads << " threads" << std::endl;
+            return false;
+        }
+
+        for (int y = 0; y < canvas->getHeight(); ++y)
+        {
+            for (int x = 0; x < canvas->getWidth(); ++x)
+            {
+                if (canvas->getPixels()[y][x].r != expected->getPixels()[y][x].r)
+                {
+                    std::cerr << name << ": pixel " << x << "," << y << " differs with " << threads << " threads"
+                              << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    std::cout << name << ": ok" << std::endl;
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    // A push in the first chunk popped in the second, followed by a pop of the empty stack, which does nothing.
+    // The 8192 commands are split into two chunks of 4096.
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("[" + std::string(4095, 'F') + "]+" + std::string(1000, 'F') + "]" + std::string(3093, 'F'));
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(1));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(90));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-45));
+        lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+        lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+        lsystem.evaluate(0);
+
+        ok &= checkThreadCounts("unbalanced pops", lsystem, {{10, 10}, 0}, []()
+        {
+            return std::unique_ptr<lsys::Canvas>(new lsys::Canvas({0, 0, 0, 0}, 4200, 4200));
+        });
+    }
+
+    // A lattice program, which must stay on the lattice
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("F");
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(2));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(90));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-90));
+        lsystem.addRule('F', "F+F-F-F+F");
+        lsystem.evaluate(6);
+
+        ok &= checkThreadCounts("lattice program", lsystem, {{10, 10}, 0}, []()
+        {
+            return std::unique_ptr<lsys::Canvas>(new lsys::Canvas({0, 0, 0, 0}, 1500, 800));
+        });
+    }
+
+    // A floating-point program with branches, grown from the canvas bounds by a dry run
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("X");
+        lsystem.addSymbol('X', nullptr);
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(3));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(25));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-25));
+        lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+        lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+        lsystem.addRule('X', "F+[[X]-X]-F[-FX]+X");
+        lsystem.addRule('F', "FF");
+        lsystem.evaluate(6);
+
+        ok &= checkThreadCounts("float program", lsystem, {{100, 10}, 60}, []()
+        {
+            return std::unique_ptr<lsys::Canvas>(new lsys::Canvas({0, 0, 0, 0}, 900, 900));
+        });
+    }
+
+    return ok ? 0 : 1;
+}
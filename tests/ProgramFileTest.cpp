@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "Canvas.hpp"
+#include "Lsystem.hpp"
+#include "Turtle.hpp"
+
+/*
+ * Regression test of the storage modes: a spilled axiom and a saved and loaded program must draw the same pixels as
+ * the evaluated L-system.
+ */
+
+/**
+ * Set up the binary fractal, whose 45 degree branches run on the lattice.
+ *
+ * @param lsystem The L-system to set up
+ */
+void setupBinaryFractal(lsys::Lsystem& lsystem)
+{
+    lsystem.setAxiom("0");
+    lsystem.addSymbol('0', nullptr);
+    lsystem.addSymbol('1', std::make_shared<lsys::MoveForwardCommand>(5));
+    lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+    lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+    lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(45));
+    lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-45));
+    lsystem.addRule('0', "1[+0]-0");
+    lsystem.addRule('1', "11");
+}
+
+/**
+ * Draw an evaluated L-system on a fresh canvas.
+ *
+ * @param lsystem The evaluated L-system
+ * @param lattice Whether the turtle may run on the lattice
+ *
+ * @return The canvas drawn on
+ */
+std::unique_ptr<lsys::Canvas> draw(lsys::Lsystem& lsystem, bool lattice)
+{
+    std::unique_ptr<lsys::Canvas> canvas(new lsys::Canvas({0, 0, 0, 0}, 5000, 5000, lsys::PixelFormat::Mono1));
+    lsys::Turtle turtle({{2500, 0}, 90}, *canvas);
+    turtle.setLatticeEnabled(lattice);
+    lsystem.draw(turtle);
+
+    return canvas;
+}
+
+/**
+ * Check that two canvases have the same pixels set.
+ *
+ * @param name Name of the case, for the report
+ * @param expected The canvas drawn from the evaluated L-system
+ * @param canvas The canvas to check
+ *
+ * @return Whether the pixels are identical
+ */
+bool checkPixels(const std::string& name, const lsys::Canvas& expected, const lsys::Canvas& canvas)
+{
+    for (unsigned short y = 0; y < canvas.getHeight(); ++y)
+    {
+        for (unsigned short x = 0; x < canvas.getWidth(); ++x)
+        {
+            if (canvas.isPixelSet(x, y) != expected.isPixelSet(x, y))
+            {
+                std::cerr << name << ": pixel " << x << "," << y << " differs" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    std::cout << name << ": ok" << std::endl;
+    return true;
+}
+
+int main()
+{
+    const unsigned int depth = 10;
+    const std::string filename = "lsys-test-program.lsp";
+
+    bool ok = true;
+
+    for (bool lattice : {true, false})
+    {
+        std::string mode = lattice ? " (lattice)" : " (float)";
+
+        lsys::Lsystem lsystem;
+        setupBinaryFractal(lsystem);
+        lsystem.evaluate(depth);
+        std::unique_ptr<lsys::Canvas> expected = draw(lsystem, lattice);
+
+        // An axiom spilled to disk while it is evaluated
+        {
+            lsys::Lsystem spilled;
+            setupBinaryFractal(spilled);
+            spilled.setSpillDirectory(".");
+            spilled.evaluate(depth);
+
+            ok &= checkPixels("spilled axiom" + mode, *expected, *draw(spilled, lattice));
+        }
+
+        // A program saved with the initial transform it is drawn with, so its bounds are reused
+        {
+            lsys::Canvas scratch({0, 0, 0, 0}, 1, 1);
+            lsys::Turtle turtle({{2500, 0}, 90}, scratch);
+            turtle.setLatticeEnabled(lattice);
+
+            lsys::Lsystem loaded;
+            setupBinaryFractal(loaded);
+            if (!lsystem.saveProgram(filename, turtle) || !loaded.loadProgram(filename, depth))
+            {
+                std::cerr << "loaded program" << mode << ": the program could not be saved and loaded" << std::endl;
+                ok = false;
+            }
+            else
+            {
+                ok &= checkPixels("loaded program" + mode, *expected, *draw(loaded, lattice));
+            }
+
+            std::remove(filename.c_str());
+        }
+    }
+
+    return ok ? 0 : 1;
+}
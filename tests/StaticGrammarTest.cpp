@@ -0,0 +1,102 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include "Lsystem.hpp"
+#include "StaticGrammars.hpp"
+
+/*
+ * Regression test of the compile-time grammars: every grammar of the catalogue must evaluate to the same string as
+ * the runtime Lsystem with the same axiom and rules.
+ */
+
+/**
+ * Check that a compile-time grammar evaluates to the same string as a runtime L-system, for every depth up to a
+ * maximum.
+ *
+ * @tparam G The compile-time grammar
+ * @param name Name of the case, for the report
+ * @param lsystem The runtime L-system, not evaluated yet
+ * @param max_depth Largest depth checked
+ *
+ * @return Whether the strings are identical
+ */
+template<typename G>
+bool checkGrammar(const std::string& name, const lsys::Lsystem& lsystem, unsigned int max_depth)
+{
+    for (unsigned int depth = 0; depth <= max_depth; ++depth)
+    {
+        lsys::Lsystem evaluated;
+        evaluated.setAxiom(lsystem.getAxiom());
+        evaluated.setSymbols(lsystem.getSymbols());
+        evaluated.setRules(lsystem.getRules());
+        evaluated.evaluate(depth);
+
+        if (lsys::grammar::StaticLsystem<G>::evaluate(depth) != evaluated.getEvaluatedAxiom())
+        {
+            std::cerr << name << ": the evaluated axiom differs at depth " << depth << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << name << ": ok" << std::endl;
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("0");
+        lsystem.addSymbol('1', std::make_shared<lsys::MoveForwardCommand>(5));
+        lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+        lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(45));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-45));
+        lsystem.addRule('0', "1[+0]-0");
+        lsystem.addRule('1', "11");
+
+        ok &= checkGrammar<lsys::grammar::BinaryFractal>("binary fractal", lsystem, 8);
+    }
+
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("F");
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(5));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(90));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-90));
+        lsystem.addRule('F', "F+F-F-F+F");
+
+        ok &= checkGrammar<lsys::grammar::KochCurve>("Koch curve", lsystem, 5);
+    }
+
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("F-G-G");
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(20));
+        lsystem.addSymbol('G', std::make_shared<lsys::MoveForwardCommand>(20));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(120));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-120));
+        lsystem.addRule('F', "F-G+F+G-F");
+        lsystem.addRule('G', "GG");
+
+        ok &= checkGrammar<lsys::grammar::SierpinskiTriangle>("Sierpinski triangle", lsystem, 6);
+    }
+
+    {
+        lsys::Lsystem lsystem;
+        lsystem.setAxiom("X");
+        lsystem.addSymbol('F', std::make_shared<lsys::MoveForwardCommand>(15));
+        lsystem.addSymbol('+', std::make_shared<lsys::TurnCommand>(25));
+        lsystem.addSymbol('-', std::make_shared<lsys::TurnCommand>(-25));
+        lsystem.addSymbol('[', std::make_shared<lsys::PushStateCommand>());
+        lsystem.addSymbol(']', std::make_shared<lsys::PopStateCommand>());
+        lsystem.addRule('X', "F+[[X]-X]-F[-FX]+X");
+        lsystem.addRule('F', "FF");
+
+        ok &= checkGrammar<lsys::grammar::FractalPlant>("fractal plant", lsystem, 5);
+    }
+
+    return ok ? 0 : 1;
+}